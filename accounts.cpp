@@ -0,0 +1,285 @@
+/*
+User Registry (see accounts.h)
+
+File: one record per account (kind account_kind), channel = name, payload =
+[u8 log2 N][u8 r][u8 p][u8 unused][16 bytes salt][32 bytes scrypt hash].
+The cost is stored per account, so it can be raised later without
+invalidating old passwords. A torn record at the end is cut at startup.
+*/
+
+#include <iostream>
+#include <map>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#include "accounts.h"
+#include "clock.h"
+#include "admin.h"
+#include "profiler.h"
+#include "server.h"
+
+namespace {
+
+const uint8_t account_kind = 128; // not a MessageKind, accounts never reach the log
+const size_t salt_size = 16;
+const size_t hash_size = 32;
+
+// scrypt cost for new accounts: N = 2^14, r = 8 is 16 MB and tens of ms per hash
+const uint8_t cost_log2_n = 14;
+const uint8_t cost_r = 8;
+const uint8_t cost_p = 1;
+
+struct Account {
+    uint8_t log2_n, r, p;
+    std::string salt;
+    std::string hash;
+};
+
+struct AuthRequest {
+    bool create;
+    std::string name;
+    std::string password;
+    int reactor;
+    std::function<void(AuthResult)> done;
+    uint64_t queued_ns;
+};
+
+std::mutex registry_mutex; // guards accounts (reactors take it too, so it's never held across I/O)
+std::map<std::string, Account> accounts;
+std::mutex file_mutex; // guards writes to file
+int file = -1;
+
+std::mutex queue_mutex; // guards queue
+std::condition_variable queue_ready;
+std::deque<AuthRequest> queue;
+size_t queue_limit = 0;
+int worker_count = 0;
+
+// Read by the admin socket while the hashing threads update them
+struct AuthStats {
+    std::atomic<uint64_t> logins{0};
+    std::atomic<uint64_t> registered{0};
+    std::atomic<uint64_t> failed{0};
+    std::atomic<uint64_t> busy{0};      // turned away, queue full
+    std::atomic<uint64_t> hashes{0};
+    std::atomic<uint64_t> hash_ns{0};
+    std::atomic<uint64_t> max_hash_ns{0};
+    std::atomic<uint64_t> wait_ns{0};   // queued before a thread took it
+    std::atomic<uint64_t> max_wait_ns{0};
+    std::atomic<uint64_t> max_queue{0};
+} stats;
+
+void raiseMax(std::atomic<uint64_t>& max, uint64_t value) {
+    uint64_t seen = max.load();
+    while (value > seen && !max.compare_exchange_weak(seen, value)) {}
+}
+
+// scrypt(): empty on failure (out of memory)
+std::string scrypt(const std::string& password, const Account& params) {
+    std::string hash(hash_size, '\0');
+    uint64_t start = monotonicNs();
+    int ok = EVP_PBE_scrypt(password.data(), password.size(), (const unsigned char*)params.salt.data(),
+                            params.salt.size(), 1ull << params.log2_n, params.r, params.p, 256ull << 20,
+                            (unsigned char*)&hash[0], hash.size());
+    uint64_t took = monotonicNs() - start;
+    stats.hashes++;
+    stats.hash_ns += took;
+    raiseMax(stats.max_hash_ns, took);
+    return ok == 1 ? hash : "";
+}
+
+// saveAccount(): appends the account's record and syncs it
+bool saveAccount(const std::string& name, const Account& account) {
+    std::string payload;
+    payload += (char)account.log2_n;
+    payload += (char)account.r;
+    payload += (char)account.p;
+    payload += '\0';
+    payload += account.salt;
+    payload += account.hash;
+
+    std::string bytes;
+    if (!appendRecord(bytes, account_kind, 0, realtimeNs(), name, "", payload)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(file_mutex);
+    return write(file, bytes.data(), bytes.size()) == (ssize_t)bytes.size() && fdatasync(file) == 0;
+}
+
+AuthResult registerAccount(const std::string& name, const std::string& password) {
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        if (accounts.count(name)) return auth_taken;
+    }
+    Account account{cost_log2_n, cost_r, cost_p, std::string(salt_size, '\0'), ""};
+    if (RAND_bytes((unsigned char*)&account.salt[0], salt_size) != 1) return auth_error;
+    account.hash = scrypt(password, account);
+    if (account.hash.empty()) return auth_error;
+
+    // Claimed before the (slow) save, checked again: another thread may have registered it while we hashed
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        if (!accounts.emplace(name, account).second) return auth_taken;
+    }
+    if (saveAccount(name, account)) return auth_ok;
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    accounts.erase(name);
+    return auth_error;
+}
+
+AuthResult checkLogin(const std::string& name, const std::string& password) {
+    Account account;
+    bool known;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        auto found = accounts.find(name);
+        known = found != accounts.end();
+        if (known) account = found->second;
+    }
+    // Unknown names cost a hash too, so timing doesn't tell which names exist
+    if (!known) account = Account{cost_log2_n, cost_r, cost_p, std::string(salt_size, '\0'), ""};
+
+    std::string hash = scrypt(password, account);
+    if (hash.empty()) return auth_error;
+    if (!known) return auth_wrong;
+    return CRYPTO_memcmp(hash.data(), account.hash.data(), hash_size) == 0 ? auth_ok : auth_wrong;
+}
+
+void runHasher() {
+    // Below the reactors: when cores are short, chat traffic gets the CPU and logins wait
+    setpriority(PRIO_PROCESS, gettid(), 10);
+    profileThread("auth");
+
+    while (true) {
+        AuthRequest request;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_ready.wait(lock, []() { return !queue.empty(); });
+            request = std::move(queue.front());
+            queue.pop_front();
+        }
+        uint64_t waited = monotonicNs() - request.queued_ns;
+        stats.wait_ns += waited;
+        raiseMax(stats.max_wait_ns, waited);
+
+        AuthResult result = request.create ? registerAccount(request.name, request.password)
+                                           : checkLogin(request.name, request.password);
+        OPENSSL_cleanse(&request.password[0], request.password.size());
+
+        if (result == auth_ok) (request.create ? stats.registered : stats.logins)++;
+        else stats.failed++;
+
+        // Back to the reactor holding the session, through its inbox
+        std::function<void(AuthResult)> done = std::move(request.done);
+        post(request.reactor, [done, result]() { done(result); });
+    }
+}
+
+// loadAccounts(): reads every record in the file, cutting a torn tail
+bool loadAccounts(const std::string& path) {
+    MappedSegment mapped;
+    if (!mapped.map(path)) return true; // new or empty
+
+    size_t at = 0;
+    while (verifyRecord(mapped.data + at, mapped.size - at) == record_ok) {
+        RecordView record(mapped.data + at);
+        at += record.size();
+        std::string_view payload = record.payload();
+        if (record.kind() != account_kind || payload.size() != 4 + salt_size + hash_size) continue;
+
+        Account& account = accounts[std::string(record.channel())]; // a later record replaces an earlier one
+        account.log2_n = payload[0];
+        account.r = payload[1];
+        account.p = payload[2];
+        account.salt = std::string(payload.substr(4, salt_size));
+        account.hash = std::string(payload.substr(4 + salt_size, hash_size));
+    }
+    if (at < mapped.size) {
+        std::cerr << "Users: cut " << mapped.size - at << " torn bytes from " << path << std::endl;
+        if (truncate(path.c_str(), at) < 0) return false;
+    }
+    return true;
+}
+
+std::string authStats() {
+    size_t queued;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        queued = queue.size();
+    }
+    size_t registered;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        registered = accounts.size();
+    }
+    uint64_t hashes = stats.hashes, done = stats.logins + stats.registered + stats.failed;
+    double hash_ms = hashes ? stats.hash_ns / 1e6 / hashes : 0.0;
+
+    // What the pool can sustain at the current hash cost (the queue absorbs bursts above it)
+    char line[512];
+    snprintf(line, sizeof(line),
+             "auth_accounts %zu\nauth_logins %llu\nauth_registered %llu\nauth_failed %llu\nauth_busy %llu\n"
+             "auth_queue %zu\nauth_queue_max %llu\nauth_hash_avg_ms %.1f\nauth_hash_max_ms %.1f\n"
+             "auth_wait_avg_ms %.1f\nauth_wait_max_ms %.1f\nauth_capacity_per_s %.0f\n",
+             registered, (unsigned long long)stats.logins.load(), (unsigned long long)stats.registered.load(),
+             (unsigned long long)stats.failed.load(), (unsigned long long)stats.busy.load(), queued,
+             (unsigned long long)stats.max_queue.load(), hash_ms, stats.max_hash_ns / 1e6,
+             done ? stats.wait_ns / 1e6 / done : 0.0, stats.max_wait_ns / 1e6,
+             hash_ms > 0 ? worker_count * 1000 / hash_ms : 0.0);
+    return line;
+}
+
+} // namespace
+
+bool openAccounts(const std::string& path, int workers, size_t limit) {
+    if (!loadAccounts(path)) {
+        std::cerr << "Can't read users file " << path << std::endl;
+        return false;
+    }
+    file = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (file < 0) {
+        std::cerr << "Can't open users file " << path << std::endl;
+        return false;
+    }
+    std::cout << "Users: " << accounts.size() << " account(s) in " << path << std::endl;
+
+    queue_limit = limit;
+    worker_count = std::max(1, workers);
+    for (int i = 0; i < worker_count; i++) std::thread(runHasher).detach();
+    addAdminStats(authStats);
+    return true;
+}
+
+bool accountsEnabled() {
+    return file >= 0;
+}
+
+bool isRegistered(const std::string& name) {
+    if (file < 0) return false;
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    return accounts.count(name) > 0;
+}
+
+bool requestAuth(bool create, const std::string& name, const std::string& password, int reactor,
+                 std::function<void(AuthResult)> done) {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (queue.size() >= queue_limit) {
+            stats.busy++;
+            return false;
+        }
+        queue.push_back(AuthRequest{create, name, password, reactor, std::move(done), monotonicNs()});
+        raiseMax(stats.max_queue, queue.size());
+    }
+    queue_ready.notify_one();
+    return true;
+}
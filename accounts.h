@@ -0,0 +1,43 @@
+/*
+User Registry (registered accounts)
+
+With --users <file>, names can be registered with a password:
+    /register <name> <password>    (as the first line, instead of a username)
+    /login <name> <password>
+A registered name can only be used through /login; any other name still
+works the old way, for as long as the connection lasts.
+
+Accounts are records (record.h) appended to one file, read back at
+startup. Passwords are hashed with scrypt, which is slow and memory-hard
+on purpose, so hashing never runs on a reactor: requests go to a small
+pool of hashing threads through a bounded queue (a full queue turns the
+login away instead of growing), and each result is posted back to the
+reactor holding the session.
+*/
+
+#pragma once
+
+#include <string>
+#include <functional>
+
+enum AuthResult {
+    auth_ok,
+    auth_wrong, // unknown name or wrong password (not told apart)
+    auth_taken, // /register of a name that exists
+    auth_error  // the account couldn't be saved
+};
+
+// openAccounts(): loads the registry at path (created if missing) and starts the hashing threads
+bool openAccounts(const std::string& path, int workers, size_t queue_limit);
+bool accountsEnabled();
+
+// isRegistered(): the name belongs to an account (false when there's no registry)
+bool isRegistered(const std::string& name);
+
+/*
+requestAuth(): queues a /register (create) or /login for the hashing threads.
+done(result) later runs on reactor `reactor`. False, and done never runs,
+if the queue is full
+*/
+bool requestAuth(bool create, const std::string& name, const std::string& password, int reactor,
+                 std::function<void(AuthResult)> done);
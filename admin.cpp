@@ -0,0 +1,109 @@
+/*
+Admin Socket (see admin.h)
+
+Commands are rare and cheap, so one thread serves them one at a time
+with plain blocking calls (a client gets 2 seconds to send its line).
+Commands are registered before startAdmin() and never change after.
+*/
+
+#include <iostream>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <map>
+#include <vector>
+#include <thread>
+
+#include "admin.h"
+
+namespace {
+
+struct Command {
+    std::string help;
+    std::function<std::string(const std::string&)> handler;
+};
+
+std::map<std::string, Command> commands;
+std::vector<std::function<std::string()>> stats_sections;
+
+std::string runCommand(const std::string& line) {
+    size_t space = line.find(' ');
+    std::string name = line.substr(0, space);
+    std::string args = space == std::string::npos ? "" : line.substr(space + 1);
+
+    auto found = commands.find(name);
+    if (found != commands.end()) return found->second.handler(args);
+
+    std::string reply = "Commands:\n";
+    for (auto& entry : commands) reply += "  " + entry.first + " - " + entry.second.help + "\n";
+    return reply;
+}
+
+void serve(int listen_fd) {
+    while (true) {
+        int client = accept(listen_fd, NULL, NULL);
+        if (client < 0) continue;
+
+        timeval timeout = {2, 0};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        // Reads up to the first newline (or until the client stops sending)
+        std::string line;
+        char buffer[512];
+        ssize_t got;
+        while (line.find('\n') == std::string::npos && (got = read(client, buffer, sizeof(buffer))) > 0) {
+            line.append(buffer, got);
+        }
+        line = line.substr(0, line.find('\n'));
+        line.erase(line.find_last_not_of(" \r\t") + 1);
+
+        std::string reply = runCommand(line);
+        size_t sent = 0;
+        while (sent < reply.size()) {
+            ssize_t n = send(client, reply.data() + sent, reply.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) break;
+            sent += n;
+        }
+        close(client);
+    }
+}
+
+} // namespace
+
+void addAdminCommand(const std::string& name, const std::string& help,
+                     std::function<std::string(const std::string& args)> handler) {
+    commands[name] = Command{help, handler};
+}
+
+void addAdminStats(std::function<std::string()> section) {
+    stats_sections.push_back(section);
+}
+
+bool startAdmin(const std::string& path) {
+    addAdminCommand("stats", "metrics, one \"name value\" per line", [](const std::string&) {
+        std::string reply;
+        for (auto& section : stats_sections) reply += section();
+        return reply;
+    });
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (listen_fd < 0 || path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Admin socket failed!" << std::endl;
+        return false;
+    }
+    strcpy(address.sun_path, path.c_str());
+    unlink(path.c_str()); // left over from the last run
+
+    if (::bind(listen_fd, (sockaddr*)&address, sizeof(address)) < 0 || listen(listen_fd, 16) < 0) {
+        std::cerr << "Admin socket bind failed!" << std::endl;
+        return false;
+    }
+
+    std::cout << "Admin socket on " << path << std::endl;
+    std::thread(serve, listen_fd).detach();
+    return true;
+}
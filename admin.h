@@ -0,0 +1,25 @@
+/*
+Admin Socket
+
+A Unix domain socket for operators, separate from the chat port:
+    echo stats | nc -U chat_admin.sock
+
+Each connection sends one command line and gets a plain-text reply,
+then the connection is closed. Subsystems register their own commands,
+and "stats" collects every registered metrics section.
+*/
+
+#pragma once
+
+#include <string>
+#include <functional>
+
+// addAdminCommand(): name -> handler (gets the rest of the line, returns the reply)
+void addAdminCommand(const std::string& name, const std::string& help,
+                     std::function<std::string(const std::string& args)> handler);
+
+// addAdminStats(): a section of "name value" lines included in the stats command
+void addAdminStats(std::function<std::string()> section);
+
+// startAdmin(): listens on the given path and serves commands on its own thread
+bool startAdmin(const std::string& path);
@@ -0,0 +1,128 @@
+/*
+Allocation Profiling (see alloc.h)
+
+The counters can't allocate (they're updated from inside operator new),
+so each thread takes a fixed slot the first time it counts something.
+Threads past the last slot share the overflow slot, with atomic adds.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include "alloc.h"
+#include "admin.h"
+
+thread_local int alloc_tag = alloc_other;
+
+namespace {
+
+const char* tag_names[alloc_tag_count] = {"other", "accept", "parse", "broadcast", "presence", "history"};
+
+const int max_slots = 256; // the last one is shared
+
+struct alignas(64) AllocSlot {
+    std::atomic<uint64_t> count[alloc_tag_count];
+    std::atomic<uint64_t> bytes[alloc_tag_count];
+};
+
+AllocSlot slots[max_slots];
+std::atomic<int> next_slot{0};
+std::atomic<bool> profiling{false};
+
+thread_local int my_slot = -1;
+
+void bump(std::atomic<uint64_t>& counter, uint64_t by, bool shared) {
+    if (shared) counter.fetch_add(by, std::memory_order_relaxed);
+    else counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+}
+
+void countAlloc(size_t size) {
+    if (my_slot < 0) my_slot = std::min(next_slot.fetch_add(1, std::memory_order_relaxed), max_slots - 1);
+    bool shared = my_slot == max_slots - 1;
+    AllocSlot& slot = slots[my_slot];
+    bump(slot.count[alloc_tag], 1, shared);
+    bump(slot.bytes[alloc_tag], size, shared);
+}
+
+void* allocate(size_t size) {
+    if (profiling.load(std::memory_order_relaxed)) countAlloc(size);
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void sum(uint64_t (&count)[alloc_tag_count], uint64_t (&bytes)[alloc_tag_count]) {
+    int used = std::min(next_slot.load(), max_slots);
+    for (int t = 0; t < alloc_tag_count; t++) {
+        count[t] = bytes[t] = 0;
+        for (int i = 0; i < used; i++) {
+            count[t] += slots[i].count[t].load(std::memory_order_relaxed);
+            bytes[t] += slots[i].bytes[t].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+} // namespace
+
+// The global hook: every new/new[] in the process goes through here (delete is plain free)
+void* operator new(size_t size) { return allocate(size); }
+void* operator new[](size_t size) { return allocate(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+void startAllocProfiling(bool on) {
+    profiling.store(on);
+    addAdminStats(allocStats);
+    addAdminCommand("allocs", "allocations by code path (allocs on|off|reset)", [](const std::string& args) {
+        if (args == "on" || args == "off") {
+            profiling.store(args == "on");
+            return std::string("Allocation profiling ") + args + "\n";
+        }
+        if (args == "reset") {
+            allocReset();
+            return std::string("Allocation counters reset\n");
+        }
+        return allocReport();
+    });
+}
+
+std::string allocReport() {
+    uint64_t count[alloc_tag_count], bytes[alloc_tag_count];
+    sum(count, bytes);
+    std::string out = profiling.load() ? "" : "(profiling is off, counts are from while it was on)\n";
+    char line[128];
+    snprintf(line, sizeof(line), "%-10s %12s %14s %8s\n", "path", "allocs", "bytes", "avg");
+    out += line;
+    for (int t = 0; t < alloc_tag_count; t++) {
+        snprintf(line, sizeof(line), "%-10s %12llu %14llu %8.0f\n", tag_names[t], (unsigned long long)count[t],
+                 (unsigned long long)bytes[t], count[t] ? (double)bytes[t] / count[t] : 0.0);
+        out += line;
+    }
+    return out;
+}
+
+std::string allocStats() {
+    if (!profiling.load()) return "";
+    uint64_t count[alloc_tag_count], bytes[alloc_tag_count];
+    sum(count, bytes);
+    std::string out;
+    for (int t = 0; t < alloc_tag_count; t++) {
+        out += std::string("alloc_") + tag_names[t] + "_count " + std::to_string(count[t]) + "\n";
+        out += std::string("alloc_") + tag_names[t] + "_bytes " + std::to_string(bytes[t]) + "\n";
+    }
+    return out;
+}
+
+void allocReset() {
+    for (AllocSlot& slot : slots) {
+        for (int t = 0; t < alloc_tag_count; t++) {
+            slot.count[t].store(0, std::memory_order_relaxed);
+            slot.bytes[t].store(0, std::memory_order_relaxed);
+        }
+    }
+}
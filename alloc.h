@@ -0,0 +1,55 @@
+/*
+Allocation Profiling
+
+Counts heap allocations (operator new) and their bytes by what the
+thread was doing at the time: code paths mark themselves with an
+AllocScope, which sets a thread-local tag and puts the previous one back
+when it ends, so nested paths (a broadcast inside a parse) are charged
+to the innermost one.
+
+Opt-in (--alloc-profile on, or "allocs on" on the admin socket). While off,
+operator new costs one relaxed load more than malloc. While on, each
+allocation is two increments on counters that belong to the allocating
+thread, so threads never share a cache line for it.
+
+    echo allocs | nc -U chat_admin.sock        per-tag counts and bytes
+    echo allocs reset | nc -U chat_admin.sock  start a fresh measurement
+    echo allocs on|off | nc -U chat_admin.sock counting on or off (counts are kept)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+enum AllocTag {
+    alloc_other,     // anything not in a scope below
+    alloc_accept,    // new connections
+    alloc_parse,     // reading input and handling lines/commands
+    alloc_broadcast, // numbering, fan-out, handoffs and deliveries
+    alloc_presence,  // joins and leaves (membership lists, notices)
+    alloc_history,   // history cache and log
+    alloc_tag_count
+};
+
+extern thread_local int alloc_tag;
+
+class AllocScope {
+public:
+    explicit AllocScope(AllocTag tag) : outer(alloc_tag) { alloc_tag = tag; }
+    ~AllocScope() { alloc_tag = outer; }
+
+private:
+    int outer;
+};
+
+// startAllocProfiling(): adds the admin command and stats (before startAdmin), counting from now if on
+void startAllocProfiling(bool on);
+
+// allocReport(): one line per tag (count, bytes, average size)
+std::string allocReport();
+
+// allocStats(): "alloc_<tag>_count" / "alloc_<tag>_bytes" lines for the stats command (empty while off)
+std::string allocStats();
+
+void allocReset();
@@ -0,0 +1,107 @@
+/*
+Reactor Load Balancing (see balance.h)
+*/
+
+#include <mutex>
+#include <thread>
+#include <chrono>
+
+#include "balance.h"
+#include "clock.h"
+#include "admin.h"
+#include "server.h"
+
+namespace {
+
+const size_t max_moves = 256; // sessions moved per round at most
+
+std::mutex busy_mutex; // guards busy_pct (the balancer thread and the admin socket)
+std::vector<double> busy_pct; // of each reactor, over the last round
+std::atomic<uint64_t> rounds{0};
+std::atomic<uint64_t> sheds{0};
+
+void runBalancer(int interval_ms, int tolerance_pct) {
+    std::vector<uint64_t> last_busy(reactors.size(), 0);
+    uint64_t last_ns = monotonicNs();
+    bool settling = false;
+
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+        uint64_t now = monotonicNs();
+        std::vector<double> pct(reactors.size());
+        for (size_t i = 0; i < reactors.size(); i++) {
+            uint64_t busy = reactors[i]->busy_ns.load(std::memory_order_relaxed);
+            pct[i] = 100.0 * (busy - last_busy[i]) / (now - last_ns);
+            last_busy[i] = busy;
+        }
+        last_ns = now;
+        {
+            std::lock_guard<std::mutex> lock(busy_mutex);
+            busy_pct = pct;
+        }
+        rounds++;
+        if (settling) { // this round still had the last move in it
+            settling = false;
+            continue;
+        }
+
+        int hot = std::max_element(pct.begin(), pct.end()) - pct.begin();
+        int cold = std::min_element(pct.begin(), pct.end()) - pct.begin();
+        if (pct[hot] - pct[cold] <= tolerance_pct) continue;
+
+        double share = (pct[hot] - pct[cold]) / 2 / pct[hot];
+        char line[160];
+        snprintf(line, sizeof(line), "[balance] reactor %d at %.0f%%, reactor %d at %.0f%%: moving ~%.0f%% of %d's work",
+                 hot, pct[hot], cold, pct[cold], share * 100, hot);
+        logLine(line);
+        post(hot, [hot, cold, share]() { shedSessions(*reactors[hot], cold, share, max_moves); });
+        sheds++;
+        settling = true;
+    }
+}
+
+std::string balanceStats() {
+    std::string out;
+    {
+        std::lock_guard<std::mutex> lock(busy_mutex);
+        for (size_t i = 0; i < busy_pct.size(); i++) {
+            out += "reactor_" + std::to_string(i) + "_busy_pct " + std::to_string((int)(busy_pct[i] + 0.5)) + "\n";
+        }
+    }
+    return out + "balance_rounds " + std::to_string(rounds.load()) + "\n" +
+           "balance_sheds " + std::to_string(sheds.load()) + "\n";
+}
+
+// moveByHand(): "move <from> <to> <count>", the busiest sessions first
+std::string moveByHand(const std::string& args) {
+    int from, to, count;
+    if (sscanf(args.c_str(), "move %d %d %d", &from, &to, &count) != 3 || from < 0 || to < 0 || count <= 0 ||
+        from >= (int)reactors.size() || to >= (int)reactors.size() || from == to) {
+        return "Usage: balance move <from reactor> <to reactor> <sessions>\n";
+    }
+    post(from, [from, to, count]() { shedSessions(*reactors[from], to, 1.0, count); });
+    return "Moving up to " + std::to_string(count) + " session(s) from reactor " + std::to_string(from) +
+           " to reactor " + std::to_string(to) + "\n";
+}
+
+} // namespace
+
+void startBalancer(int interval_ms, int tolerance_pct) {
+    addAdminStats(balanceStats);
+    addAdminCommand("balance", "reactor load and sessions (balance move <from> <to> <n> moves some)",
+                    [](const std::string& args) {
+        if (!args.empty()) return moveByHand(args);
+        std::lock_guard<std::mutex> lock(busy_mutex);
+        std::string out;
+        for (size_t i = 0; i < reactors.size(); i++) {
+            char line[96];
+            snprintf(line, sizeof(line), "reactor %zu: %u sessions, %s busy\n", i,
+                     reactors[i]->watch.sessions.load(std::memory_order_relaxed),
+                     i < busy_pct.size() ? (std::to_string((int)(busy_pct[i] + 0.5)) + "%").c_str() : "?");
+            out += line;
+        }
+        return out;
+    });
+    if (interval_ms <= 0 || reactors.size() < 2) return;
+    std::thread(runBalancer, interval_ms, tolerance_pct).detach();
+}
@@ -0,0 +1,23 @@
+/*
+Reactor Load Balancing
+
+SO_REUSEPORT spreads connections evenly as they arrive, not the work
+they bring later: a reactor can end up holding the busy clients while
+the others wait in select(). The balancer thread compares the
+reactors' busy time (time in loop passes, measured around each pass)
+every --balance-ms, and when the busiest and the least busy are further
+apart than --balance-tolerance percentage points, it asks the busiest
+to move about half the difference to the other one (shedSessions in
+server.cpp): its busiest sessions by the reads and frames they had
+since the last round, with their sockets, buffers, rooms and topics.
+It then sits out a round, so the next comparison sees the result.
+
+Only session work moves this way; a room's fan-out stays on its owner.
+The admin socket shows the last round's numbers (balance), and moves
+sessions by hand (balance move <from> <to> <count>).
+*/
+
+#pragma once
+
+// startBalancer(): interval_ms = 0 leaves the automatic balancing off (moving by hand still works)
+void startBalancer(int interval_ms, int tolerance_pct);
@@ -10,19 +10,256 @@ Key Ideas:
 - utilizes threading for send and recieve
 - Uses I/O blocking for commication
 - handles disconect
+- speaks the compact wire (see wire.h on the server): names are sent once, then ids,
+  and every message has its room and seq
+- keeps recent history on disk, so startup shows the room at once and only asks for what's new
 */
 
 #include <iostream>
 #include <cstring>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <thread> // provides same benifit as select()
+#include <mutex>
+#include <map>
+#include <deque>
+#include <unordered_map>
+
+#include "record.h"
+#include "clock.h"
 
 // Global: allows intertwine between threads
 int sock_fd; // file descriptor used for connecting to server
 bool running = true; // Intializes the client running for shutdown between threads
 
+const uint8_t chat_kind = 0; // MessageKind chat_message (server.h)
+const uint8_t epoch_kind = 254; // cache file only: the numbering epoch its records belong to (seq field)
+
+// The server's id -> name dictionary, as it defined them (only the receiving thread uses it)
+std::unordered_map<uint64_t, std::string> names;
+
+// ------------------- History Cache -------------------
+/*
+The last messages of every room we've been in, kept in a local file of
+records (record.h, like the server's log). At startup the file is
+mmap'd and the room is shown straight from it, before the server has
+said anything; then the server is only asked for what came after the
+highest seq we have of that room (/since <seq>:<epoch> <room>).
+
+Seqs only mean something in the server's numbering epoch (wire.h), which
+the file starts with. When the server says it has a new one (its rooms
+started over from 1), the file is emptied: what we have can't be matched
+with what it sends anymore.
+
+The file is append-only while running, and rewritten with just what's
+kept when it has grown to more than twice that
+*/
+
+const size_t cache_per_room = 200;
+
+struct CachedRoom {
+    std::deque<std::string_view> records; // oldest first: into the mapping, then into owned
+    std::deque<std::string> owned;        // records received this run (always the tail of records)
+    uint64_t mark = 0;                    // highest seq we have
+};
+
+// Our own lines come back too (numbered), they're kept but not shown again
+std::mutex sent_mutex;
+std::deque<std::string> sent; // bodies sent and not back yet, oldest first
+std::string own_name;         // set before the receiving thread starts
+
+std::mutex cache_mutex; // the receiving thread adds, the input thread shows rooms
+std::map<std::string, CachedRoom, std::less<>> cache;
+uint64_t cache_epoch = 0; // 0 = none yet
+int cache_fd = -1;
+const char* cache_map = nullptr;
+size_t cache_map_size = 0;
+
+// keepRecord(): adds a record to a room, dropping its oldest past cache_per_room
+void keepRecord(CachedRoom& room, std::string_view record) {
+    room.records.push_back(record);
+    if (room.records.size() > cache_per_room) {
+        room.records.pop_front();
+        if (room.owned.size() > room.records.size()) room.owned.pop_front();
+    }
+}
+
+/*
+loadCache(): maps the cache file and indexes it by room (nothing is copied).
+A torn record at the end (we were killed mid-write) is cut off
+*/
+bool loadCache(const std::string& path) {
+    cache_fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (cache_fd < 0) return false;
+
+    struct stat info;
+    if (fstat(cache_fd, &info) < 0 || info.st_size == 0) return true;
+    void* mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, cache_fd, 0);
+    if (mapped == MAP_FAILED) return false;
+    cache_map = static_cast<const char*>(mapped);
+    cache_map_size = info.st_size;
+
+    size_t at = 0;
+    size_t kept_bytes = 0;
+    while (verifyRecord(cache_map + at, cache_map_size - at) == record_ok) {
+        RecordView record(cache_map + at);
+        if (record.kind() == epoch_kind) {
+            cache_epoch = record.seq();
+            at += record.size();
+            continue;
+        }
+        auto found = cache.find(record.channel());
+        if (found == cache.end()) found = cache.emplace(std::string(record.channel()), CachedRoom()).first;
+        keepRecord(found->second, std::string_view(cache_map + at, record.size()));
+        found->second.mark = std::max(found->second.mark, record.seq());
+        at += record.size();
+    }
+    if (at < cache_map_size && ftruncate(cache_fd, at) < 0) return false;
+    for (auto& entry : cache) {
+        for (std::string_view record : entry.second.records) kept_bytes += record.size();
+    }
+    if (at <= 2 * kept_bytes) return true;
+
+    // Mostly records that fell out of the window: rewrite it with just the kept ones, and load that
+    std::string tmp = path + ".tmp";
+    int out = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (out < 0) return true; // still usable as it is
+    std::string epoch;
+    bool written = !appendRecord(epoch, epoch_kind, cache_epoch, 0, "", "", "") ||
+                   write(out, epoch.data(), epoch.size()) == (ssize_t)epoch.size();
+    for (auto& entry : cache) {
+        for (std::string_view record : entry.second.records) {
+            written = written && write(out, record.data(), record.size()) == (ssize_t)record.size();
+        }
+    }
+    close(out);
+    if (!written || rename(tmp.c_str(), path.c_str()) < 0) return true;
+
+    cache.clear();
+    munmap(const_cast<char*>(cache_map), cache_map_size);
+    close(cache_fd);
+    return loadCache(path);
+}
+
+// numberingEpoch(): the server's epoch ('E'), a new one empties the cache
+void numberingEpoch(uint64_t epoch) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    if (epoch == cache_epoch) return;
+    cache.clear(); // the mapping stays, nothing points into it anymore
+    cache_epoch = epoch;
+    if (cache_fd < 0 || ftruncate(cache_fd, 0) < 0) return;
+    std::string record;
+    if (appendRecord(record, epoch_kind, epoch, 0, "", "", "")) (void)write(cache_fd, record.data(), record.size());
+}
+
+// cacheMessage(): keeps a chat message from the server, false if we already had it
+bool cacheMessage(const std::string& room_name, uint64_t seq, const std::string& text) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    CachedRoom& room = cache[room_name];
+    if (seq <= room.mark) return false;
+    room.mark = seq;
+
+    std::string record;
+    if (!appendRecord(record, chat_kind, seq, realtimeNs(), room_name, text, text)) {
+        return true;
+    }
+    room.owned.push_back(std::move(record));
+    keepRecord(room, room.owned.back());
+    if (cache_fd >= 0) (void)write(cache_fd, room.owned.back().data(), room.owned.back().size());
+    return true;
+}
+
+// showRoom(): prints what we have of a room (right away, nothing asked from the server)
+void showRoom(const std::string& name) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto found = cache.find(name);
+    if (found == cache.end()) return;
+    for (std::string_view record : found->second.records) {
+        std::cout << RecordView(record.data()).text() << "\n";
+    }
+    std::cout << std::flush;
+}
+
+// sendLine(): one line of the chat protocol, as a record
+void sendLine(const std::string& line) {
+    std::string record;
+    if (!appendRecord(record, chat_kind, 0, 0, "", "", line)) return;
+    send(sock_fd, record.data(), record.size(), 0);
+}
+
+// ownLine(): is this the next of our own lines coming back? ("alice: hi" for "hi", not "bob: hi")
+bool ownLine(std::string_view text) {
+    std::lock_guard<std::mutex> lock(sent_mutex);
+    if (sent.empty() || text != own_name + ": " + sent.front()) return false;
+    sent.pop_front();
+    return true;
+}
+
+// sendMark(): tells the server how much of a room we have, before joining it
+void sendMark(const std::string& room) {
+    uint64_t mark, epoch;
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        auto found = cache.find(room);
+        if (found == cache.end()) return;
+        mark = found->second.mark;
+        epoch = cache_epoch;
+    }
+    sendLine("/since " + std::to_string(mark) + ":" + std::to_string(epoch) + " " + room);
+}
+
+/*
+handleFrame(): one frame of the compact wire.
+Returns its size, 0 if it isn't all here yet, -1 if it isn't a frame
+*/
+long handleFrame(const char* start, const char* end) {
+    const char* p = start;
+    if (p == end) return 0;
+    char tag = *p++;
+    uint64_t id, room = 0, user = 0, seq, size;
+    uint8_t kind = chat_kind;
+
+    if (tag == 'E') { // the numbering our marks have to be in
+        if (!readVarint(p, end, id)) return 0;
+        numberingEpoch(id);
+        return p - start;
+    }
+    if (tag == 'D') { // a name, used by id from now on
+        if (!readVarint(p, end, id) || !readVarint(p, end, size) || (uint64_t)(end - p) < size) return 0;
+        names[id] = std::string(p, size);
+        return p + size - start;
+    }
+    if (tag == 'M') {
+        if (!readVarint(p, end, room) || !readVarint(p, end, user)) return 0;
+    } else if (tag == 'X') {
+        if (p == end) return 0;
+        kind = *p++;
+        if (!readVarint(p, end, room)) return 0;
+    } else {
+        return -1;
+    }
+    if (!readVarint(p, end, seq) || !readVarint(p, end, size)) return 0;
+    if (size > max_record) return -1;
+    if ((uint64_t)(end - p) < size) return 0;
+
+    std::string text(p, size);
+    if (tag == 'M') text = names[user] + ": " + text;
+    long used = p + size - start;
+
+    // Chat messages we already have (replayed on a join) aren't shown twice, nor our own
+    if (kind == chat_kind && room != 0 && !cacheMessage(names[room], seq, text)) return used;
+    if (kind == chat_kind && ownLine(text)) return used;
+
+    // Formats the recieved message
+    std::cout << "\r\033[K"; // Clears entire line before
+    std::cout << text << std::endl;
+    return used;
+}
+
 /*
 recieveMessage(): reads the messages from server,
 stops after server or client disconnects.
@@ -30,14 +267,15 @@ stops after server or client disconnects.
 This thread is used for just reading
 */
 void recieveMessage() {
-    char buffer[1024];
+    char buffer[4096];
+    std::string pending; // bytes after the last whole frame (frame not finished yet)
 
     while(running) {
         // Clears the buffer, preventing contamination
         memset(buffer, 0, sizeof(buffer));
 
         // reads value sent from server
-        int valread = read(sock_fd, buffer, 1024);
+        int valread = read(sock_fd, buffer, sizeof(buffer));
 
         // If the value is 0 = closed, and 0 > means error
         if (valread <= 0) {
@@ -46,14 +284,29 @@ void recieveMessage() {
             break;
         }
 
-        // Formats the recieved message within buffer
-        std::cout << "\r\033[K"; // Clears entire line before
-        std::cout << buffer << std::endl;
+        // Server sends one message per frame, and several can arrive in one read
+        pending.append(buffer, valread);
+        size_t at = 0;
+        long used;
+        while ((used = handleFrame(pending.data() + at, pending.data() + pending.size())) > 0) at += used;
+        pending.erase(0, at);
+        if (used < 0) {
+            std::cout << "\nBad data from server" << std::endl;
+            running = false;
+            break;
+        }
         std::cout << "You: " << std::flush; // flush is used to force immediate print
     }
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+    // --------- History Cache ---------
+
+    // Shown before connecting: everyone starts in the lobby
+    std::string cache_path = argc > 1 ? argv[1] : "chat_history.cache";
+    if (!loadCache(cache_path)) std::cerr << "Can't use history cache " << cache_path << std::endl;
+    showRoom("lobby");
+
     // --------- Socket Setup ---------
 
     // Create socket
@@ -85,15 +338,24 @@ int main() {
     
     std::cout << "Connected to server!" << std::endl;
 
+    // Compact wire from here on (see wire.h on the server)
+    send(sock_fd, wire_ids_magic, sizeof(wire_ids_magic), 0);
+
     // Setup for Username: prompts for username
     std::string username;
     std::cout << "Enter your username: ";
     std::getline(std::cin, username);
+    own_name = username.substr(0, username.find_last_not_of(" \r\t") + 1); // as the server keeps it
+    if (own_name.compare(0, 7, "/login ") == 0 || own_name.compare(0, 10, "/register ") == 0) {
+        size_t at = own_name.find(' ') + 1;
+        own_name = own_name.substr(at, own_name.find(' ', at) - at);
+    }
 
-    // Sends the username to server
-    send(sock_fd, username.c_str(), username.length(), 0);
+    // Sends the username to server, after how much of the lobby we have (it's joined right after)
+    sendMark("lobby");
+    sendLine(username);
 
-    std::cout << "\nStart chatting (type 'quit' to exit):\n" << std::endl;
+    std::cout << "\nStart chatting (type 'quit' to exit, '/join <room>' to switch rooms):\n" << std::endl;
 
 // --------- Threading Communication ---------
 
@@ -113,9 +375,19 @@ int main() {
             break;
         }
 
+        // Switching rooms: show what we have of it, the server sends the rest
+        if (message.compare(0, 6, "/join ") == 0 && message.size() > 6) {
+            sendMark(message.substr(6));
+            showRoom(message.substr(6));
+        }
+
         // Send only non-empty messages to the server
         if(!message.empty()) {
-            send(sock_fd, message.c_str(), message.length(), 0);
+            if (message[0] != '/') {
+                std::lock_guard<std::mutex> lock(sent_mutex);
+                sent.push_back(message.substr(0, message.find_last_not_of(" \r\t") + 1));
+            }
+            sendLine(message);
         }
     }
     
@@ -0,0 +1,31 @@
+/*
+Clocks
+
+One place for the clocks every module reads:
+    realtimeNs()   CLOCK_REALTIME, the clock of Message::time_ns, kernel
+                   receive timestamps and anything compared across
+                   processes (relay latency between local nodes)
+    monotonicNs()  CLOCK_MONOTONIC, for intervals and deadlines
+    monotonicMs()  the same in milliseconds
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <time.h>
+
+inline uint64_t realtimeNs() {
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+inline uint64_t monotonicNs() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+inline uint64_t monotonicMs() {
+    return monotonicNs() / 1000000;
+}
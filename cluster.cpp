@@ -0,0 +1,697 @@
+/*
+Cluster Links and Relay Trees
+
+One thread runs its own select() loop over the links to other nodes.
+Every node connects out to every peer and only sends on those outbound
+links; what it receives comes in on the peers' outbound links. A link
+that fails is retried every second, and a node whose link is down is
+never picked as a relay (its subtree is handed to the next node).
+
+Peer messages are length-prefixed: [u32 length][u8 type][payload]
+
+Presence (presence.h) rides on the same links: every gossip_ms each
+node sends each peer the users that changed since what it last sent
+there, and each peer acknowledges the version it now holds. A peer
+that reports a gap (a lost link, a restart on either side) gets a
+resend from what it has, or a snapshot if that's too old.
+
+Every relay records how long the message took since the origin sent it,
+grouped by depth in the tree, and prints the totals every few seconds.
+*/
+
+#include <iostream>
+#include <cstring>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <future>
+
+#include "cluster.h"
+#include "clock.h"
+#include "codec.h"
+#include "presence.h"
+#include "admin.h"
+#include "server.h"
+
+namespace {
+
+enum PeerMessage : uint8_t {
+    peer_hello = 1, // [str node id]
+    peer_relay = 2, // [u64 origin ns][u8 depth][str origin][str channel][str text][u16 n][str node]*n
+    peer_presence = 3,     // [u64 epoch][u64 from][u64 to][u32 n]([str user][u8 online])*n
+    peer_presence_ack = 4, // [u64 epoch][u64 version][u8 gap] of the receiver's replica of our part
+};
+
+const size_t presence_keep = 100000; // departures remembered for peers that are behind
+const int presence_expire_s = 10;    // a node unheard of for this long counts as offline, users and all
+
+// ------------------- Encoding -------------------
+
+// message(): wraps a payload with its length and type
+Frame message(PeerMessage type, const std::string& payload) {
+    std::string out;
+    putU32(out, payload.size() + 1);
+    putU8(out, type);
+    out += payload;
+    return std::make_shared<const std::string>(std::move(out));
+}
+
+// ------------------- State (cluster thread only) -------------------
+
+// Link: our outbound connection to one peer (we only ever send on it)
+struct Link {
+    PeerConfig peer;
+    int fd = -1;
+    bool connected = false;
+    std::deque<Frame> outbox;
+    size_t out_offset = 0;
+    time_t retry_at = 0;
+};
+
+// Inbound: a peer's outbound connection to us (we only read from it)
+struct Inbound {
+    int fd;
+    std::string peer_id;
+    std::string inbuf;
+};
+
+struct DepthStats {
+    uint64_t count = 0;
+    double total_ms = 0;
+    double max_ms = 0;
+};
+
+ClusterConfig config;
+bool enabled = false;
+Inbox cluster_inbox;
+int listen_fd = -1;
+std::map<std::string, Link> links; // by node id
+std::vector<Inbound> inbound;
+std::map<std::string, std::string> zone_of; // node id -> zone
+
+// Feed: how far a peer's replica of our presence is
+struct Feed {
+    uint64_t sent = 0;  // version sent up to
+    uint64_t acked = 0; // version it acknowledged (0 = nothing of this epoch)
+};
+
+PresenceState presence(0);
+std::map<std::string, Feed> feeds;          // by node id
+std::map<std::string, bool> acks_due;       // node id -> reporting a gap
+std::map<std::string, time_t> lost_since;   // nodes whose link to us is down
+uint64_t gossip_at = 0;
+
+std::atomic<uint64_t> presence_local{0}, presence_remote{0};
+std::atomic<uint64_t> presence_batches{0}, presence_snapshots{0}, presence_users_sent{0}, presence_bytes{0};
+std::atomic<uint64_t> presence_gaps{0};
+
+std::map<int, DepthStats> depth_stats;
+bool stats_changed = false;
+time_t next_report = 0;
+
+void forward(uint64_t origin_ns, int depth, const std::string& origin, const std::string& channel,
+             const std::string& text, const std::vector<std::string>& nodes);
+
+/*
+closeLink(): drops a failed link. Presence and acks queued on it are simply
+sent again later, but the relays are re-planned: the peer was the root of
+each one's subtree, so its nodes go out through the repaired tree instead
+*/
+void closeLink(Link& link) {
+    if (link.fd >= 0) close(link.fd);
+    if (link.connected) logLine("[cluster] link to " + link.peer.id + " down");
+    link.fd = -1;
+    link.connected = false;
+    std::deque<Frame> queued;
+    queued.swap(link.outbox);
+    Feed& feed = feeds[link.peer.id];
+    feed.sent = feed.acked; // presence resumes from what it acknowledged
+    link.out_offset = 0;
+    link.retry_at = time(NULL) + 1;
+
+    for (const Frame& frame : queued) {
+        if (frame->size() < 5 || (uint8_t)(*frame)[4] != peer_relay) continue;
+        Reader in{frame->data() + 5, frame->size() - 5};
+        uint64_t origin_ns = in.number(8);
+        int depth = in.number(1);
+        std::string origin = in.string();
+        std::string channel = in.string();
+        std::string text = in.string();
+        size_t count = in.number(2);
+        std::vector<std::string> nodes;
+        for (size_t i = 0; i < count && in.ok; i++) nodes.push_back(in.string());
+        if (in.ok && !nodes.empty()) forward(origin_ns, depth, origin, channel, text, nodes);
+    }
+}
+
+// startConnect(): non-blocking connect, finished once select() says writable
+void startConnect(Link& link) {
+    link.fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (link.fd < 0) return;
+    fcntl(link.fd, F_SETFL, fcntl(link.fd, F_GETFL) | O_NONBLOCK);
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(link.peer.port);
+    if (inet_pton(AF_INET, link.peer.host.c_str(), &addr.sin_addr) <= 0 ||
+        (connect(link.fd, (sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS)) {
+        closeLink(link);
+    }
+}
+
+// finishConnect(): connection is up, introduce ourselves
+void finishConnect(Link& link) {
+    int error = 0;
+    socklen_t len = sizeof(error);
+    getsockopt(link.fd, SOL_SOCKET, SO_ERROR, &error, &len);
+    if (error != 0) {
+        closeLink(link);
+        return;
+    }
+    link.connected = true;
+    std::string hello;
+    putString(hello, config.node_id);
+    link.outbox.push_front(message(peer_hello, hello));
+    logLine("[cluster] link to " + link.peer.id + " up");
+}
+
+void flushLink(Link& link) {
+    while (!link.outbox.empty()) {
+        const std::string& data = *link.outbox.front();
+        ssize_t sent = send(link.fd, data.data() + link.out_offset, data.size() - link.out_offset, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) closeLink(link);
+            return;
+        }
+        link.out_offset += sent;
+        if (link.out_offset == data.size()) {
+            link.outbox.pop_front();
+            link.out_offset = 0;
+        }
+    }
+}
+
+bool linkUp(const std::string& node) {
+    auto found = links.find(node);
+    return found != links.end() && found->second.connected;
+}
+
+const std::string& zoneOf(const std::string& node) {
+    static const std::string unknown = "";
+    auto found = zone_of.find(node);
+    return found == zone_of.end() ? unknown : found->second;
+}
+
+// ------------------- Relay Trees -------------------
+
+/*
+planSubtrees(): splits the nodes still to reach into at most K subtrees.
+
+Topology-aware: nodes are grouped by zone (our own zone first) and
+zones are kept whole where possible, so most tree edges stay inside a
+zone and each zone is entered through as few links as possible.
+*/
+std::vector<std::vector<std::string>> planSubtrees(std::vector<std::string> nodes) {
+    std::sort(nodes.begin(), nodes.end(), [](const std::string& a, const std::string& b) {
+        bool a_far = zoneOf(a) != config.zone;
+        bool b_far = zoneOf(b) != config.zone;
+        if (a_far != b_far) return !a_far;
+        if (zoneOf(a) != zoneOf(b)) return zoneOf(a) < zoneOf(b);
+        return a < b;
+    });
+
+    // One group per zone, in the order above
+    std::vector<std::vector<std::string>> groups;
+    for (const std::string& node : nodes) {
+        if (groups.empty() || zoneOf(groups.back().front()) != zoneOf(node)) groups.push_back({});
+        groups.back().push_back(node);
+    }
+
+    size_t k = std::min((size_t)config.fanout, nodes.size());
+    if (groups.size() >= k) {
+        // More zones than subtrees: whole zones, biggest zone into the smallest subtree
+        std::stable_sort(groups.begin(), groups.end(), [](const std::vector<std::string>& a,
+                                                          const std::vector<std::string>& b) {
+            return a.size() > b.size();
+        });
+        std::vector<std::vector<std::string>> subtrees(k);
+        for (auto& group : groups) {
+            auto smallest = std::min_element(subtrees.begin(), subtrees.end(), [](const std::vector<std::string>& a,
+                                                                                 const std::vector<std::string>& b) {
+                return a.size() < b.size();
+            });
+            smallest->insert(smallest->end(), group.begin(), group.end());
+        }
+        return subtrees;
+    }
+
+    // Fewer zones than subtrees: split the biggest zone in half until there are K
+    while (groups.size() < k) {
+        auto biggest = std::max_element(groups.begin(), groups.end(), [](const std::vector<std::string>& a,
+                                                                         const std::vector<std::string>& b) {
+            return a.size() < b.size();
+        });
+        std::vector<std::string> half(biggest->begin() + biggest->size() / 2, biggest->end());
+        biggest->resize(biggest->size() / 2);
+        groups.insert(biggest + 1, half);
+    }
+    return groups;
+}
+
+/*
+forward(): sends a channel message on to the nodes below us.
+Each subtree goes to its first reachable node, which becomes the relay
+for the rest of it (a relay that's down is simply skipped, repairing
+the tree around it)
+*/
+void forward(uint64_t origin_ns, int depth, const std::string& origin, const std::string& channel,
+             const std::string& text, const std::vector<std::string>& nodes) {
+    for (const std::vector<std::string>& subtree : planSubtrees(nodes)) {
+        auto root = std::find_if(subtree.begin(), subtree.end(), linkUp);
+        if (root == subtree.end()) {
+            logLine("[cluster] no live relay for " + std::to_string(subtree.size()) + " node(s), dropped");
+            continue;
+        }
+
+        std::string payload;
+        putU64(payload, origin_ns);
+        putU8(payload, depth);
+        putString(payload, origin);
+        putString(payload, channel);
+        putString(payload, text);
+        putU16(payload, subtree.size() - 1);
+        for (const std::string& node : subtree) {
+            if (node != *root) putString(payload, node);
+        }
+
+        Link& link = links[*root];
+        link.outbox.push_back(message(peer_relay, payload));
+        flushLink(link);
+    }
+}
+
+// onRelay(): delivers a channel message to our own members, then passes it down
+void onRelay(Reader& in) {
+    uint64_t origin_ns = in.number(8);
+    int depth = in.number(1);
+    std::string origin = in.string();
+    std::string channel = in.string();
+    std::string text = in.string();
+    size_t count = in.number(2);
+    std::vector<std::string> nodes;
+    for (size_t i = 0; i < count && in.ok; i++) nodes.push_back(in.string());
+    if (!in.ok) return;
+
+    // Local delivery on the channel's owner reactor (no sender to skip here)
+    MessagePtr message = makeMessage(chat_message, channel, text);
+    int owner = ownerOf(channel);
+    post(owner, [owner, channel, message]() { broadcast(*reactors[owner], channel, message, 0); });
+
+    DepthStats& stats = depth_stats[depth];
+    double ms = (realtimeNs() - origin_ns) / 1e6;
+    stats.count++;
+    stats.total_ms += ms;
+    stats.max_ms = std::max(stats.max_ms, ms);
+    stats_changed = true;
+
+    if (!nodes.empty()) forward(origin_ns, depth + 1, origin, channel, text, nodes);
+}
+
+// ------------------- Presence -------------------
+
+void sendPresence(Link& link, const PresenceBatch& batch) {
+    std::string payload;
+    putU64(payload, batch.epoch);
+    putU64(payload, batch.from);
+    putU64(payload, batch.to);
+    putU32(payload, batch.users.size());
+    for (auto& user : batch.users) {
+        putString(payload, user.first);
+        putU8(payload, user.second);
+    }
+    Frame frame = message(peer_presence, payload);
+    link.outbox.push_back(frame);
+
+    presence_batches++;
+    if (batch.from == 0) presence_snapshots++;
+    presence_users_sent += batch.users.size();
+    presence_bytes += frame->size();
+}
+
+void sendPresenceAck(Link& link, bool gap) {
+    std::pair<uint64_t, uint64_t> known = presence.known(link.peer.id);
+    std::string payload;
+    putU64(payload, known.first);
+    putU64(payload, known.second);
+    putU8(payload, gap);
+    Frame frame = message(peer_presence_ack, payload);
+    link.outbox.push_back(frame);
+    presence_bytes += frame->size();
+}
+
+// onPresence(): a batch of the sender's part, acknowledged at the next gossip
+void onPresence(const std::string& node, Reader& in) {
+    PresenceBatch batch;
+    batch.epoch = in.number(8);
+    batch.from = in.number(8);
+    batch.to = in.number(8);
+    size_t count = in.number(4);
+    for (size_t i = 0; i < count && in.ok; i++) {
+        std::string user = in.string();
+        bool online = in.number(1) != 0;
+        batch.users.emplace_back(std::move(user), online);
+    }
+    if (!in.ok || node.empty()) return;
+
+    PresenceState::Applied result = presence.apply(node, batch);
+    if (result == PresenceState::gap) {
+        presence_gaps++;
+        acks_due[node] = true;
+    } else if (result == PresenceState::applied) {
+        acks_due.emplace(node, false);
+    }
+}
+
+// onPresenceAck(): what a peer holds of our part; after a gap the next batch starts there
+void onPresenceAck(const std::string& node, Reader& in) {
+    uint64_t epoch = in.number(8);
+    uint64_t version = in.number(8);
+    bool gap = in.number(1) != 0;
+    if (!in.ok || node.empty() || !links.count(node)) return;
+
+    Feed& feed = feeds[node];
+    feed.acked = epoch == presence.epoch() ? version : 0;
+    if (gap) feed.sent = feed.acked;
+}
+
+/*
+gossip(): every gossip_ms, sends each peer what changed since its last
+batch and the acks we owe, forgets departures every peer has, and drops
+the part of a node that has been unreachable for presence_expire_s
+*/
+void gossip() {
+    uint64_t acked = UINT64_MAX;
+    for (auto& entry : links) {
+        Link& link = entry.second;
+        Feed& feed = feeds[entry.first];
+        acked = std::min(acked, feed.acked);
+        if (!link.connected) continue;
+
+        auto due = acks_due.find(entry.first);
+        if (due != acks_due.end()) {
+            sendPresenceAck(link, due->second);
+            acks_due.erase(due);
+        }
+        if (feed.sent < presence.version()) {
+            sendPresence(link, presence.batchFrom(feed.sent));
+            feed.sent = presence.version();
+        }
+        flushLink(link);
+    }
+    presence.collect(acked, presence_keep);
+
+    time_t now = time(NULL);
+    for (auto it = lost_since.begin(); it != lost_since.end();) {
+        if (now - it->second < presence_expire_s) {
+            ++it;
+            continue;
+        }
+        if (presence.usersOn(it->first) > 0) {
+            logLine("[cluster] " + it->first + " unreachable, its " + std::to_string(presence.usersOn(it->first)) +
+                    " user(s) count as offline");
+        }
+        presence.drop(it->first);
+        it = lost_since.erase(it);
+    }
+
+    presence_local = presence.localUsers();
+    presence_remote = presence.remoteUsers();
+}
+
+// presenceReport(): for the admin socket, one line per node (and where `user` is, if given)
+std::string presenceReport(const std::string& user) {
+    std::string out = config.node_id + " (here): epoch " + std::to_string(presence.epoch()) + ", version " +
+                      std::to_string(presence.version()) + ", " + std::to_string(presence.localUsers()) +
+                      " online\n";
+    for (const std::string& node : presence.nodes()) {
+        std::pair<uint64_t, uint64_t> known = presence.known(node);
+        out += node + ": epoch " + std::to_string(known.first) + ", version " + std::to_string(known.second) + ", " +
+               std::to_string(presence.usersOn(node)) + " online" + (lost_since.count(node) ? " (unreachable)" : "") +
+               "\n";
+    }
+    if (!user.empty()) {
+        std::vector<std::string> nodes = presence.where(user);
+        if (presence.onlineHere(user)) nodes.insert(nodes.begin(), config.node_id);
+        std::string list;
+        for (const std::string& node : nodes) list += (list.empty() ? "" : ", ") + node;
+        out += user + (nodes.empty() ? " is offline" : " is on " + list) + "\n";
+    }
+    return out;
+}
+
+std::string presenceStats() {
+    return "presence_users_local " + std::to_string(presence_local.load()) + "\n" +
+           "presence_users_remote " + std::to_string(presence_remote.load()) + "\n" +
+           "presence_batches_sent " + std::to_string(presence_batches.load()) + "\n" +
+           "presence_snapshots_sent " + std::to_string(presence_snapshots.load()) + "\n" +
+           "presence_users_sent " + std::to_string(presence_users_sent.load()) + "\n" +
+           "presence_bytes_sent " + std::to_string(presence_bytes.load()) + "\n" +
+           "presence_gaps " + std::to_string(presence_gaps.load()) + "\n";
+}
+
+// readInbound(): handles every complete peer message, false when the peer is gone
+bool readInbound(Inbound& peer) {
+    char buffer[16384];
+    ssize_t valread = read(peer.fd, buffer, sizeof(buffer));
+    if (valread < 0 && (errno == EAGAIN || errno == EINTR)) return true;
+    if (valread <= 0) return false;
+    peer.inbuf.append(buffer, valread);
+
+    size_t start = 0;
+    while (peer.inbuf.size() - start >= 4) {
+        Reader header{peer.inbuf.data() + start, 4};
+        size_t size = header.number(4);
+        if (size == 0 || size > (64u << 20)) return false; // garbage, drop the link
+        if (peer.inbuf.size() - start - 4 < size) break;
+
+        Reader in{peer.inbuf.data() + start + 5, size - 1};
+        uint8_t type = peer.inbuf[start + 4];
+        if (type == peer_hello) {
+            peer.peer_id = in.string();
+            lost_since.erase(peer.peer_id);
+            if (presence.known(peer.peer_id).first == 0) acks_due[peer.peer_id] = true; // send us all of it
+        }
+        else if (type == peer_relay) onRelay(in);
+        else if (type == peer_presence) onPresence(peer.peer_id, in);
+        else if (type == peer_presence_ack) onPresenceAck(peer.peer_id, in);
+        start += 4 + size;
+    }
+    peer.inbuf.erase(0, start);
+    return true;
+}
+
+void reportStats() {
+    if (!stats_changed || time(NULL) < next_report) return;
+    stats_changed = false;
+    next_report = time(NULL) + 5;
+
+    for (auto& entry : depth_stats) {
+        const DepthStats& stats = entry.second;
+        char line[160];
+        snprintf(line, sizeof(line), "[cluster] depth %d: %llu msgs, avg %.3f ms, max %.3f ms", entry.first,
+                 (unsigned long long)stats.count, stats.total_ms / stats.count, stats.max_ms);
+        logLine(line);
+    }
+}
+
+void runCluster() {
+    while (true) {
+        time_t now = time(NULL);
+        for (auto& entry : links) {
+            Link& link = entry.second;
+            if (link.fd < 0 && now >= link.retry_at) startConnect(link);
+        }
+
+        fd_set read_fds;
+        fd_set write_fds;
+        FD_ZERO(&read_fds);
+        FD_ZERO(&write_fds);
+        FD_SET(listen_fd, &read_fds);
+        FD_SET(cluster_inbox.wake_fds[0], &read_fds);
+        int max_fd = std::max(listen_fd, cluster_inbox.wake_fds[0]);
+
+        for (auto& entry : links) {
+            Link& link = entry.second;
+            if (link.fd < 0) continue;
+            FD_SET(link.fd, &read_fds); // peers never send on it, readable means closed
+            if (!link.connected || !link.outbox.empty()) FD_SET(link.fd, &write_fds);
+            max_fd = std::max(max_fd, link.fd);
+        }
+        for (Inbound& peer : inbound) {
+            FD_SET(peer.fd, &read_fds);
+            max_fd = std::max(max_fd, peer.fd);
+        }
+
+        // Wakes at least once a second for reconnects and the stats report, and for each gossip
+        uint64_t now_ms = monotonicMs();
+        uint64_t wait_ms = std::min<uint64_t>(1000, gossip_at > now_ms ? gossip_at - now_ms : 0);
+        timeval timeout = {(time_t)(wait_ms / 1000), (suseconds_t)(wait_ms % 1000 * 1000)};
+        if (select(max_fd + 1, &read_fds, &write_fds, NULL, &timeout) < 0) continue;
+
+        if (FD_ISSET(cluster_inbox.wake_fds[0], &read_fds)) cluster_inbox.run();
+
+        if (FD_ISSET(listen_fd, &read_fds)) {
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd >= 0) {
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                inbound.push_back(Inbound{fd, "", ""});
+            }
+        }
+
+        for (auto& entry : links) {
+            Link& link = entry.second;
+            if (link.fd < 0) continue;
+            if (!link.connected) {
+                if (FD_ISSET(link.fd, &write_fds)) finishConnect(link);
+                if (!link.connected) continue;
+            }
+            if (FD_ISSET(link.fd, &read_fds)) {
+                char probe[64];
+                if (read(link.fd, probe, sizeof(probe)) <= 0) {
+                    closeLink(link);
+                    continue;
+                }
+            }
+            flushLink(link);
+        }
+
+        for (size_t i = 0; i < inbound.size(); i++) {
+            if (!FD_ISSET(inbound[i].fd, &read_fds)) continue;
+            if (!readInbound(inbound[i])) {
+                std::string node = inbound[i].peer_id;
+                bool other = std::any_of(inbound.begin(), inbound.end(), [&](const Inbound& peer) {
+                    return peer.fd != inbound[i].fd && peer.peer_id == node;
+                });
+                if (!node.empty() && !other) lost_since.emplace(node, time(NULL)); // not reconnected already
+                close(inbound[i].fd);
+                inbound.erase(inbound.begin() + i);
+                i--;
+            }
+        }
+
+        if (monotonicMs() >= gossip_at) {
+            gossip();
+            gossip_at = monotonicMs() + config.gossip_ms;
+        }
+        reportStats();
+    }
+}
+
+} // namespace
+
+bool parsePeers(const std::string& list, std::vector<PeerConfig>& out) {
+    size_t start = 0;
+    while (start < list.size()) {
+        size_t comma = list.find(',', start);
+        std::string item = list.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+        start = comma == std::string::npos ? list.size() : comma + 1;
+
+        PeerConfig peer;
+        size_t at = item.find('@');
+        size_t colon = item.find(':', at);
+        if (at == std::string::npos || colon == std::string::npos) return false;
+        size_t slash = item.find('/', colon);
+
+        peer.id = item.substr(0, at);
+        peer.host = item.substr(at + 1, colon - at - 1);
+        peer.port = atoi(item.substr(colon + 1, slash - colon - 1).c_str());
+        if (slash != std::string::npos) peer.zone = item.substr(slash + 1);
+        if (peer.id.empty() || peer.port <= 0) return false;
+        out.push_back(peer);
+    }
+    return true;
+}
+
+bool startCluster(const ClusterConfig& cluster_config) {
+    config = cluster_config;
+    zone_of[config.node_id] = config.zone;
+    for (const PeerConfig& peer : config.peers) {
+        if (peer.id == config.node_id) continue;
+        links[peer.id].peer = peer;
+        zone_of[peer.id] = peer.zone;
+    }
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int opt = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(config.peer_port);
+    if (::bind(listen_fd, (sockaddr*)&address, sizeof(address)) < 0 || listen(listen_fd, SOMAXCONN) < 0) {
+        std::cerr << "Peer port bind failed!" << std::endl;
+        return false;
+    }
+    if (!cluster_inbox.open()) return false;
+
+    presence = PresenceState(realtimeNs()); // the epoch: later than any earlier run of this node
+    addAdminStats(presenceStats);
+    addAdminCommand("presence", "cluster presence by node (presence <user> also says where they are)",
+                    [](const std::string& args) {
+        // Answered on the cluster thread, which owns the state
+        auto answer = std::make_shared<std::promise<std::string>>();
+        std::future<std::string> report = answer->get_future();
+        cluster_inbox.post([answer, args]() { answer->set_value(presenceReport(args)); });
+        if (report.wait_for(std::chrono::seconds(2)) != std::future_status::ready) {
+            return std::string("The cluster thread didn't answer\n");
+        }
+        return report.get();
+    });
+
+    enabled = true;
+    std::cout << "Node " << config.node_id << " (zone " << config.zone << ") peering on port " << config.peer_port
+              << " with " << links.size() << " peer(s), relay fan-out " << config.fanout << std::endl;
+    std::thread(runCluster).detach();
+    return true;
+}
+
+bool clusterEnabled() {
+    return enabled;
+}
+
+bool isChannel(const std::string& room) {
+    return !room.empty() && room[0] == '#';
+}
+
+void relayToCluster(const std::string& channel, const std::string& text) {
+    uint64_t origin_ns = realtimeNs();
+    cluster_inbox.post([origin_ns, channel, text]() {
+        std::vector<std::string> nodes;
+        for (auto& entry : links) nodes.push_back(entry.first);
+        forward(origin_ns, 1, config.node_id, channel, text, nodes);
+    });
+}
+
+void presenceJoin(const std::string& user) {
+    cluster_inbox.post([user]() { presence.join(user); });
+}
+
+void presenceLeave(const std::string& user) {
+    cluster_inbox.post([user]() { presence.leave(user); });
+}
+
+void whereOnline(const std::string& user, int reactor, std::function<void(const std::vector<std::string>&)> done) {
+    cluster_inbox.post([user, reactor, done]() {
+        std::vector<std::string> nodes = presence.where(user);
+        if (presence.onlineHere(user)) nodes.insert(nodes.begin(), config.node_id);
+        post(reactor, [done, nodes]() { done(nodes); });
+    });
+}
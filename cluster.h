@@ -0,0 +1,59 @@
+/*
+Cluster: broadcast channels across several server nodes
+
+Rooms whose name starts with '#' are channels: a message posted on any
+node reaches the channel's members on every node. The origin doesn't
+send to every node itself, it sends to K relays, each relays to K more,
+and every node also delivers to its own local members.
+
+Each relay message carries the list of nodes still to reach below it
+(its subtree). A relay splits that list into K smaller subtrees, keeping
+nodes of the same zone together, and picks a live node as the root of
+each. If a relay is down, the next node of its subtree takes its place.
+
+Every node also knows which users are online on which node, gossiped
+between them (presence.h).
+*/
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+struct PeerConfig {
+    std::string id;
+    std::string host;
+    int port = 0;
+    std::string zone = "local";
+};
+
+struct ClusterConfig {
+    std::string node_id = "node";
+    std::string zone = "local";
+    int peer_port = 0;   // 0 = single node, cluster turned off
+    int fanout = 2;      // K: relays each node sends to
+    int gossip_ms = 500; // presence changes go out this often
+    std::vector<PeerConfig> peers;
+};
+
+// parsePeers(): reads "id@host:port[/zone],..." (our own id may be listed, it is skipped)
+bool parsePeers(const std::string& list, std::vector<PeerConfig>& out);
+
+// startCluster(): opens the peer port and starts the cluster thread
+bool startCluster(const ClusterConfig& config);
+
+bool clusterEnabled();
+
+// isChannel(): rooms delivered to every node ('#' prefix)
+bool isChannel(const std::string& room);
+
+// relayToCluster(): sends a channel line to every other node (callable from any thread)
+void relayToCluster(const std::string& channel, const std::string& text);
+
+// presenceJoin()/presenceLeave(): a named session opened/closed on this node (callable from any thread)
+void presenceJoin(const std::string& user);
+void presenceLeave(const std::string& user);
+
+// whereOnline(): the nodes `user` is online on, ours first; done runs on reactor `reactor`
+void whereOnline(const std::string& user, int reactor, std::function<void(const std::vector<std::string>&)> done);
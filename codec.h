@@ -0,0 +1,47 @@
+/*
+Binary Encoding
+
+The little-endian fields the peer links (cluster.cpp) and the replication
+stream (replica.cpp) are built from: putU8..putU64 and putString
+([u32 length][bytes]) append, Reader takes them back out of a buffer.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+inline void putU8(std::string& out, uint8_t v) { out.push_back((char)v); }
+inline void putU16(std::string& out, uint16_t v) { for (int i = 0; i < 2; i++) out.push_back((char)(v >> (8 * i))); }
+inline void putU32(std::string& out, uint32_t v) { for (int i = 0; i < 4; i++) out.push_back((char)(v >> (8 * i))); }
+inline void putU64(std::string& out, uint64_t v) { for (int i = 0; i < 8; i++) out.push_back((char)(v >> (8 * i))); }
+inline void putString(std::string& out, const std::string& v) { putU32(out, v.size()); out += v; }
+
+// Reader: pulls fields back out of a buffer, ok turns false when it runs short
+struct Reader {
+    const char* p;
+    size_t left;
+    bool ok = true;
+
+    uint64_t number(int bytes) {
+        if (left < (size_t)bytes) { ok = false; return 0; }
+        uint64_t v = 0;
+        for (int i = 0; i < bytes; i++) v |= (uint64_t)(uint8_t)p[i] << (8 * i);
+        p += bytes;
+        left -= bytes;
+        return v;
+    }
+    const char* bytes(size_t size) {
+        if (left < size) { ok = false; return nullptr; }
+        const char* at = p;
+        p += size;
+        left -= size;
+        return at;
+    }
+    std::string string() {
+        size_t size = number(4);
+        const char* at = bytes(size);
+        return at ? std::string(at, size) : "";
+    }
+};
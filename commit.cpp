@@ -0,0 +1,161 @@
+/*
+Group Commit (see commit.h)
+*/
+
+#include <map>
+#include <set>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <unistd.h>
+
+#include "commit.h"
+#include "clock.h"
+#include "admin.h"
+#include "server.h"
+
+namespace {
+
+std::set<std::string> durable_rooms;
+
+struct CommitRequest {
+    int fd;
+    std::string path;
+    std::vector<DurableAck> acks;
+};
+
+std::mutex commit_mutex; // guards queue
+std::condition_variable commit_ready;
+std::vector<CommitRequest> queue;
+int window_us = 0;
+
+// Read by the admin socket while the committer updates them
+struct CommitStats {
+    std::atomic<uint64_t> batches{0};
+    std::atomic<uint64_t> acks{0};
+    std::atomic<uint64_t> failed{0};
+    std::atomic<uint64_t> largest_batch{0};
+    std::atomic<uint64_t> sync_ns{0};
+    std::atomic<uint64_t> max_sync_ns{0};
+    std::atomic<uint64_t> ack_ns{0};
+    std::atomic<uint64_t> max_ack_ns{0};
+} stats;
+
+void raiseMax(std::atomic<uint64_t>& max, uint64_t value) {
+    uint64_t seen = max.load();
+    while (value > seen && !max.compare_exchange_weak(seen, value)) {}
+}
+
+// sendAcks(): one task per reactor holding senders (senders that left since are skipped, moved ones followed)
+void sendAcks(const std::vector<DurableAck>& acks, bool saved) {
+    std::map<int, std::vector<DurableAck>> by_reactor;
+    for (const DurableAck& ack : acks) by_reactor[ack.reactor].push_back(ack);
+
+    for (auto& entry : by_reactor) {
+        int target = entry.first;
+        std::vector<DurableAck> list = std::move(entry.second);
+        post(target, [target, list, saved]() {
+            Reactor& r = *reactors[target];
+            for (const DurableAck& ack : list) {
+                std::string id = ack.room + " " + std::to_string(ack.seq);
+                std::string text = saved ? "ack " + id : "error: " + id + " not saved";
+                withSession(r, ack.session, [text](Reactor&, Session& s) { reply(s, text); });
+            }
+        });
+    }
+}
+
+void runCommitter() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(commit_mutex);
+            commit_ready.wait(lock, []() { return !queue.empty(); });
+        }
+        // The window: passes that arrive meanwhile share this commit
+        if (window_us > 0) std::this_thread::sleep_for(std::chrono::microseconds(window_us));
+
+        std::vector<CommitRequest> batch;
+        {
+            std::lock_guard<std::mutex> lock(commit_mutex);
+            batch.swap(queue);
+        }
+
+        // Every request was written before it was queued, so one sync per file covers them all
+        uint64_t start = realtimeNs();
+        std::map<std::string, bool> synced;
+        for (const CommitRequest& request : batch) {
+            if (request.fd >= 0 && !synced.count(request.path)) synced[request.path] = fdatasync(request.fd) == 0;
+        }
+        uint64_t done = realtimeNs();
+
+        uint64_t acks = 0;
+        for (CommitRequest& request : batch) {
+            bool saved = request.fd >= 0 && synced[request.path];
+            if (request.fd >= 0) close(request.fd);
+            if (!saved) stats.failed += request.acks.size();
+
+            for (const DurableAck& ack : request.acks) {
+                uint64_t waited = done > ack.created_ns ? done - ack.created_ns : 0;
+                stats.ack_ns += waited;
+                raiseMax(stats.max_ack_ns, waited);
+            }
+            acks += request.acks.size();
+            sendAcks(request.acks, saved);
+        }
+
+        stats.batches++;
+        stats.acks += acks;
+        raiseMax(stats.largest_batch, acks);
+        stats.sync_ns += done - start;
+        raiseMax(stats.max_sync_ns, done - start);
+    }
+}
+
+std::string commitStats() {
+    uint64_t batches = stats.batches, acks = stats.acks;
+    char line[256];
+    snprintf(line, sizeof(line),
+             "commit_batches %llu\ncommit_acks %llu\ncommit_failed %llu\ncommit_batch_avg %.1f\n"
+             "commit_batch_max %llu\ncommit_sync_avg_us %.1f\ncommit_sync_max_us %.1f\n"
+             "commit_ack_avg_us %.1f\ncommit_ack_max_us %.1f\n",
+             (unsigned long long)batches, (unsigned long long)acks, (unsigned long long)stats.failed.load(),
+             batches ? (double)acks / batches : 0.0, (unsigned long long)stats.largest_batch.load(),
+             batches ? stats.sync_ns / 1e3 / batches : 0.0, stats.max_sync_ns / 1e3,
+             acks ? stats.ack_ns / 1e3 / acks : 0.0, stats.max_ack_ns / 1e3);
+    return line;
+}
+
+} // namespace
+
+void durableRooms(const std::string& comma_list) {
+    size_t start = 0;
+    while (start <= comma_list.size()) {
+        size_t comma = comma_list.find(',', start);
+        if (comma == std::string::npos) comma = comma_list.size();
+        if (comma > start) durable_rooms.insert(comma_list.substr(start, comma - start));
+        start = comma + 1;
+    }
+}
+
+bool isDurable(const std::string& room) {
+    return durable_rooms.count(room) > 0;
+}
+
+bool anyDurable() {
+    return !durable_rooms.empty();
+}
+
+void startCommitter(int window) {
+    window_us = window;
+    addAdminStats(commitStats);
+    std::thread(runCommitter).detach();
+}
+
+void requestCommit(int fd, const std::string& path, std::vector<DurableAck>&& acks) {
+    {
+        std::lock_guard<std::mutex> lock(commit_mutex);
+        queue.push_back(CommitRequest{fd, path, std::move(acks)});
+    }
+    commit_ready.notify_one();
+}
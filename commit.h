@@ -0,0 +1,44 @@
+/*
+Group Commit (durable rooms)
+
+Messages to a durable room (--durable-rooms) are acknowledged to their
+sender only once they are on disk. The owner reactor writes them to its
+history log like any other message, once per loop pass, and hands the
+pass to the committer thread, which syncs the log and then tells the
+reactors holding the senders.
+
+The committer waits one commit window (--commit-us) for more passes,
+then runs one fdatasync per log file for everything it collected, so
+many senders share a sync. Reactors never wait on it, and a room that
+isn't durable never does either.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// DurableAck: one message whose sender is waiting for it to be on disk
+struct DurableAck {
+    uint64_t session; // the sender
+    int reactor;      // the reactor holding the sender
+    std::string room;
+    uint64_t seq;
+    uint64_t created_ns; // the message's time_ns (ack latency is measured from it)
+};
+
+// durableRooms(): which rooms need acks (comma list), isDurable(): is this one of them
+void durableRooms(const std::string& comma_list);
+bool isDurable(const std::string& room);
+bool anyDurable();
+
+// startCommitter(): starts the committer thread (window_us = how long a batch collects)
+void startCommitter(int window_us);
+
+/*
+requestCommit(): called by a reactor after writing a pass to its log.
+fd is a dup of the log file (the committer closes it), path names the file,
+fd < 0 means the write failed and the senders get an error instead
+*/
+void requestCommit(int fd, const std::string& path, std::vector<DurableAck>&& acks);
@@ -0,0 +1,30 @@
+/*
+User Directory (see directory.h)
+*/
+
+#include "directory.h"
+
+void UserDirectory::add(const std::string& name) {
+    sessions_by_name[name]++;
+}
+
+void UserDirectory::remove(const std::string& name) {
+    auto found = sessions_by_name.find(name);
+    if (found == sessions_by_name.end()) return;
+    if (--found->second == 0) sessions_by_name.erase(found);
+}
+
+std::vector<std::string> UserDirectory::page(const std::string& prefix, const std::string& after, size_t limit,
+                                             bool& more) const {
+    std::vector<std::string> out;
+    auto at = after < prefix ? sessions_by_name.lower_bound(prefix) : sessions_by_name.upper_bound(after);
+    for (; at != sessions_by_name.end() && at->first.compare(0, prefix.size(), prefix) == 0; ++at) {
+        if (out.size() == limit) {
+            more = true;
+            return out;
+        }
+        out.push_back(at->first);
+    }
+    more = false;
+    return out;
+}
@@ -0,0 +1,40 @@
+/*
+User Directory
+
+Every connected chat user's name, kept sorted, for /who listings and
+@-mention completion:
+    /who [prefix]     the first page of names (starting with prefix)
+    /more             the next page of the last /who
+    /complete <prefix> a few names starting with prefix, on one line
+
+Lives on one reactor (user_owner) like the topic index, updated as
+names arrive and sessions close. A query is a lower_bound to its first
+name and a walk over the ones it returns, so a page costs the same with
+ten users or 200k. Pages are cut by name, not by position: the cursor is
+the last name sent, so joins and leaves between pages never repeat or
+skip anyone who stayed.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+class UserDirectory {
+public:
+    // add()/remove(): one session using the name (names aren't unique, each is counted)
+    void add(const std::string& name);
+    void remove(const std::string& name);
+
+    // page(): up to limit names starting with prefix that sort after `after` ("" = from the first);
+    // more says whether another one follows
+    std::vector<std::string> page(const std::string& prefix, const std::string& after, size_t limit,
+                                  bool& more) const;
+
+    size_t names() const { return sessions_by_name.size(); }
+
+private:
+    std::map<std::string, uint32_t> sessions_by_name;
+};
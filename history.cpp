@@ -0,0 +1,99 @@
+/*
+Hot-Room History Cache (see history.h)
+*/
+
+#include "history.h"
+#include "alloc.h"
+#include "server.h"
+
+void HistoryCache::configure(size_t budget_bytes, size_t messages_per_room) {
+    budget = budget_bytes;
+    per_room = messages_per_room;
+}
+
+size_t HistoryCache::messageBytes(const Message& message) {
+    // The object, its strings and the chat encoding (nearly every message gets one)
+    return sizeof(Message) + message.channel.size() + message.text.size() * 2 + message.payload.size();
+}
+
+// ringFor(): the room's ring, created (and counted) if it isn't cached
+HistoryCache::Ring& HistoryCache::ringFor(const std::string& room) {
+    auto found = rings.find(room);
+    if (found == rings.end()) {
+        found = rings.emplace(room, Ring()).first;
+        found->second.bytes = ringBytes(room);
+        total += found->second.bytes;
+        counters.rooms++;
+    }
+    found->second.referenced = true;
+    return found->second;
+}
+
+void HistoryCache::append(const std::string& room, const MessagePtr& message) {
+    AllocScope scope(alloc_history);
+    if (per_room == 0) return;
+    Ring& ring = ringFor(room);
+
+    size_t size = messageBytes(*message);
+    ring.messages.push_back(message);
+    ring.bytes += size;
+    total += size;
+
+    // Ring is full: the oldest message goes
+    if (ring.messages.size() > per_room) {
+        size_t oldest = messageBytes(*ring.messages.front());
+        ring.messages.pop_front();
+        ring.bytes -= oldest;
+        total -= oldest;
+    }
+
+    if (total > budget) evict();
+    counters.bytes = total;
+}
+
+void HistoryCache::fill(const std::string& room, const std::vector<MessagePtr>& messages) {
+    AllocScope scope(alloc_history);
+    if (per_room == 0) return;
+    ringFor(room);
+    for (const MessagePtr& message : messages) append(room, message);
+    if (total > budget) evict();
+    counters.bytes = total;
+}
+
+bool HistoryCache::recent(const std::string& room, std::vector<MessagePtr>& out) {
+    AllocScope scope(alloc_history);
+    auto found = rings.find(room);
+    if (found == rings.end()) {
+        counters.misses++;
+        return false;
+    }
+    counters.hits++;
+    found->second.referenced = true;
+    out.assign(found->second.messages.begin(), found->second.messages.end());
+    return true;
+}
+
+/*
+evict(): CLOCK sweep over the rooms until back under budget.
+A room whose bit is set gets it cleared and is passed over once,
+the first room found without it loses its whole ring
+*/
+void HistoryCache::evict() {
+    while (total > budget && !rings.empty()) {
+        auto it = rings.lower_bound(hand);
+        if (it == rings.end()) it = rings.begin(); // wrap around
+
+        auto next = std::next(it);
+        std::string next_hand = next == rings.end() ? "" : next->first;
+
+        if (it->second.referenced) {
+            it->second.referenced = false;
+        } else {
+            total -= it->second.bytes;
+            rings.erase(it);
+            counters.rooms--;
+            counters.evictions++;
+        }
+        hand = next_hand;
+    }
+}
@@ -0,0 +1,76 @@
+/*
+Hot-Room History Cache
+
+Keeps the last few messages of each room in memory so someone joining
+a room sees what was said just before, without anything being re-read
+or re-encoded: the cache holds the same Message objects the fan-out used,
+and a join hands them out by reference.
+
+Every reactor caches the rooms it owns, within its share of a global
+memory budget. When over budget, whole rooms are evicted with CLOCK
+(second chance): a room that was appended to or joined since the hand
+last passed keeps its ring, the first one that wasn't is dropped.
+
+Hit/miss counts and memory are atomics so the admin socket can read
+them from its own thread.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include <memory>
+
+struct Message;
+typedef std::shared_ptr<const Message> MessagePtr;
+
+class HistoryCache {
+public:
+    struct Stats {
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+        std::atomic<uint64_t> evictions{0};
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<uint64_t> rooms{0};
+    };
+
+    // configure(): budget for this cache (its share of the global one), messages kept per room
+    void configure(size_t budget_bytes, size_t per_room);
+
+    void append(const std::string& room, const MessagePtr& message);
+
+    // fill(): caches a room's history read from elsewhere (the log), even if it's empty
+    void fill(const std::string& room, const std::vector<MessagePtr>& messages);
+
+    // recent(): the room's cached messages, oldest first (false on a miss)
+    bool recent(const std::string& room, std::vector<MessagePtr>& out);
+
+    const Stats& stats() const { return counters; }
+    size_t perRoom() const { return per_room; }
+
+    // messageBytes(): what one cached message costs (it's shared, so counted once)
+    static size_t messageBytes(const Message& message);
+
+    // ringBytes(): what a room costs with nothing in it (so empty rooms get evicted too)
+    static size_t ringBytes(const std::string& room) { return sizeof(Ring) + room.size() + 64; }
+
+private:
+    struct Ring {
+        std::deque<MessagePtr> messages;
+        size_t bytes = 0;
+        bool referenced = true; // CLOCK bit, set on every use
+    };
+
+    size_t budget = 64 << 20;
+    size_t per_room = 50;
+    size_t total = 0;
+    std::map<std::string, Ring> rings;
+    std::string hand; // CLOCK hand: the next room to look at (rooms in name order)
+    Stats counters;
+
+    Ring& ringFor(const std::string& room);
+    void evict();
+};
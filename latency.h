@@ -0,0 +1,88 @@
+/*
+Ingress Latency Histograms
+
+Where a chat line's time goes before it reaches its recipients' reactors,
+starting from when the kernel received its bytes (SO_TIMESTAMPING), not
+from when our loop got around to read() them:
+    rx_read      kernel receive -> read() returned it (socket queue + loop busy elsewhere)
+    rx_deliver   kernel receive -> queued for the recipients on their reactor
+    read_deliver read() -> queued for the recipients (the part the old numbers showed)
+
+Each reactor keeps its own histograms (only it writes them, relaxed
+atomics so the admin socket can read them), summed when reported.
+Buckets are powers of two of nanoseconds, so a sample is one increment.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+class LatencyHistogram {
+public:
+    static const int bucket_count = 40; // bucket b: [2^b, 2^(b+1)) ns, the last one open-ended
+
+    void record(uint64_t ns) {
+        int bucket = ns == 0 ? 0 : 63 - __builtin_clzll(ns);
+        if (bucket >= bucket_count) bucket = bucket_count - 1;
+        buckets[bucket].store(buckets[bucket].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    // add(): sums another histogram into this one (for reporting)
+    void add(const LatencyHistogram& other) {
+        for (int b = 0; b < bucket_count; b++) {
+            buckets[b].store(buckets[b].load(std::memory_order_relaxed) + other.buckets[b].load(std::memory_order_relaxed),
+                             std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t count() const {
+        uint64_t total = 0;
+        for (int b = 0; b < bucket_count; b++) total += buckets[b].load(std::memory_order_relaxed);
+        return total;
+    }
+
+    // percentile(): upper bound of the bucket holding the p-th sample (0 < p <= 1), in ns
+    uint64_t percentile(double p) const {
+        uint64_t total = count(), seen = 0;
+        for (int b = 0; b < bucket_count; b++) {
+            seen += buckets[b].load(std::memory_order_relaxed);
+            if (total > 0 && seen >= p * total) return 2ull << b;
+        }
+        return 0;
+    }
+
+    // stats(): "name_count", "name_p50_us", ... lines for the admin stats command
+    std::string stats(const std::string& name) const {
+        char line[256];
+        snprintf(line, sizeof(line), "%s_count %llu\n%s_p50_us %.1f\n%s_p99_us %.1f\n%s_p999_us %.1f\n",
+                 name.c_str(), (unsigned long long)count(), name.c_str(), percentile(0.5) / 1e3, name.c_str(),
+                 percentile(0.99) / 1e3, name.c_str(), percentile(0.999) / 1e3);
+        return line;
+    }
+
+    // chart(): one line per non-empty bucket with a bar, for the admin latency command
+    std::string chart(const std::string& name) const {
+        uint64_t total = count();
+        std::string out = name + " (" + std::to_string(total) + " samples)\n";
+        for (int b = 0; b < bucket_count; b++) {
+            uint64_t n = buckets[b].load(std::memory_order_relaxed);
+            if (n == 0) continue;
+            char line[128];
+            snprintf(line, sizeof(line), "  < %10.1f us %10llu ", (2ull << b) / 1e3, (unsigned long long)n);
+            out += line + std::string(1 + n * 50 / total, '#') + "\n";
+        }
+        return out;
+    }
+
+private:
+    std::atomic<uint64_t> buckets[bucket_count] = {};
+};
+
+struct IngressLatency {
+    LatencyHistogram rx_read;
+    LatencyHistogram rx_deliver;
+    LatencyHistogram read_deliver;
+};
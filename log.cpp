@@ -0,0 +1,584 @@
+/*
+History Log (see log.h)
+*/
+
+#include <iostream>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "clock.h"
+#include "alloc.h"
+#include "server.h"
+#include "replica.h"
+
+namespace {
+
+const size_t segment_limit = 64 << 20; // bytes before a new segment is started
+const size_t max_segments = 16;        // per reactor, older ones are deleted
+
+struct SegmentName {
+    int reactor;
+    uint64_t number;
+    std::string path;
+};
+
+// listSegments(): log-<reactor>-<n>.seg files in dir, by reactor then number
+std::vector<SegmentName> listSegments(const std::string& dir) {
+    std::vector<SegmentName> found;
+    DIR* d = opendir(dir.c_str());
+    if (!d) return found;
+
+    while (dirent* entry = readdir(d)) {
+        int reactor;
+        unsigned long long number;
+        char tail;
+        if (sscanf(entry->d_name, "log-%d-%llu.se%c", &reactor, &number, &tail) == 3 && tail == 'g') {
+            found.push_back(SegmentName{reactor, number, dir + "/" + entry->d_name});
+        }
+    }
+    closedir(d);
+
+    std::sort(found.begin(), found.end(), [](const SegmentName& a, const SegmentName& b) {
+        return a.reactor != b.reactor ? a.reactor < b.reactor : a.number < b.number;
+    });
+    return found;
+}
+
+// RoomTail: one entry of a segment's summary (see record.h)
+struct RoomTail {
+    std::string_view room;
+    uint64_t seq;
+    uint64_t offset;
+};
+
+// appendSummary(): the summary records for a segment's rooms, as many as it takes to keep each under max_record
+void appendSummary(std::string& out, const std::vector<RoomTail>& rooms, uint64_t time_ns) {
+    const size_t most = max_record - sizeof(RecordHeader) - record_align;
+    std::string entries;
+    for (const RoomTail& tail : rooms) {
+        if (!entries.empty() && entries.size() + tail.room.size() + 20 > most) {
+            appendRecord(out, summary_kind, 0, time_ns, "", "", entries);
+            entries.clear();
+        }
+        uint32_t size = tail.room.size();
+        entries.append(reinterpret_cast<const char*>(&size), 4);
+        entries.append(tail.room);
+        entries.append(reinterpret_cast<const char*>(&tail.seq), 8);
+        entries.append(reinterpret_cast<const char*>(&tail.offset), 8);
+    }
+    if (!entries.empty()) appendRecord(out, summary_kind, 0, time_ns, "", "", entries);
+}
+
+// readSummary(): calls visit(RoomTail) for every entry of the summary starting at `at`
+template <typename Visit>
+void readSummary(const char* data, size_t size, uint64_t at, Visit visit) {
+    while (at < size && checkRecord(data + at, size - at) == record_ok) {
+        RecordView record(data + at);
+        if (record.kind() != summary_kind) return;
+        std::string_view entries = record.payload();
+        size_t p = 0;
+        while (entries.size() - p >= 4) {
+            uint32_t length;
+            memcpy(&length, entries.data() + p, 4);
+            if (entries.size() - p - 4 < (uint64_t)length + 16) return; // not ours
+            RoomTail tail{entries.substr(p + 4, length), 0, 0};
+            memcpy(&tail.seq, entries.data() + p + 4 + length, 8);
+            memcpy(&tail.offset, entries.data() + p + 12 + length, 8);
+            if (tail.offset < at) visit(tail);
+            p += 20 + length;
+        }
+        at += record.size();
+    }
+}
+
+// lastRecords(): up to count records of a room, newest first, following back pointers from its last one
+void lastRecords(const char* data, size_t size, std::string_view room, uint64_t at, size_t count,
+                 std::vector<RecordView>& out) {
+    while (count-- > 0 && at < size && checkRecord(data + at, size - at) == record_ok) {
+        RecordView record(data + at);
+        if (record.channel() != room) return; // not what the summary or index says, don't follow it
+        out.push_back(record);
+        if (record.back() == 0 || (uint64_t)record.back() * record_align > at) return;
+        at -= (uint64_t)record.back() * record_align;
+    }
+}
+
+} // namespace
+
+std::vector<std::string> segmentFiles(const std::string& dir) {
+    std::vector<std::string> names;
+    for (const SegmentName& name : listSegments(dir)) names.push_back(name.path.substr(dir.size() + 1));
+    return names;
+}
+
+bool MappedSegment::map(const std::string& path, bool sequential) {
+    int file = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file < 0) return false;
+
+    struct stat info;
+    if (fstat(file, &info) < 0 || info.st_size == 0) {
+        close(file);
+        return false;
+    }
+    void* mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file); // the mapping keeps the file
+    if (mapped == MAP_FAILED) return false;
+
+    madvise(mapped, info.st_size, sequential ? MADV_SEQUENTIAL : MADV_RANDOM); // no read-ahead for a few records
+    data = static_cast<const char*>(mapped);
+    size = info.st_size;
+    return true;
+}
+
+MappedSegment::~MappedSegment() {
+    if (data) munmap(const_cast<char*>(data), size);
+}
+
+MessagePtr messageFromRecord(const RecordView& record) {
+    std::shared_ptr<Message> message = std::make_shared<Message>();
+    message->kind = (MessageKind)record.kind();
+    message->channel = std::string(record.channel());
+    message->text = std::string(record.text());
+    message->payload = std::string(record.payload());
+    message->time_ns = record.timeNs();
+    message->seq = record.seq();
+    return message;
+}
+
+// ------------------- Writing -------------------
+
+bool MessageLog::open(const std::string& log_dir, int reactor_index) {
+    dir = log_dir;
+    reactor = reactor_index;
+
+    for (const SegmentName& name : listSegments(dir)) {
+        if (name.reactor != reactor) continue;
+        segments.push_back(Segment{name.number, name.path});
+        indexSegment(segments.back());
+        segment = name.number;
+    }
+    return startSegment();
+}
+
+// indexSegment(): where each room's last record in an existing segment is (once, when the log is opened),
+// read from its summary if it's sealed with one
+void MessageLog::indexSegment(const Segment& existing) {
+    MappedSegment mapped;
+    if (!mapped.map(existing.path, false)) return;
+
+    uint64_t records;
+    if (sealedSegment(mapped.data, mapped.size, records) && summaryOffset(mapped.data, mapped.size) > 0) {
+        readSummary(mapped.data, mapped.size, summaryOffset(mapped.data, mapped.size), [&](const RoomTail& tail) {
+            tails[std::string(tail.room)][existing.number] = Tail{tail.offset, tail.seq};
+        });
+        return;
+    }
+
+    madvise(const_cast<char*>(mapped.data), mapped.size, MADV_SEQUENTIAL);
+    std::unordered_map<std::string_view, Tail> last; // views into the mapping
+    bool chained = true;
+    walkRecords(mapped.data, mapped.size, [&](const RecordView& record) {
+        if (record.kind() == footer_kind || record.kind() == summary_kind || record.kind() == floor_kind) return;
+        Tail tail{(uint64_t)(reinterpret_cast<const char*>(&record.header()) - mapped.data), record.seq()};
+        auto found = last.find(record.channel());
+        if (found == last.end()) {
+            last.emplace(record.channel(), tail);
+            return;
+        }
+        if (record.back() == 0) chained = false; // written before records pointed back
+        found->second = tail;
+    });
+    for (auto& entry : last) tails[std::string(entry.first)][existing.number] = entry.second;
+    if (!chained) unchained.insert(existing.number);
+}
+
+// dropTails(): forgets a deleted segment
+void MessageLog::dropTails(uint64_t number) {
+    for (auto it = tails.begin(); it != tails.end();) {
+        it->second.erase(number);
+        if (it->second.empty()) it = tails.erase(it);
+        else ++it;
+    }
+    unchained.erase(number);
+}
+
+// startSegment(): seals and closes the current segment, opens the next one (dropping the oldest past max_segments)
+bool MessageLog::startSegment() {
+    if (fd >= 0) {
+        // Its rooms' summary, then the footer: the segment is never walked again
+        std::vector<RoomTail> rooms;
+        for (auto& entry : tails) {
+            auto here = entry.second.find(segment);
+            if (here != entry.second.end()) rooms.push_back(RoomTail{entry.first, here->second.seq, here->second.offset});
+        }
+        uint64_t now = realtimeNs();
+        std::string sealing;
+        appendSummary(sealing, rooms, now);
+        uint64_t summary_at = sealing.empty() ? 0 : segment_bytes;
+        appendFooter(sealing, segment_records, segment_bytes + sealing.size(), now, summary_at);
+        writeOut(std::move(sealing), 0);
+        close(fd);
+    }
+
+    segment++;
+    std::string path = dir + "/log-" + std::to_string(reactor) + "-" + std::to_string(segment) + ".seg";
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cerr << "Can't open history segment " << path << std::endl;
+        return false;
+    }
+    segments.push_back(Segment{segment, path});
+    segment_bytes = 0;
+    segment_records = 0;
+
+    // Rooms only the segments about to go held would number from 1 again: the floor goes above them,
+    // and it's the new segment's first record before they're unlinked
+    for (size_t i = 0; i + max_segments < segments.size(); i++) {
+        for (auto& entry : tails) {
+            auto here = entry.second.find(segments[i].number);
+            if (here != entry.second.end()) raiseFloor(here->second.seq);
+        }
+    }
+    if (numbering_floor > 0) {
+        std::string bytes;
+        appendRecord(bytes, floor_kind, numbering_floor, realtimeNs(), "", "", "");
+        writeOut(std::move(bytes), 0);
+    }
+
+    while (segments.size() > max_segments) {
+        unlink(segments.front().path.c_str());
+        if (replicating()) replicateDelete(segments.front().path.substr(dir.size() + 1)); // followers drop it too
+        dropTails(segments.front().number);
+        segments.erase(segments.begin());
+    }
+    return true;
+}
+
+bool MessageLog::append(const Message& message, uint64_t seq) {
+    AllocScope scope(alloc_history);
+    if (fd < 0) return false;
+
+    // A record's place is known now, so it can point back to the room's previous one: one that
+    // won't fit starts the next segment first (what's buffered goes to this one)
+    size_t most = sizeof(RecordHeader) + message.channel.size() + message.text.size() + message.payload.size() +
+                  record_align;
+    if (segment_bytes + buffer.size() > 0 && segment_bytes + buffer.size() + most > segment_limit) {
+        flush();
+        if (!startSegment()) return false;
+    }
+
+    uint64_t at = segment_bytes + buffer.size();
+    uint32_t back = 0;
+    auto buffered = buffered_tails.find(message.channel);
+    if (buffered != buffered_tails.end()) {
+        back = (at - buffered->second.offset) / record_align;
+    } else {
+        auto room = tails.find(message.channel);
+        if (room != tails.end() && room->second.count(segment)) {
+            back = (at - room->second[segment].offset) / record_align;
+        }
+    }
+    if (!appendRecord(buffer, message.kind, seq, message.time_ns, message.channel, message.text, message.payload,
+                      back)) {
+        return false;
+    }
+    buffered_tails[message.channel] = Tail{at, seq};
+    counters.appended++;
+    buffered_records++;
+    return true;
+}
+
+void MessageLog::awaitCommit(const DurableAck& ack) {
+    waiting.push_back(ack);
+}
+
+void MessageLog::flush() {
+    AllocScope scope(alloc_history);
+    if (fd < 0 || buffer.empty()) return;
+
+    // Segments were started in append(), so everything buffered belongs to this one
+    bool written = writeOut(std::move(buffer), buffered_records);
+    buffer.clear();
+    buffered_records = 0;
+    if (written) {
+        for (auto& entry : buffered_tails) tails[entry.first][segment] = entry.second;
+    }
+    buffered_tails.clear();
+
+    // The committer syncs its own dup, so the segment can roll over meanwhile
+    if (!waiting.empty()) {
+        requestCommit(written ? dup(fd) : -1, segments.back().path, std::move(waiting));
+        waiting.clear();
+    }
+}
+
+/*
+writeOut(): appends bytes holding whole records to the current segment (and to followers).
+All or nothing: a short or failed write is cut off again, so the next append starts where
+this one did instead of after a torn record
+*/
+bool MessageLog::writeOut(std::string&& bytes, uint64_t records) {
+    uint64_t offset = segment_bytes;
+    size_t written = 0;
+    while (written < bytes.size()) {
+        ssize_t n = write(fd, bytes.data() + written, bytes.size() - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            std::cerr << "History log write failed" << std::endl;
+            break;
+        }
+        written += n;
+    }
+    if (written < bytes.size()) {
+        if (written > 0 && ftruncate(fd, offset) < 0) {
+            // Can't take the torn part back: the next append starts a new segment instead of landing
+            // after it (recovery cuts this one at the tear)
+            std::cerr << "Can't cut a torn write from the history log" << std::endl;
+            segment_bytes = segment_limit;
+        }
+        return false;
+    }
+    segment_bytes += written;
+    segment_records += records;
+    counters.bytes_written += written;
+
+    // Followers get exactly these bytes, handed over without a copy
+    if (replicating()) {
+        std::string file = segments.back().path.substr(dir.size() + 1);
+        replicateWrite(file, offset, std::make_shared<const std::string>(std::move(bytes)));
+    }
+    return true;
+}
+
+// ------------------- Reading -------------------
+
+void MessageLog::recent(const std::string& room, size_t count, std::vector<MessagePtr>& out) {
+    AllocScope scope(alloc_history);
+    out.clear();
+    if (fd < 0 || count == 0) return;
+    flush(); // what this pass appended is part of the history too
+    auto found = tails.find(room);
+    if (found == tails.end()) return;
+    counters.reads++;
+
+    // Newest segment first, each one's records newest first, until enough are found
+    std::vector<MessagePtr> newest_first;
+    for (auto tail = found->second.rbegin(); tail != found->second.rend() && newest_first.size() < count; ++tail) {
+        auto file = std::find_if(segments.begin(), segments.end(),
+                                 [&](const Segment& candidate) { return candidate.number == tail->first; });
+        MappedSegment mapped;
+        if (file == segments.end() || !mapped.map(file->path, unchained.count(tail->first))) continue;
+        size_t wanted = count - newest_first.size();
+
+        if (unchained.count(tail->first)) { // an older segment: walked
+            std::deque<RecordView> last;
+            walkRecords(mapped.data, mapped.size, [&](const RecordView& record) {
+                if (record.channel() != room || record.kind() == footer_kind || record.kind() == summary_kind) return;
+                last.push_back(record);
+                if (last.size() > wanted) last.pop_front();
+            });
+            for (auto record = last.rbegin(); record != last.rend(); ++record) {
+                newest_first.push_back(messageFromRecord(*record));
+            }
+            continue;
+        }
+
+        std::vector<RecordView> chain;
+        lastRecords(mapped.data, mapped.size, room, tail->second.offset, wanted, chain);
+        for (const RecordView& record : chain) newest_first.push_back(messageFromRecord(record));
+    }
+    out.assign(newest_first.rbegin(), newest_first.rend());
+}
+
+// ------------------- Recovery -------------------
+
+namespace {
+
+// recoverSegment(): one segment's part of recoverLogs()
+void recoverSegment(const std::string& path, bool seal, bool verify_all, RecoveryReport& report) {
+    report.segments++;
+    MappedSegment mapped;
+    if (!mapped.map(path)) return; // empty
+
+    uint64_t records;
+    if (!verify_all && sealedSegment(mapped.data, mapped.size, records)) {
+        report.sealed++;
+        return;
+    }
+    const RecordHeader* first = reinterpret_cast<const RecordHeader*>(mapped.data);
+    if (mapped.size >= sizeof(RecordHeader) && first->version != record_version) {
+        report.unreadable++; // not ours to cut
+        return;
+    }
+
+    report.verified++;
+    size_t at = 0;
+    bool footer = false;
+    records = 0;
+    std::map<std::string_view, std::pair<uint64_t, uint64_t>> last; // room -> seq, offset of its last record
+    bool chained = true;
+    while (verifyRecord(mapped.data + at, mapped.size - at) == record_ok) {
+        RecordView record(mapped.data + at);
+        footer = record.kind() == footer_kind;
+        if (!footer && record.kind() != summary_kind && record.kind() != floor_kind) {
+            records++;
+            auto found = last.find(record.channel());
+            if (found != last.end() && record.back() == 0) chained = false;
+            last[record.channel()] = std::make_pair(record.seq(), (uint64_t)at);
+        }
+        at += record.size();
+    }
+    report.records += records;
+    if (at == mapped.size && footer) return; // sealed, and every record checked out
+
+    if (at < mapped.size) {
+        report.torn++;
+        report.cut_bytes += mapped.size - at;
+        if (truncate(path.c_str(), at) < 0) std::cerr << "Can't truncate " << path << std::endl;
+    }
+    if (!seal) return;
+
+    // Only a log whose records point back gets a summary, readers follow it from there
+    std::string bytes;
+    uint64_t now = realtimeNs();
+    if (chained) {
+        std::vector<RoomTail> rooms;
+        for (auto& entry : last) rooms.push_back(RoomTail{entry.first, entry.second.first, entry.second.second});
+        appendSummary(bytes, rooms, now);
+    }
+    uint64_t summary_at = bytes.empty() ? 0 : at;
+    appendFooter(bytes, records, at + bytes.size(), now, summary_at);
+    int file = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (file < 0 || write(file, bytes.data(), bytes.size()) != (ssize_t)bytes.size()) {
+        std::cerr << "Can't seal " << path << std::endl;
+    }
+    if (file >= 0) close(file);
+}
+
+} // namespace
+
+RecoveryReport recoverLogs(const std::string& dir, bool seal, bool verify_all) {
+    std::vector<SegmentName> names = listSegments(dir);
+    RecoveryReport total;
+    if (names.empty()) return total;
+    auto start = std::chrono::steady_clock::now();
+
+    // Segments are independent: each worker takes the next one until none are left
+    std::atomic<size_t> next(0);
+    std::mutex total_mutex;
+    size_t workers = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), names.size());
+    std::vector<std::thread> threads;
+    for (size_t w = 0; w < workers; w++) {
+        threads.emplace_back([&]() {
+            RecoveryReport mine;
+            for (size_t i; (i = next++) < names.size();) recoverSegment(names[i].path, seal, verify_all, mine);
+
+            std::lock_guard<std::mutex> lock(total_mutex);
+            total.segments += mine.segments;
+            total.sealed += mine.sealed;
+            total.verified += mine.verified;
+            total.records += mine.records;
+            total.torn += mine.torn;
+            total.cut_bytes += mine.cut_bytes;
+            total.unreadable += mine.unreadable;
+        });
+    }
+    for (std::thread& t : threads) t.join();
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Recovery: " << total.segments << " segment(s), " << total.sealed << " sealed, " << total.verified
+              << " verified (" << total.records << " records), " << total.torn << " torn (" << total.cut_bytes
+              << " bytes cut)";
+    if (total.unreadable) std::cout << ", " << total.unreadable << " in an older format skipped";
+    std::cout << " in " << ms << " ms" << std::endl;
+    return total;
+}
+
+uint64_t loadHistory(const std::string& dir, size_t per_room,
+                     const std::function<void(const std::string& room, const std::vector<MessagePtr>& messages)>& add) {
+    std::vector<SegmentName> names = listSegments(dir);
+    if (names.empty()) return 0;
+    auto start = std::chrono::steady_clock::now();
+
+    // Rooms may have moved between reactors since the last run, so order by time, not by file
+    auto byTime = [](const RecordView& a, const RecordView& b) { return a.timeNs() < b.timeNs(); };
+    auto trim = [&](std::vector<RecordView>& list) {
+        std::stable_sort(list.begin(), list.end(), byTime);
+        list.erase(list.begin(), list.end() - std::min(per_room, list.size()));
+    };
+
+    // Segments stay mapped until the end, the candidates point into them. A sealed one is read through its
+    // summary, a few records per room; only the open ones (and older ones without a summary) are walked
+    std::vector<MappedSegment> mapped(names.size());
+    std::vector<std::map<std::string_view, std::vector<RecordView>>> found(names.size());
+    std::vector<uint64_t> floors(names.size(), 0);
+    std::atomic<size_t> next(0), summarized(0);
+    size_t workers = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), names.size());
+    std::vector<std::thread> threads;
+    for (size_t w = 0; w < workers; w++) {
+        threads.emplace_back([&]() {
+            for (size_t i; (i = next++) < names.size();) {
+                MappedSegment& segment = mapped[i];
+                if (!segment.map(names[i].path, false)) continue;
+                std::map<std::string_view, std::vector<RecordView>>& rooms = found[i];
+                if (checkRecord(segment.data, segment.size) == record_ok && RecordView(segment.data).kind() == floor_kind) {
+                    floors[i] = RecordView(segment.data).seq();
+                }
+
+                uint64_t records;
+                uint64_t at = sealedSegment(segment.data, segment.size, records) ? summaryOffset(segment.data, segment.size) : 0;
+                if (at > 0) {
+                    summarized++;
+                    readSummary(segment.data, segment.size, at, [&](const RoomTail& tail) {
+                        std::vector<RecordView> chain;
+                        lastRecords(segment.data, segment.size, tail.room, tail.offset, per_room, chain);
+                        for (const RecordView& record : chain) {
+                            if (record.kind() == chat_message) rooms[record.channel()].push_back(record);
+                        }
+                    });
+                    continue;
+                }
+                madvise(const_cast<char*>(segment.data), segment.size, MADV_SEQUENTIAL);
+                walkRecords(segment.data, segment.size, [&](const RecordView& record) {
+                    if (record.kind() != chat_message) return;
+                    std::vector<RecordView>& list = rooms[record.channel()];
+                    list.push_back(record);
+                    if (list.size() >= per_room * 2) trim(list);
+                });
+            }
+        });
+    }
+    for (std::thread& t : threads) t.join();
+
+    std::map<std::string_view, std::vector<RecordView>> candidates;
+    for (auto& rooms : found) {
+        for (auto& entry : rooms) {
+            std::vector<RecordView>& list = candidates[entry.first];
+            list.insert(list.end(), entry.second.begin(), entry.second.end());
+        }
+    }
+    for (auto& entry : candidates) {
+        trim(entry.second);
+        std::vector<MessagePtr> messages;
+        for (const RecordView& record : entry.second) messages.push_back(messageFromRecord(record));
+        add(std::string(entry.first), messages);
+    }
+    uint64_t floor = *std::max_element(floors.begin(), floors.end());
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "History: " << candidates.size() << " rooms loaded from " << names.size() << " segment(s) ("
+              << summarized << " through their summary) in " << ms << " ms";
+    if (floor) std::cout << ", numbering floor " << floor;
+    std::cout << std::endl;
+    return floor;
+}
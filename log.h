@@ -0,0 +1,170 @@
+/*
+History Log
+
+Every chat message a reactor fans out is also appended to that reactor's
+log, as a record (record.h), in segment files under --history-dir:
+    log-<reactor>-<n>.seg    (a new one every 64 MB, the newest 16 are kept)
+
+Appends are buffered and written once per loop pass. Nothing is fsynced,
+so a crash can lose the last pass; the log is there so history survives
+restarts and cache evictions.
+
+Reading never copies or parses a record: segments are mmap'd and walked
+record by record, comparing fields in place, and only the records that
+are wanted become Messages.
+
+A history cache miss doesn't walk anything: each record points back to
+the room's previous record in the same segment (RecordHeader::back), and
+the log keeps where each room's last record is in every segment, so a
+room's recent messages are read newest first, one record at a time.
+A sealed segment lists the same per room in its summary (record.h), so
+neither opening the log nor loading history at startup walks it.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <atomic>
+#include <memory>
+#include <functional>
+
+#include "record.h"
+#include "commit.h"
+
+struct Message;
+typedef std::shared_ptr<const Message> MessagePtr;
+
+// MappedSegment: a whole segment file, mapped read-only
+struct MappedSegment {
+    const char* data = nullptr;
+    size_t size = 0;
+
+    // map(): sequential = about to be read front to back (else only a few records are picked out)
+    bool map(const std::string& path, bool sequential = true);
+    ~MappedSegment();
+};
+
+/*
+walkRecords(): calls visit(RecordView) for every record from data on.
+Stops at the first incomplete or unreadable one (a torn tail), and
+returns how many bytes were valid records
+*/
+template <typename Visit>
+size_t walkRecords(const char* data, size_t size, Visit visit) {
+    size_t at = 0;
+    while (checkRecord(data + at, size - at) == record_ok) {
+        RecordView record(data + at);
+        visit(record);
+        at += record.size();
+    }
+    return at;
+}
+
+// messageFromRecord(): the one place record fields get copied, to become a Message
+MessagePtr messageFromRecord(const RecordView& record);
+
+class MessageLog {
+public:
+    struct Stats {
+        std::atomic<uint64_t> appended{0};
+        std::atomic<uint64_t> bytes_written{0};
+        std::atomic<uint64_t> reads{0}; // history served from disk
+    };
+
+    // open(): starts a new segment for this reactor (older ones are still read)
+    bool open(const std::string& dir, int reactor);
+    bool enabled() const { return fd >= 0; }
+
+    // append(): false if the message couldn't be logged (log off, or too big for a record)
+    bool append(const Message& message, uint64_t seq);
+
+    // awaitCommit(): the sender of the last append wants to know once it's on disk (see commit.h)
+    void awaitCommit(const DurableAck& ack);
+
+    // flush(): writes everything appended since the last flush (and hands waiting acks to the committer)
+    void flush();
+
+    // recent(): a room's last count messages in this reactor's segments, oldest first.
+    // Rooms that moved here after a restart with a different --threads only
+    // have their older history through loadHistory()
+    void recent(const std::string& room, size_t count, std::vector<MessagePtr>& out);
+
+    // floor(): where a room the log has nothing of numbers from, above any seq a deleted segment
+    // held (see record.h). raiseFloor(): seq is no longer kept anywhere else
+    uint64_t floor() const { return numbering_floor; }
+    void raiseFloor(uint64_t seq) { numbering_floor = std::max(numbering_floor, seq); }
+
+    const Stats& stats() const { return counters; }
+
+private:
+    struct Segment {
+        uint64_t number;
+        std::string path;
+    };
+
+    // Tail: a room's last record in one segment
+    struct Tail {
+        uint64_t offset;
+        uint64_t seq;
+    };
+
+    std::string dir;
+    int reactor = 0;
+    int fd = -1;
+    uint64_t segment = 0;               // number of the segment being written
+    size_t segment_bytes = 0;
+    uint64_t segment_records = 0;       // written to the current segment (for its footer)
+    uint64_t buffered_records = 0;      // in buffer
+    std::vector<Segment> segments;      // this reactor's segments, oldest first
+    std::string buffer;                 // appended, not written yet
+    std::vector<DurableAck> waiting;    // acks for what's in buffer
+    uint64_t numbering_floor = 0;       // written at the start of every segment once it's set
+    Stats counters;
+
+    // Where each room's last record is, by segment number, for every segment holding the room
+    std::unordered_map<std::string, std::map<uint64_t, Tail>> tails;
+    std::unordered_map<std::string, Tail> buffered_tails; // the same for what's in buffer (current segment)
+    std::set<uint64_t> unchained; // segments written before records pointed back, walked on a miss
+
+    bool startSegment();
+    bool writeOut(std::string&& bytes, uint64_t records);
+    void indexSegment(const Segment& segment);
+    void dropTails(uint64_t number);
+};
+
+// segmentFiles(): names of the segment files in dir (every reactor's), by reactor then number
+std::vector<std::string> segmentFiles(const std::string& dir);
+
+/*
+recoverLogs(): checks every segment in dir before anything reads them, several at a time.
+
+A sealed segment (valid footer) is trusted without being read, unless
+verify_all. Any other one is read with every CRC checked and cut after its
+last good record (a torn write), then sealed if seal is set (a standby
+leaves its copies exactly as the leader wrote them)
+*/
+struct RecoveryReport {
+    uint64_t segments = 0;
+    uint64_t sealed = 0;       // trusted from their footer
+    uint64_t verified = 0;     // read and CRC-checked
+    uint64_t records = 0;      // in the verified ones
+    uint64_t torn = 0;         // cut short
+    uint64_t cut_bytes = 0;
+    uint64_t unreadable = 0;   // older record version, left alone
+};
+RecoveryReport recoverLogs(const std::string& dir, bool seal, bool verify_all);
+
+/*
+loadHistory(): at startup, finds the last per_room messages of every room in
+dir (whatever reactor wrote them) and hands each room's list to add, oldest first.
+Segments are read several at a time; a sealed one through its summary, following
+each room's records back from the last, anything else is walked.
+Returns the highest numbering floor found (see MessageLog::floor())
+*/
+uint64_t loadHistory(const std::string& dir, size_t per_room,
+                 const std::function<void(const std::string& room, const std::vector<MessagePtr>& messages)>& add);
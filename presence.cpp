@@ -0,0 +1,114 @@
+/*
+Cluster Presence (see presence.h)
+*/
+
+#include <algorithm>
+
+#include "presence.h"
+
+void PresenceState::stamp(const std::string& user, Local& local) {
+    if (local.version != 0) {
+        changes.erase(local.version);
+        departures.erase(local.version);
+    }
+    local.version = ++version_;
+    changes[local.version] = user;
+    if (local.sessions == 0) departures[local.version] = user;
+}
+
+bool PresenceState::join(const std::string& user) {
+    Local& local = users[user];
+    if (local.sessions++ > 0) return false;
+    stamp(user, local);
+    return true;
+}
+
+bool PresenceState::leave(const std::string& user) {
+    auto found = users.find(user);
+    if (found == users.end() || found->second.sessions == 0) return false;
+    if (--found->second.sessions > 0) return false;
+    stamp(user, found->second);
+    return true;
+}
+
+bool PresenceState::onlineHere(const std::string& user) const {
+    auto found = users.find(user);
+    return found != users.end() && found->second.sessions > 0;
+}
+
+PresenceBatch PresenceState::batchFrom(uint64_t known) const {
+    PresenceBatch batch;
+    batch.epoch = epoch_;
+    batch.to = version_;
+    if (known == 0 || known < collected || known > version_) { // snapshot: only who's online
+        for (auto& entry : users) {
+            if (entry.second.sessions > 0) batch.users.emplace_back(entry.first, true);
+        }
+        return batch;
+    }
+    batch.from = known;
+    for (auto it = changes.upper_bound(known); it != changes.end(); ++it) {
+        batch.users.emplace_back(it->second, users.at(it->second).sessions > 0);
+    }
+    return batch;
+}
+
+void PresenceState::collect(uint64_t acked, size_t keep) {
+    while (!departures.empty() && (departures.begin()->first <= acked || departures.size() > keep)) {
+        auto oldest = departures.begin();
+        collected = std::max(collected, oldest->first);
+        users.erase(oldest->second);
+        changes.erase(oldest->first);
+        departures.erase(oldest);
+    }
+}
+
+PresenceState::Applied PresenceState::apply(const std::string& node, const PresenceBatch& batch) {
+    Replica& replica = replicas[node];
+    if (batch.epoch < replica.epoch) return stale; // from before a restart
+    if (batch.epoch == replica.epoch && batch.to <= replica.version) return stale;
+
+    if (batch.from == 0) {
+        replica.epoch = batch.epoch;
+        replica.users.clear();
+    } else if (batch.epoch != replica.epoch || batch.from != replica.version) {
+        return gap;
+    }
+    for (auto& user : batch.users) {
+        if (user.second) replica.users.insert(user.first);
+        else replica.users.erase(user.first);
+    }
+    replica.version = batch.to;
+    return applied;
+}
+
+std::pair<uint64_t, uint64_t> PresenceState::known(const std::string& node) const {
+    auto found = replicas.find(node);
+    if (found == replicas.end()) return {0, 0};
+    return {found->second.epoch, found->second.version};
+}
+
+std::vector<std::string> PresenceState::where(const std::string& user) const {
+    std::vector<std::string> nodes;
+    for (auto& entry : replicas) {
+        if (entry.second.users.count(user)) nodes.push_back(entry.first);
+    }
+    return nodes;
+}
+
+size_t PresenceState::remoteUsers() const {
+    size_t total = 0;
+    for (auto& entry : replicas) total += entry.second.users.size();
+    return total;
+}
+
+std::vector<std::string> PresenceState::nodes() const {
+    std::vector<std::string> nodes;
+    for (auto& entry : replicas) nodes.push_back(entry.first);
+    return nodes;
+}
+
+size_t PresenceState::usersOn(const std::string& node) const {
+    auto found = replicas.find(node);
+    return found == replicas.end() ? 0 : found->second.users.size();
+}
@@ -0,0 +1,105 @@
+/*
+Cluster Presence
+
+Which users are online on which node, known on every node without a
+central registry:
+    /where alice  ->  "alice is online on n1, n3"
+
+Each node is the only writer of its own part: the users with a session
+on it. That part is versioned; every time a user comes online here
+(first session) or goes offline (last session closed), the node's
+version goes up by one and the user is stamped with it. Another node
+holds a replica of each part, with the version it has seen up to, so
+getting it up to date means sending the users stamped after that
+version: a delta whose size follows churn, not how many are online.
+A user who came and went within one delta is sent once, as offline.
+
+A part also carries its node's epoch (the time it started), so state
+from before a restart is recognised and replaced as a whole: a delta
+from version 0 (a snapshot, only the online users) resets a replica.
+
+Departures are remembered (with their version) until every peer has
+acknowledged a version past them; a peer further behind than the
+oldest forgotten departure gets a snapshot instead of a delta. A delta
+only applies on top of exactly the version it starts from, anything
+else is a gap (answered with what we have, see cluster.cpp) or an old
+duplicate (ignored), so replicas converge to their owner's state
+whatever order or how often batches arrive.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct PresenceBatch {
+    uint64_t epoch = 0;
+    uint64_t from = 0; // the version this applies on top of, 0 = a snapshot
+    uint64_t to = 0;
+    std::vector<std::pair<std::string, bool>> users; // user, online
+};
+
+class PresenceState {
+public:
+    enum Applied { applied, stale, gap };
+
+    explicit PresenceState(uint64_t epoch) : epoch_(epoch) {}
+
+    // join()/leave(): a session of ours came or went, true if that changed whether the user is online here
+    bool join(const std::string& user);
+    bool leave(const std::string& user);
+
+    uint64_t epoch() const { return epoch_; }
+    uint64_t version() const { return version_; }
+    bool onlineHere(const std::string& user) const;
+    size_t localUsers() const { return users.size() - departures.size(); }
+
+    // batchFrom(): what a peer holding our part up to version `known` is missing
+    PresenceBatch batchFrom(uint64_t known) const;
+
+    // collect(): forgets departures every peer has (version <= acked), and the oldest past `keep`
+    void collect(uint64_t acked, size_t keep);
+
+    // apply(): a batch of `node`'s part
+    Applied apply(const std::string& node, const PresenceBatch& batch);
+
+    // known(): the epoch and version of our replica of `node`'s part (0, 0 if none)
+    std::pair<uint64_t, uint64_t> known(const std::string& node) const;
+
+    // drop(): forgets a node's part (it's gone), the next batch from it has to be a snapshot
+    void drop(const std::string& node) { replicas.erase(node); }
+
+    // where(): the other nodes `user` is online on
+    std::vector<std::string> where(const std::string& user) const;
+
+    size_t remoteUsers() const;
+    std::vector<std::string> nodes() const;
+    size_t usersOn(const std::string& node) const;
+
+private:
+    struct Local {
+        uint32_t sessions = 0;
+        uint64_t version = 0; // of the last change
+    };
+
+    struct Replica {
+        uint64_t epoch = 0;
+        uint64_t version = 0;
+        std::unordered_set<std::string> users;
+    };
+
+    uint64_t epoch_;
+    uint64_t version_ = 1; // a fresh node still has a version to send (its empty snapshot resets old replicas)
+    uint64_t collected = 0; // newest departure forgotten
+    std::unordered_map<std::string, Local> users; // online here, or departed and not yet collected
+    std::map<uint64_t, std::string> changes;      // version -> user, each user at its last change
+    std::map<uint64_t, std::string> departures;   // the changes that were departures
+
+    std::map<std::string, Replica> replicas; // by node id
+
+    void stamp(const std::string& user, Local& local);
+};
@@ -0,0 +1,196 @@
+/*
+CPU Profiler (see profiler.h)
+*/
+
+#include <map>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <unordered_map>
+#include <cstring>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "profiler.h"
+#include "admin.h"
+#include "server.h"
+
+namespace {
+
+const int max_frames = 64;
+const size_t ring_size = 4096;   // samples waiting to be drained (about 10 s of 4 busy threads)
+const size_t max_stacks = 20000; // distinct stacks kept, later new ones are counted as "[other stacks]"
+const int profile_signal = SIGPROF;
+
+struct Sample {
+    std::atomic<uint64_t> ready{0}; // n + 1 once sample n is written into this slot
+    const char* thread;
+    int depth;
+    void* frames[max_frames];
+};
+
+// Written by the signal handlers, read by the profiler thread
+Sample ring[ring_size];
+std::atomic<uint64_t> head{0}; // next sample to claim
+std::atomic<uint64_t> tail{0}; // next sample to drain (slots below it are free again)
+std::atomic<uint64_t> dropped{0};
+
+std::mutex totals_mutex; // guards totals and samples (the profiler thread and the admin socket)
+std::map<std::string, uint64_t> totals; // folded stack -> samples
+uint64_t samples = 0;
+
+std::unordered_map<void*, std::string> names; // frame address -> function, profiler thread only
+long interval_ns = 0;
+int sampling_hz = 0;
+
+thread_local const char* thread_name = nullptr;
+
+// onProfileSignal(): runs on the sampled thread, claims a slot and fills it (or drops the sample)
+void onProfileSignal(int) {
+    int saved = errno;
+    uint64_t n = head.load(std::memory_order_relaxed);
+    do {
+        if (n - tail.load(std::memory_order_acquire) >= ring_size) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            errno = saved;
+            return;
+        }
+    } while (!head.compare_exchange_weak(n, n + 1, std::memory_order_relaxed));
+
+    Sample& sample = ring[n % ring_size];
+    sample.thread = thread_name;
+    sample.depth = backtrace(sample.frames, max_frames);
+    sample.ready.store(n + 1, std::memory_order_release);
+    errno = saved;
+}
+
+std::string frameName(void* address) {
+    auto found = names.find(address);
+    if (found != names.end()) return found->second;
+
+    Dl_info info;
+    std::string name = "[unknown]";
+    bool known = dladdr(address, &info) != 0;
+    if (known && info.dli_sname) {
+        int status;
+        char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+        name = status == 0 ? demangled : info.dli_sname;
+        free(demangled);
+    } else if (known && info.dli_fname) { // not exported (static, anonymous namespace): at least say where
+        const char* slash = strrchr(info.dli_fname, '/');
+        name = std::string("[") + (slash ? slash + 1 : info.dli_fname) + "]";
+    }
+    for (char& c : name) {
+        if (c == ';') c = ':'; // the folded format's separator
+    }
+    names.emplace(address, name);
+    return name;
+}
+
+// fold(): "thread;outermost;...;innermost"
+std::string fold(const Sample& sample) {
+    std::string stack = sample.thread ? sample.thread : "thread";
+    // 0 and 1 are the handler and the signal trampoline, 2 is where the thread was interrupted;
+    // the rest are return addresses, one byte back lands inside the calling function
+    for (int i = sample.depth - 1; i >= 2; i--) {
+        char* address = (char*)sample.frames[i];
+        stack += ";" + frameName(i > 2 ? address - 1 : address);
+    }
+    return stack;
+}
+
+void drain() {
+    std::vector<std::string> stacks;
+    uint64_t n = tail.load(std::memory_order_relaxed);
+    uint64_t end = head.load(std::memory_order_acquire);
+    for (; n < end; n++) {
+        Sample& sample = ring[n % ring_size];
+        if (sample.ready.load(std::memory_order_acquire) != n + 1) break; // still being written, next time
+        stacks.push_back(fold(sample));
+        tail.store(n + 1, std::memory_order_release); // the slot can be claimed again
+    }
+
+    std::lock_guard<std::mutex> lock(totals_mutex);
+    for (const std::string& stack : stacks) {
+        auto found = totals.find(stack);
+        if (found != totals.end()) found->second++;
+        else if (totals.size() < max_stacks) totals.emplace(stack, 1);
+        else totals[stack.substr(0, stack.find(';')) + ";[other stacks]"]++;
+        samples++;
+    }
+}
+
+void runProfiler() {
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        drain();
+    }
+}
+
+std::string profileStats() {
+    std::lock_guard<std::mutex> lock(totals_mutex);
+    return "profile_hz " + std::to_string(sampling_hz) + "\n" +
+           "profile_samples " + std::to_string(samples) + "\n" +
+           "profile_dropped " + std::to_string(dropped.load()) + "\n" +
+           "profile_stacks " + std::to_string(totals.size()) + "\n";
+}
+
+} // namespace
+
+void startProfiler(int hz) {
+    if (hz <= 0) return;
+    sampling_hz = hz;
+    interval_ns = 1000000000L / hz;
+
+    // backtrace() loads its unwinder on first use, which isn't safe in a signal handler: do it now
+    void* warm[1];
+    backtrace(warm, 1);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onProfileSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(profile_signal, &action, nullptr);
+
+    addAdminStats(profileStats);
+    addAdminCommand("profile", "CPU samples as folded stacks, for flame graphs (profile reset clears them)",
+                    [](const std::string& args) {
+        std::lock_guard<std::mutex> lock(totals_mutex);
+        if (args == "reset") {
+            totals.clear();
+            samples = 0;
+            return std::string("Profile cleared\n");
+        }
+        std::string out;
+        for (auto& entry : totals) out += entry.first + " " + std::to_string(entry.second) + "\n";
+        return out.empty() ? std::string("No samples yet\n") : out;
+    });
+    std::thread(runProfiler).detach();
+}
+
+void profileThread(const char* name) {
+    if (interval_ns == 0) return;
+    thread_name = name;
+
+    // A timer on this thread's CPU clock, signalling this thread
+    sigevent event;
+    memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = profile_signal;
+    event._sigev_un._tid = gettid();
+    timer_t timer;
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &timer) != 0) {
+        logLine(std::string("Profiler: no timer for ") + name + " (" + strerror(errno) + ")");
+        return;
+    }
+    itimerspec every;
+    every.it_interval.tv_sec = interval_ns / 1000000000L;
+    every.it_interval.tv_nsec = interval_ns % 1000000000L;
+    every.it_value = every.it_interval;
+    timer_settime(timer, 0, &every, nullptr);
+}
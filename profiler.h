@@ -0,0 +1,26 @@
+/*
+CPU Profiler
+
+Always-on sampling of the reactors and worker threads, read as folded
+stacks (one "root;caller;callee count" line per distinct stack) that
+flamegraph.pl and most flame graph viewers take as they are:
+    echo profile | nc -U chat_admin.sock > chat.folded
+    flamegraph.pl chat.folded > chat.svg
+
+Each thread that calls profileThread() gets its own timer on its own CPU
+clock (--profile-hz, 99 by default), so a thread is sampled while it
+runs and costs nothing while it waits in select(). The timer's signal
+(SIGPROF) lands on that thread, whose handler only runs backtrace() into
+a free slot of a ring shared by all threads (claimed with one CAS, no
+locks). A profiler thread drains the ring a few times a second, names
+the frames (cached per address) and adds each stack to the totals.
+A full ring drops samples rather than wait; profile_dropped counts them.
+*/
+
+#pragma once
+
+// startProfiler(): samples every thread that calls profileThread() from then on, hz = 0 leaves it off
+void startProfiler(int hz);
+
+// profileThread(): starts sampling the calling thread, name is the root frame of its stacks
+void profileThread(const char* name);
@@ -0,0 +1,303 @@
+/*
+Message Records
+
+One fixed layout for a message, used as-is in the history log (log.cpp)
+and on the binary wire (wire.cpp), so neither side parses anything:
+a reader checks the header once, then reads fields in place, straight
+from an mmap'd segment or a receive buffer.
+
+Layout (little-endian, every record padded to a multiple of 8 bytes):
+    RecordHeader    56 bytes: size, version, kind, CRC32C, seq, time,
+                    then an offset table (offset, length) per field
+    field bytes     channel, text, payload (payload usually points
+                    inside text, "alice: hi" -> "hi", so it isn't stored twice)
+    padding         zeros up to the next multiple of 8
+
+Records follow each other with no framing in between: the next one
+starts size bytes after this one, so walking a log is a pointer walk.
+The CRC covers the whole record except itself, and is only checked
+where bytes come from outside (recovery, clients), not on every walk.
+A closed log segment ends with a footer record (footer_kind).
+Header only, so client.cpp can read records too.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "records are read in place, little-endian hosts only");
+
+const uint16_t record_version = 2; // 2: CRC32C in the header
+const size_t record_align = 8;
+const uint32_t max_record = 1 << 20; // anything bigger is corruption
+
+enum RecordField { channel_field, text_field, payload_field, record_fields };
+
+struct FieldRef {
+    uint32_t offset; // from the start of the record
+    uint32_t length;
+};
+
+struct RecordHeader {
+    uint32_t size;       // whole record, header and padding included
+    uint16_t version;    // record_version
+    uint8_t kind;        // MessageKind (or footer_kind)
+    uint8_t field_count; // record_fields
+    uint32_t crc;        // CRC32C of every other byte of the record
+    uint32_t back;       // history log only: how far back (in record_align units) the previous record
+                         // of the same channel in this segment starts, 0 = none (see log.h)
+    uint64_t seq;        // room sequence number (0 on the wire)
+    uint64_t time_ns;    // when the message was made (CLOCK_REALTIME)
+    FieldRef fields[record_fields];
+};
+
+static_assert(sizeof(RecordHeader) == 56, "record header layout is part of the format");
+
+const size_t crc_offset = offsetof(RecordHeader, crc);
+
+// ------------------- CRC32C -------------------
+// SSE4.2 has an instruction for it (picked at runtime), a table does the rest
+
+namespace crc32c_detail {
+
+inline const uint32_t* table() {
+    static const struct Table {
+        uint32_t entries[256];
+        Table() {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; bit++) crc = crc & 1 ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+                entries[i] = crc;
+            }
+        }
+    } instance;
+    return instance.entries;
+}
+
+inline uint32_t software(uint32_t crc, const uint8_t* p, size_t size) {
+    const uint32_t* entries = table();
+    while (size--) crc = entries[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) inline uint32_t hardware(uint32_t crc, const uint8_t* p, size_t size) {
+    uint64_t wide = crc;
+    for (; size >= 8; p += 8, size -= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        wide = _mm_crc32_u64(wide, word);
+    }
+    crc = (uint32_t)wide;
+    while (size--) crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+
+inline bool hasHardware() {
+    static const bool supported = __builtin_cpu_supports("sse4.2");
+    return supported;
+}
+#endif
+
+} // namespace crc32c_detail
+
+// crc32c(): continues crc over more bytes (start with 0)
+inline uint32_t crc32c(uint32_t crc, const void* data, size_t size) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+#if defined(__x86_64__)
+    if (crc32c_detail::hasHardware()) return ~crc32c_detail::hardware(~crc, p, size);
+#endif
+    return ~crc32c_detail::software(~crc, p, size);
+}
+
+// recordCrc(): CRC32C of a record, skipping the crc field itself
+inline uint32_t recordCrc(const char* data, uint32_t size) {
+    uint32_t crc = crc32c(0, data, crc_offset);
+    return crc32c(crc, data + crc_offset + sizeof(uint32_t), size - crc_offset - sizeof(uint32_t));
+}
+
+enum RecordStatus {
+    record_ok,
+    record_partial, // not all of it is here yet (or the log ends mid-record)
+    record_bad      // not a record we can read
+};
+
+// checkRecord(): is there one complete, readable record at data?
+inline RecordStatus checkRecord(const char* data, size_t available) {
+    if (available < sizeof(RecordHeader)) return record_partial;
+    const RecordHeader* header = reinterpret_cast<const RecordHeader*>(data);
+
+    if (header->size < sizeof(RecordHeader) || header->size % record_align != 0 || header->size > max_record ||
+        header->version != record_version || header->field_count != record_fields) {
+        return record_bad;
+    }
+    if (available < header->size) return record_partial;
+
+    for (const FieldRef& field : header->fields) {
+        if (field.offset < sizeof(RecordHeader) || (uint64_t)field.offset + field.length > header->size) return record_bad;
+    }
+    return record_ok;
+}
+
+// verifyRecord(): checkRecord(), plus the CRC for a complete record
+inline RecordStatus verifyRecord(const char* data, size_t available) {
+    RecordStatus status = checkRecord(data, available);
+    if (status != record_ok) return status;
+    const RecordHeader* header = reinterpret_cast<const RecordHeader*>(data);
+    return recordCrc(data, header->size) == header->crc ? record_ok : record_bad;
+}
+
+/*
+RecordView: read-only access to a record that passed checkRecord().
+Fields are views into the record's own bytes, valid as long as they are
+*/
+class RecordView {
+public:
+    explicit RecordView(const char* data) : data(data) {}
+
+    const RecordHeader& header() const { return *reinterpret_cast<const RecordHeader*>(data); }
+    uint32_t size() const { return header().size; }
+    uint8_t kind() const { return header().kind; }
+    uint64_t seq() const { return header().seq; }
+    uint64_t timeNs() const { return header().time_ns; }
+    uint32_t back() const { return header().back; }
+
+    std::string_view field(RecordField which) const {
+        const FieldRef& ref = header().fields[which];
+        return std::string_view(data + ref.offset, ref.length);
+    }
+    std::string_view channel() const { return field(channel_field); }
+    std::string_view text() const { return field(text_field); }
+    std::string_view payload() const { return field(payload_field); }
+
+private:
+    const char* data;
+};
+
+// appendRecord(): encodes one record at the end of out (out.size() stays a multiple of 8).
+// False, and nothing appended, if the message is too big to be a record
+inline bool appendRecord(std::string& out, uint8_t kind, uint64_t seq, uint64_t time_ns, std::string_view channel,
+                         std::string_view text, std::string_view payload, uint32_t back = 0) {
+    if ((uint64_t)channel.size() + text.size() + payload.size() > max_record - sizeof(RecordHeader) - record_align) {
+        return false;
+    }
+    bool shared = payload.size() <= text.size() &&
+                  text.compare(text.size() - payload.size(), payload.size(), payload) == 0;
+
+    RecordHeader header;
+    memset(&header, 0, sizeof(header));
+    header.version = record_version;
+    header.kind = kind;
+    header.field_count = record_fields;
+    header.seq = seq;
+    header.time_ns = time_ns;
+    header.back = back;
+
+    uint32_t at = sizeof(RecordHeader);
+    header.fields[channel_field] = FieldRef{at, (uint32_t)channel.size()};
+    at += channel.size();
+    header.fields[text_field] = FieldRef{at, (uint32_t)text.size()};
+    at += text.size();
+    if (shared) {
+        header.fields[payload_field] = FieldRef{(uint32_t)(at - payload.size()), (uint32_t)payload.size()};
+    } else {
+        header.fields[payload_field] = FieldRef{at, (uint32_t)payload.size()};
+        at += payload.size();
+    }
+    header.size = (at + record_align - 1) / record_align * record_align;
+
+    size_t start = out.size();
+    out.resize(start + header.size, '\0'); // padding stays zero
+    char* record = &out[start];
+    memcpy(record, &header, sizeof(header));
+    memcpy(record + header.fields[channel_field].offset, channel.data(), channel.size());
+    memcpy(record + header.fields[text_field].offset, text.data(), text.size());
+    if (!shared) memcpy(record + header.fields[payload_field].offset, payload.data(), payload.size());
+
+    uint32_t crc = recordCrc(record, header.size);
+    memcpy(record + crc_offset, &crc, sizeof(crc));
+    return true;
+}
+
+// ------------------- Binary Wire -------------------
+
+// wire_magic: a binary client's first bytes (see wire.h), starts with a NUL so it can't be the start of a chat line
+const char wire_magic[8] = {'\0', 'C', 'H', 'A', 'T', 'R', 'E', 'C'};
+const char wire_ids_magic[8] = {'\0', 'C', 'H', 'A', 'T', 'I', 'D', 'S'}; // the compact wire
+
+// Varints (compact wire): 7 bits per byte, low bits first, high bit = more follows
+inline void appendVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += (char)(value | 0x80);
+        value >>= 7;
+    }
+    out += (char)value;
+}
+
+// readVarint(): false if data runs out first (the frame isn't all here yet) or it's too long
+inline bool readVarint(const char*& data, const char* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && data < end; shift += 7) {
+        uint8_t byte = *data++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+// ------------------- Segment Footer -------------------
+
+/*
+The last record of a closed segment: how many records and bytes came
+before it. A segment ending in a valid footer that matches its size was
+closed cleanly, recovery can trust it without reading it.
+
+Just before the footer, a history log segment sums up its rooms, so
+nothing has to walk it to find them: summary records (summary_kind)
+of [u32 size][room][u64 last seq][u64 offset of its last record]
+entries. The footer's seq is where the first one starts (0 = none)
+
+Once older segments have been deleted, a history log segment starts
+with a floor record (floor_kind): its seq is the highest any deleted
+segment held, so a room whose records all went numbers on above it
+*/
+const uint8_t footer_kind = 255;
+const uint8_t summary_kind = 253;
+const uint8_t floor_kind = 252;
+const size_t footer_size = sizeof(RecordHeader) + 16;
+
+inline void appendFooter(std::string& out, uint64_t records, uint64_t data_bytes, uint64_t time_ns,
+                         uint64_t summary_at = 0) {
+    char counts[16];
+    memcpy(counts, &records, 8);
+    memcpy(counts + 8, &data_bytes, 8);
+    appendRecord(out, footer_kind, summary_at, time_ns, "", "", std::string_view(counts, sizeof(counts)));
+}
+
+// sealedSegment(): does a segment of this size end in a footer that matches it?
+inline bool sealedSegment(const char* data, size_t size, uint64_t& records) {
+    if (size < footer_size) return false;
+    const char* footer = data + size - footer_size;
+    if (verifyRecord(footer, footer_size) != record_ok) return false;
+
+    RecordView view(footer);
+    uint64_t data_bytes;
+    if (view.kind() != footer_kind || view.size() != footer_size || view.payload().size() != 16) return false;
+    memcpy(&records, view.payload().data(), 8);
+    memcpy(&data_bytes, view.payload().data() + 8, 8);
+    return data_bytes == size - footer_size;
+}
+
+// summaryOffset(): where a sealed segment's summary starts (0 = it has none)
+inline uint64_t summaryOffset(const char* data, size_t size) {
+    uint64_t at = RecordView(data + size - footer_size).seq();
+    return at < size - footer_size ? at : 0;
+}
@@ -0,0 +1,668 @@
+/*
+Log Replication (see replica.h)
+
+Leader: one thread with its own select() loop over the followers.
+Reactors post what they wrote to its Inbox; each pass of the loop turns
+everything pending into one compressed batch per follower (the same
+frame for every follower that is caught up).
+
+Follower: one thread with a blocking connection to the leader. It writes
+pieces with pwrite() at the leader's offsets and posts the records to
+the reactors owning their rooms, so their history caches stay warm.
+*/
+
+#include <iostream>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <zlib.h>
+
+#include "replica.h"
+#include "clock.h"
+#include "codec.h"
+#include "admin.h"
+#include "server.h"
+
+namespace {
+
+const size_t catchup_chunk = 1 << 20;     // bytes of a segment read per catch-up piece
+const size_t catchup_outbox = 4 << 20;    // catch-up waits while a follower has this much unsent
+const size_t max_outbox = 256 << 20;      // a follower this far behind is dropped (it reconnects and catches up)
+const size_t frame_header = 16;           // [u32 compressed size][u32 raw size][u64 batch]
+
+// validName(): only plain segment names (and the epoch file), a leader can't write outside the follower's log dir
+bool validName(const std::string& name) {
+    int reactor;
+    unsigned long long number;
+    char tail;
+    if (name == "epoch") return true;
+    return name.find('/') == std::string::npos &&
+           sscanf(name.c_str(), "log-%d-%llu.se%c", &reactor, &number, &tail) == 3 && tail == 'g';
+}
+
+// Piece: bytes written at offset of a segment (skip = leading bytes a follower already has),
+// or the segment being deleted (no bytes)
+struct Piece {
+    std::string file;
+    uint64_t offset;
+    bool whole;
+    std::shared_ptr<const std::string> bytes;
+    size_t skip = 0;
+    bool deleted = false;
+};
+
+const uint8_t piece_whole = 1;
+const uint8_t piece_deleted = 2;
+
+// ------------------- Leader -------------------
+
+struct Range {
+    std::string file;
+    uint64_t begin;
+    uint64_t end;
+};
+
+struct Follower {
+    int fd = -1;
+    std::string inbuf;
+    bool hello = false;                        // catch-up planned
+    std::deque<Frame> outbox;
+    size_t out_offset = 0;
+    size_t queued = 0;                         // bytes in outbox
+    std::map<std::string, uint64_t> snapshot;  // segment sizes when the catch-up was planned
+    std::deque<Range> catchup;                 // what's still to send of them
+    std::vector<Piece> held;                   // live pieces waiting for the catch-up
+    std::deque<std::pair<uint64_t, uint64_t>> unacked; // batch, sent at (ns)
+};
+
+// Read by the admin socket while the replicator (or a follower thread) updates them
+struct ReplicaStats {
+    std::atomic<uint64_t> followers{0};
+    std::atomic<uint64_t> batches{0};
+    std::atomic<uint64_t> raw_bytes{0};
+    std::atomic<uint64_t> sent_bytes{0};
+    std::atomic<uint64_t> compress_ns{0};
+    std::atomic<uint64_t> handoff_ns{0}; // reactor time spent handing writes over
+    std::atomic<uint64_t> unacked{0};
+    std::atomic<uint64_t> lag_ns{0};     // oldest unacked batch, over all followers
+    // follower side
+    std::atomic<bool> connected{false};
+    std::atomic<uint64_t> applied{0};
+    std::atomic<uint64_t> applied_bytes{0};
+    std::atomic<uint64_t> record_lag_ns{0}; // age of the newest record when it was applied
+} stats;
+
+bool leader = false;
+std::string leader_dir;
+Inbox replica_inbox;
+int listen_fd = -1;
+std::vector<Follower> followers;
+std::vector<Piece> pending; // live pieces since the last batch
+uint64_t next_batch = 1;
+
+// encodeBatch(): one compressed frame holding the pieces
+Frame encodeBatch(uint64_t batch, const std::vector<Piece>& pieces) {
+    std::string raw;
+    for (const Piece& piece : pieces) {
+        putU16(raw, piece.file.size());
+        raw += piece.file;
+        putU64(raw, piece.offset + piece.skip);
+        if (piece.deleted) {
+            putU8(raw, piece_deleted);
+            putU32(raw, 0);
+            continue;
+        }
+        putU8(raw, piece.whole && piece.skip == 0 ? piece_whole : 0);
+        putU32(raw, piece.bytes->size() - piece.skip);
+        raw.append(*piece.bytes, piece.skip, std::string::npos);
+    }
+
+    uint64_t start = realtimeNs();
+    uLongf size = compressBound(raw.size());
+    std::string out(frame_header + size, '\0');
+    compress2((Bytef*)&out[frame_header], &size, (const Bytef*)raw.data(), raw.size(), Z_BEST_SPEED);
+    out.resize(frame_header + size);
+    stats.compress_ns += realtimeNs() - start;
+
+    std::string header;
+    putU32(header, size);
+    putU32(header, raw.size());
+    putU64(header, batch);
+    out.replace(0, frame_header, header);
+
+    stats.raw_bytes += raw.size();
+    return std::make_shared<const std::string>(std::move(out));
+}
+
+void queueBatch(Follower& f, uint64_t batch, const Frame& frame) {
+    f.outbox.push_back(frame);
+    f.queued += frame->size();
+    f.unacked.emplace_back(batch, realtimeNs());
+    stats.sent_bytes += frame->size();
+}
+
+// trim(): drops what the follower got (or will get) through its catch-up
+std::vector<Piece> trim(const Follower& f, const std::vector<Piece>& pieces) {
+    std::vector<Piece> out;
+    for (const Piece& piece : pieces) {
+        if (piece.deleted) {
+            out.push_back(piece);
+            continue;
+        }
+        auto found = f.snapshot.find(piece.file);
+        uint64_t covered = found == f.snapshot.end() ? 0 : found->second;
+        if (piece.offset + piece.bytes->size() <= covered) continue;
+
+        out.push_back(piece);
+        if (covered > piece.offset) out.back().skip = covered - piece.offset;
+    }
+    return out;
+}
+
+void sendPieces(Follower& f, const std::vector<Piece>& pieces) {
+    std::vector<Piece> trimmed = trim(f, pieces);
+    if (trimmed.empty()) return;
+    uint64_t batch = next_batch++;
+    queueBatch(f, batch, encodeBatch(batch, trimmed));
+    stats.batches++;
+}
+
+// sendLive(): this pass's pieces, one shared frame for every follower that needs them all as they are
+void sendLive() {
+    uint64_t shared_batch = 0;
+    Frame shared;
+
+    for (Follower& f : followers) {
+        if (!f.hello || !f.catchup.empty() || !f.held.empty()) {
+            f.held.insert(f.held.end(), pending.begin(), pending.end());
+            continue;
+        }
+        std::vector<Piece> trimmed = trim(f, pending);
+        bool untouched = trimmed.size() == pending.size();
+        for (const Piece& piece : trimmed) untouched = untouched && piece.skip == 0;
+        if (!untouched) {
+            sendPieces(f, trimmed);
+            continue;
+        }
+        if (!shared) {
+            shared_batch = next_batch++;
+            shared = encodeBatch(shared_batch, pending);
+            stats.batches++;
+        }
+        queueBatch(f, shared_batch, shared);
+    }
+    pending.clear();
+}
+
+// sendCatchup(): the next chunk of the follower's catch-up, cut on record boundaries
+void sendCatchup(Follower& f) {
+    Range& range = f.catchup.front();
+    MappedSegment mapped;
+    if (!mapped.map(leader_dir + "/" + range.file)) { // deleted since (old segments are dropped)
+        f.catchup.pop_front();
+        return;
+    }
+    uint64_t end = std::min<uint64_t>(range.end, mapped.size);
+    uint64_t at = range.begin;
+    while (at < end && at - range.begin < catchup_chunk && checkRecord(mapped.data + at, end - at) == record_ok) {
+        at += RecordView(mapped.data + at).size();
+    }
+
+    // No whole record here (a write in progress when the snapshot was taken): send the bytes as they are
+    bool whole = at > range.begin;
+    if (!whole) at = end;
+
+    Piece piece{range.file, range.begin, whole,
+                std::make_shared<const std::string>(mapped.data + range.begin, at - range.begin)};
+    range.begin = at;
+    if (range.begin >= end) f.catchup.pop_front();
+
+    uint64_t batch = next_batch++;
+    queueBatch(f, batch, encodeBatch(batch, {piece}));
+    stats.batches++;
+}
+
+// readHello(): what the follower already has, turned into its catch-up plan
+bool readHello(Follower& f) {
+    Reader reader{f.inbuf.data(), f.inbuf.size()};
+    uint64_t count = reader.number(4);
+    std::map<std::string, uint64_t> has;
+    for (uint64_t i = 0; i < count && reader.ok; i++) {
+        size_t size = reader.number(2);
+        const char* name = reader.bytes(size);
+        uint64_t length = reader.number(8);
+        if (reader.ok) has[std::string(name, size)] = length;
+    }
+    if (!reader.ok) return false; // not all here yet
+    f.inbuf.erase(0, f.inbuf.size() - reader.left);
+
+    for (const std::string& file : segmentFiles(leader_dir)) {
+        struct stat info;
+        if (stat((leader_dir + "/" + file).c_str(), &info) < 0) continue;
+        uint64_t size = info.st_size;
+        f.snapshot[file] = size;
+
+        // A follower with more than we have is copying someone else's log: start the file over
+        uint64_t begin = has.count(file) && has[file] <= size ? has[file] : 0;
+        if (begin < size) f.catchup.push_back(Range{file, begin, size});
+    }
+
+    // What we deleted while it was away goes on its side too, once the catch-up is sent
+    for (auto& entry : has) {
+        if (f.snapshot.count(entry.first)) continue;
+        Piece gone{entry.first, 0, false, nullptr};
+        gone.deleted = true;
+        f.held.push_back(gone);
+    }
+    f.hello = true;
+
+    // Our numbering epoch, so the follower numbers on under it once promoted
+    FILE* epoch = fopen((leader_dir + "/epoch").c_str(), "r");
+    if (epoch) {
+        char text[32];
+        size_t size = fread(text, 1, sizeof(text), epoch);
+        fclose(epoch);
+        if (size > 0) sendPieces(f, {Piece{"epoch", 0, false, std::make_shared<const std::string>(text, size)}});
+    }
+    logLine("[replica] follower connected, catch-up of " + std::to_string(f.catchup.size()) + " segment(s)");
+    return true;
+}
+
+// readFollower(): the hello, then acks. False when the follower is gone
+bool readFollower(Follower& f) {
+    char buffer[4096];
+    ssize_t got = read(f.fd, buffer, sizeof(buffer));
+    if (got < 0 && (errno == EAGAIN || errno == EINTR)) return true;
+    if (got <= 0) return false;
+    f.inbuf.append(buffer, got);
+
+    if (!f.hello && !readHello(f)) return f.inbuf.size() < (1 << 20);
+
+    size_t at = 0;
+    while (f.inbuf.size() - at >= 8) {
+        Reader reader{f.inbuf.data() + at, 8};
+        uint64_t acked = reader.number(8);
+        while (!f.unacked.empty() && f.unacked.front().first <= acked) f.unacked.pop_front();
+        at += 8;
+    }
+    f.inbuf.erase(0, at);
+    return true;
+}
+
+bool flushFollower(Follower& f) {
+    while (!f.outbox.empty()) {
+        const std::string& data = *f.outbox.front();
+        ssize_t sent = send(f.fd, data.data() + f.out_offset, data.size() - f.out_offset, MSG_NOSIGNAL);
+        if (sent < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        f.out_offset += sent;
+        if (f.out_offset == data.size()) {
+            f.queued -= data.size();
+            f.outbox.pop_front();
+            f.out_offset = 0;
+        }
+    }
+    return true;
+}
+
+void runLeader() {
+    while (true) {
+        fd_set read_fds;
+        fd_set write_fds;
+        FD_ZERO(&read_fds);
+        FD_ZERO(&write_fds);
+        FD_SET(listen_fd, &read_fds);
+        FD_SET(replica_inbox.wake_fds[0], &read_fds);
+        int max_fd = std::max(listen_fd, replica_inbox.wake_fds[0]);
+        for (Follower& f : followers) {
+            FD_SET(f.fd, &read_fds);
+            if (!f.outbox.empty()) FD_SET(f.fd, &write_fds);
+            max_fd = std::max(max_fd, f.fd);
+        }
+
+        timeval timeout = {1, 0}; // keeps the lag current while idle
+        if (select(max_fd + 1, &read_fds, &write_fds, NULL, &timeout) < 0) continue;
+
+        if (FD_ISSET(replica_inbox.wake_fds[0], &read_fds)) replica_inbox.run();
+
+        if (FD_ISSET(listen_fd, &read_fds)) {
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd >= 0) {
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                Follower follower;
+                follower.fd = fd;
+                followers.push_back(std::move(follower));
+            }
+        }
+
+        std::vector<bool> gone(followers.size(), false);
+        for (size_t i = 0; i < followers.size(); i++) {
+            if (FD_ISSET(followers[i].fd, &read_fds) && !readFollower(followers[i])) gone[i] = true;
+        }
+
+        if (!pending.empty()) sendLive();
+
+        uint64_t now = realtimeNs();
+        uint64_t lag = 0, unacked = 0;
+        for (size_t i = 0; i < followers.size(); i++) {
+            Follower& f = followers[i];
+            if (f.hello && !f.catchup.empty() && f.queued < catchup_outbox) sendCatchup(f);
+            if (f.hello && f.catchup.empty() && !f.held.empty()) {
+                sendPieces(f, f.held);
+                f.held.clear();
+            }
+            if (!flushFollower(f) || f.queued > max_outbox) gone[i] = true;
+
+            if (!f.unacked.empty()) lag = std::max(lag, now - f.unacked.front().second);
+            unacked += f.unacked.size();
+        }
+        stats.lag_ns = lag;
+        stats.unacked = unacked;
+
+        for (size_t i = followers.size(); i-- > 0;) {
+            if (!gone[i]) continue;
+            close(followers[i].fd);
+            followers.erase(followers.begin() + i);
+            logLine("[replica] follower disconnected");
+        }
+        stats.followers = followers.size();
+    }
+}
+
+std::string leaderStats() {
+    char line[512];
+    uint64_t raw = stats.raw_bytes, sent = stats.sent_bytes;
+    snprintf(line, sizeof(line),
+             "replica_followers %llu\nreplica_batches %llu\nreplica_raw_bytes %llu\nreplica_sent_bytes %llu\n"
+             "replica_compression %.2f\nreplica_compress_ms %.1f\nreplica_handoff_ms %.1f\n"
+             "replica_unacked %llu\nreplica_lag_ms %.3f\n",
+             (unsigned long long)stats.followers.load(), (unsigned long long)stats.batches.load(),
+             (unsigned long long)raw, (unsigned long long)sent, sent ? (double)raw / sent : 0.0,
+             stats.compress_ns / 1e6, stats.handoff_ns / 1e6, (unsigned long long)stats.unacked.load(),
+             stats.lag_ns / 1e6);
+    return line;
+}
+
+// ------------------- Follower -------------------
+
+std::string follower_dir;
+std::string leader_host;
+int leader_port = 0;
+std::thread follower_thread;
+std::atomic<bool> promoting{false};
+std::atomic<bool> is_standby{false};
+std::map<std::string, int> files; // open segment copies (follower thread only)
+
+// readFull(): blocking read of exactly size bytes (false on disconnect, or when promoting)
+bool readFull(int fd, char* out, size_t size) {
+    size_t got = 0;
+    while (got < size) {
+        ssize_t n = recv(fd, out + got, size - got, 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            if (promoting) return false;
+            continue;
+        }
+        if (n <= 0) return false;
+        got += n;
+    }
+    return true;
+}
+
+bool sendAll(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+int connectLeader() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(leader_port);
+    if (fd < 0 || inet_pton(AF_INET, leader_host.c_str(), &addr.sin_addr) <= 0 ||
+        connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    timeval timeout = {1, 0}; // wake up now and then to notice a promotion
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return fd;
+}
+
+// hello(): how much of every segment we already hold (whole records only)
+std::string hello() {
+    std::vector<std::string> names = segmentFiles(follower_dir);
+    std::string out;
+    putU32(out, names.size());
+    for (const std::string& name : names) {
+        MappedSegment mapped;
+        uint64_t valid = 0;
+        if (mapped.map(follower_dir + "/" + name)) valid = walkRecords(mapped.data, mapped.size, [](const RecordView&) {});
+        putU16(out, name.size());
+        out += name;
+        putU64(out, valid);
+    }
+    return out;
+}
+
+int fileFor(const std::string& name) {
+    auto found = files.find(name);
+    if (found != files.end()) return found->second;
+    int fd = open((follower_dir + "/" + name).c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd >= 0) files[name] = fd;
+    return fd;
+}
+
+// apply(): writes a batch's pieces and hands their records to the rooms' owners
+bool apply(const std::string& raw) {
+    std::vector<std::vector<std::pair<std::string, MessagePtr>>> by_owner(reactors.size());
+    uint64_t newest = 0;
+    uint64_t floor = 0; // the leader's numbering floor, for rooms it deleted every record of
+
+    Reader reader{raw.data(), raw.size()};
+    while (reader.left > 0) {
+        size_t name_size = reader.number(2);
+        const char* name = reader.bytes(name_size);
+        uint64_t offset = reader.number(8);
+        uint8_t flags = reader.number(1);
+        size_t size = reader.number(4);
+        const char* bytes = reader.bytes(size);
+        if (!reader.ok) return false;
+
+        std::string file(name, name_size);
+        if (!validName(file)) return false;
+        if (flags & piece_deleted) { // the leader's retention
+            auto open_copy = files.find(file);
+            if (open_copy != files.end()) {
+                close(open_copy->second);
+                files.erase(open_copy);
+            }
+            unlink((follower_dir + "/" + file).c_str());
+            continue;
+        }
+        int fd = fileFor(file);
+        if (fd < 0) return false;
+        if (offset == 0) ftruncate(fd, 0); // a new segment, or one started over
+        for (size_t done = 0; done < size;) {
+            ssize_t n = pwrite(fd, bytes + done, size - done, offset + done);
+            if (n <= 0) return false;
+            done += n;
+        }
+
+        if (!(flags & piece_whole)) continue;
+        walkRecords(bytes, size, [&](const RecordView& record) {
+            newest = std::max(newest, record.timeNs());
+            if (record.kind() == floor_kind) floor = std::max(floor, record.seq());
+            if (record.kind() != chat_message) return;
+            std::string room(record.channel());
+            by_owner[ownerOf(room)].emplace_back(room, messageFromRecord(record));
+        });
+    }
+
+    for (size_t owner = 0; owner < by_owner.size(); owner++) {
+        if (by_owner[owner].empty()) continue;
+        auto messages = std::make_shared<std::vector<std::pair<std::string, MessagePtr>>>(std::move(by_owner[owner]));
+        post(owner, [owner, messages]() {
+            for (auto& entry : *messages) {
+                reactors[owner]->history.append(entry.first, entry.second);
+                noteNumbered(*reactors[owner], entry.first, entry.second->seq); // numbering goes on from it once promoted
+            }
+        });
+    }
+    for (size_t owner = 0; floor > 0 && owner < reactors.size(); owner++) {
+        post(owner, [owner, floor]() { reactors[owner]->log.raiseFloor(floor); });
+    }
+    if (newest) stats.record_lag_ns = realtimeNs() > newest ? realtimeNs() - newest : 0;
+    stats.applied_bytes += raw.size();
+    return true;
+}
+
+void runFollower() {
+    while (!promoting) {
+        int fd = connectLeader();
+        if (fd < 0 || !sendAll(fd, hello())) {
+            if (fd >= 0) close(fd);
+            sleep(1);
+            continue;
+        }
+        logLine("[replica] following " + leader_host + ":" + std::to_string(leader_port));
+        stats.connected = true;
+
+        char header[frame_header];
+        std::string compressed, raw;
+        while (readFull(fd, header, sizeof(header))) {
+            Reader reader{header, sizeof(header)};
+            uLongf compressed_size = reader.number(4);
+            uLongf raw_size = reader.number(4);
+            uint64_t batch = reader.number(8);
+
+            compressed.resize(compressed_size);
+            raw.resize(raw_size);
+            if (!readFull(fd, &compressed[0], compressed_size) ||
+                uncompress((Bytef*)&raw[0], &raw_size, (const Bytef*)compressed.data(), compressed_size) != Z_OK ||
+                !apply(raw)) {
+                break;
+            }
+            stats.applied++;
+
+            std::string ack;
+            putU64(ack, batch);
+            if (!sendAll(fd, ack)) break;
+        }
+        close(fd);
+        stats.connected = false;
+        if (!promoting) logLine("[replica] lost the leader, reconnecting");
+    }
+    for (auto& entry : files) close(entry.second);
+    files.clear();
+}
+
+std::string followerStats() {
+    char line[256];
+    snprintf(line, sizeof(line),
+             "replica_standby %d\nreplica_connected %d\nreplica_applied %llu\nreplica_applied_bytes %llu\n"
+             "replica_record_lag_ms %.3f\n",
+             (int)is_standby.load(), (int)stats.connected.load(), (unsigned long long)stats.applied.load(),
+             (unsigned long long)stats.applied_bytes.load(), stats.record_lag_ns / 1e6);
+    return line;
+}
+
+/*
+promote(): stops following and starts serving. Every reactor opens its
+own log (new segments, after the copied ones) before clients are let in
+*/
+std::string promote(const std::string&) {
+    if (!is_standby) return "not a standby\n";
+    promoting = true;
+    follower_thread.join();
+
+    auto opened = std::make_shared<std::atomic<size_t>>(0);
+    std::string dir = follower_dir;
+    for (Reactor* r : reactors) {
+        post(r->index, [r, dir, opened]() {
+            r->log.open(dir, r->index);
+            (*opened)++;
+        });
+    }
+    while (*opened < reactors.size()) usleep(1000);
+
+    numbering_epoch = loadEpoch(follower_dir); // the leader's, so clients' marks still hold
+    is_standby = false;
+    logLine("[replica] promoted, serving clients");
+    return "promoted\n";
+}
+
+} // namespace
+
+bool startReplicaServer(int port, const std::string& log_dir) {
+    leader_dir = log_dir;
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int opt = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(port);
+    if (::bind(listen_fd, (sockaddr*)&address, sizeof(address)) < 0 || listen(listen_fd, 16) < 0) {
+        std::cerr << "Replica port bind failed!" << std::endl;
+        return false;
+    }
+    if (!replica_inbox.open()) return false;
+
+    leader = true;
+    addAdminStats(leaderStats);
+    std::cout << "Replicating the history log on port " << port << std::endl;
+    std::thread(runLeader).detach();
+    return true;
+}
+
+bool replicating() {
+    return leader;
+}
+
+void replicateWrite(const std::string& file, uint64_t offset, std::shared_ptr<const std::string> bytes) {
+    uint64_t start = realtimeNs();
+    replica_inbox.post([file, offset, bytes]() { pending.push_back(Piece{file, offset, true, bytes}); });
+    stats.handoff_ns += realtimeNs() - start;
+}
+
+void replicateDelete(const std::string& file) {
+    replica_inbox.post([file]() {
+        Piece gone{file, 0, false, nullptr};
+        gone.deleted = true;
+        pending.push_back(gone);
+    });
+}
+
+bool startFollower(const std::string& leader_address, const std::string& log_dir) {
+    size_t colon = leader_address.rfind(':');
+    if (colon == std::string::npos) return false;
+    leader_host = leader_address.substr(0, colon);
+    leader_port = atoi(leader_address.substr(colon + 1).c_str());
+    if (leader_port <= 0) return false;
+    follower_dir = log_dir;
+
+    is_standby = true;
+    addAdminStats(followerStats);
+    addAdminCommand("promote", "stop following the leader and serve clients", promote);
+    std::cout << "Standby for " << leader_address << " (promote through the admin socket)" << std::endl;
+    follower_thread = std::thread(runFollower);
+    return true;
+}
+
+bool standby() {
+    return is_standby;
+}
@@ -0,0 +1,52 @@
+/*
+Log Replication (warm standby)
+
+A leader (--replica-port) streams its history log to followers. A
+follower (--follow host:port) keeps a byte-for-byte copy of the leader's
+segment files in its own --history-dir and feeds every record into its
+history cache, so once promoted (admin command "promote") it serves with
+history already on disk and in memory. Until then it turns clients away.
+
+The stream mirrors files, not messages: each piece is "these bytes at
+this offset of this segment". Reactors hand the replicator exactly what
+they just wrote (one piece per reactor per loop pass); the replicator
+packs everything pending into one batch, compresses it (zlib) and sends
+it to every follower without waiting for the previous batch's ack.
+
+A follower that connects says how much of each segment it already has,
+and is sent the rest of the leader's files (the catch-up) before live
+pieces. Followers ack every batch they applied, which gives the leader
+its replication lag.
+
+The leader's retention goes along too: a segment it deletes is deleted
+on the followers, and one it deleted while a follower was away is named
+in that follower's catch-up. So does its numbering epoch (the log
+directory's epoch file, sent to every follower that connects), so
+clients' marks stay good on a promoted standby.
+
+Frames, leader -> follower: [u32 compressed size][u32 raw size][u64 batch] zlib data
+  raw data: pieces [u16 name size][name][u64 offset][u8 flags][u32 size][bytes]
+  (flags: 1 = the piece starts on a record boundary, 2 = the segment was deleted, no bytes)
+Follower -> leader: hello [u32 count] count x ([u16 name size][name][u64 size]), then [u64 batch] acks
+*/
+
+#pragma once
+
+#include <string>
+#include <memory>
+
+// startReplicaServer(): leader side, followers connect to port
+bool startReplicaServer(int port, const std::string& log_dir);
+bool replicating();
+
+// replicateWrite(): called by a reactor right after writing bytes at offset of a segment
+void replicateWrite(const std::string& file, uint64_t offset, std::shared_ptr<const std::string> bytes);
+
+// replicateDelete(): called by a reactor right after deleting one of its segments
+void replicateDelete(const std::string& file);
+
+// startFollower(): follower side, mirrors host:port into log_dir until promoted
+bool startFollower(const std::string& leader, const std::string& log_dir);
+
+// standby(): true on a follower that hasn't been promoted (clients are turned away)
+bool standby();
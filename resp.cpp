@@ -0,0 +1,203 @@
+/*
+Redis Pub/Sub Adapter (see resp.h)
+
+Commands arrive as arrays of bulk strings:
+*3\r\n$7\r\nPUBLISH\r\n$4\r\nnews\r\n$2\r\nhi\r\n
+Inline commands (PING\r\n) are accepted too. Commands can be pipelined,
+so everything complete in the buffer is run in one go.
+
+PUBLISH replies 0: delivery happens on other reactors after the reply,
+so the number of receivers isn't known yet. What's published is said as
+the session ("resp-<id>: hi"), like any chat line, so it can't contain
+line breaks: chat clients would read the rest as lines of their own.
+
+One command waiting for the rest of its bytes can hold at most
+max_command of them, like the 64 KB a chat line gets.
+*/
+
+#include <algorithm>
+#include <cctype>
+
+#include "resp.h"
+#include "topics.h"
+
+namespace {
+
+const size_t max_command = 4 << 20; // biggest command accepted, all its arguments together
+const size_t max_args = 1 << 16;
+
+// ------------------- Encoding -------------------
+
+std::string bulk(const std::string& value) {
+    return "$" + std::to_string(value.size()) + "\r\n" + value + "\r\n";
+}
+
+std::string integer(long long value) {
+    return ":" + std::to_string(value) + "\r\n";
+}
+
+Frame frameOf(std::string bytes) {
+    return std::make_shared<const std::string>(std::move(bytes));
+}
+
+void replyRaw(Session& s, std::string bytes) {
+    queueFrame(s, frameOf(std::move(bytes)));
+}
+
+// subscriptionReply(): [kind, name, subscriptions left] like Redis sends for each (un)subscribe
+void subscriptionReply(Session& s, const std::string& kind, const std::string* name) {
+    long long count = s.rooms.size() + s.topics.size();
+    replyRaw(s, "*3\r\n" + bulk(kind) + (name ? bulk(*name) : "$-1\r\n") + integer(count));
+}
+
+// ------------------- Parsing -------------------
+
+// readNumber(): parses the digits after a type byte up to \r\n, -1 = incomplete, -2 = bad
+long long readNumber(const std::string& in, size_t& pos) {
+    size_t end = in.find("\r\n", pos);
+    if (end == std::string::npos) return in.size() - pos > 20 ? -2 : -1;
+    long long value = 0;
+    for (size_t i = pos; i < end; i++) {
+        if (!isdigit((unsigned char)in[i])) return -2;
+        value = value * 10 + (in[i] - '0');
+    }
+    pos = end + 2;
+    return value;
+}
+
+/*
+parseCommand(): reads one command starting at pos.
+Returns 1 with args filled, 0 if more bytes are needed, -1 on a protocol error
+*/
+int parseCommand(const std::string& in, size_t& pos, std::vector<std::string>& args) {
+    args.clear();
+    size_t at = pos;
+
+    if (in[at] != '*') { // inline command: words split by spaces
+        size_t end = in.find('\n', at);
+        if (end == std::string::npos) return in.size() - at > max_command ? -1 : 0;
+        std::string line = in.substr(at, end - at);
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        size_t start = 0;
+        while (start < line.size()) {
+            size_t space = line.find(' ', start);
+            if (space == std::string::npos) space = line.size();
+            if (space > start) args.push_back(line.substr(start, space - start));
+            start = space + 1;
+        }
+        pos = end + 1;
+        return 1;
+    }
+
+    at++;
+    long long count = readNumber(in, at);
+    if (count == -1) return 0;
+    if (count < 0 || (size_t)count > max_args) return -1;
+
+    for (long long i = 0; i < count; i++) {
+        if (at >= in.size()) return 0;
+        if (in[at] != '$') return -1;
+        at++;
+        long long size = readNumber(in, at);
+        if (size == -1) return 0;
+        if (size < 0 || (size_t)size > max_command) return -1;
+        if (in.size() - at < (size_t)size + 2) return 0;
+        args.push_back(in.substr(at, size));
+        at += size + 2;
+    }
+    pos = at;
+    return 1;
+}
+
+// ------------------- Commands -------------------
+
+void runCommand(Reactor& r, Session& s, std::vector<std::string>& args) {
+    std::string command = args[0];
+    std::transform(command.begin(), command.end(), command.begin(), ::toupper);
+
+    if (command == "PING") {
+        replyRaw(s, args.size() > 1 ? bulk(args[1]) : "+PONG\r\n");
+    } else if (command == "SUBSCRIBE" && args.size() > 1) {
+        for (size_t i = 1; i < args.size(); i++) {
+            joinRoom(r, s, args[i]);
+            subscriptionReply(s, "subscribe", &args[i]);
+        }
+    } else if (command == "UNSUBSCRIBE") {
+        std::vector<std::string> rooms(args.begin() + 1, args.end());
+        if (rooms.empty()) rooms.assign(s.rooms.begin(), s.rooms.end()); // no names = all of them
+        if (rooms.empty()) subscriptionReply(s, "unsubscribe", nullptr);
+        for (const std::string& room : rooms) {
+            leaveRoom(r, s, room);
+            subscriptionReply(s, "unsubscribe", &room);
+        }
+    } else if (command == "PSUBSCRIBE" && args.size() > 1) {
+        for (size_t i = 1; i < args.size(); i++) {
+            if (!TopicIndex::validPattern(args[i])) {
+                replyRaw(s, "-ERR invalid pattern (levels split by '.', '*' = one level, '#' = the rest)\r\n");
+                continue;
+            }
+            subscribeTopic(r, s, args[i]);
+            subscriptionReply(s, "psubscribe", &args[i]);
+        }
+    } else if (command == "PUNSUBSCRIBE") {
+        std::vector<std::string> patterns(args.begin() + 1, args.end());
+        if (patterns.empty()) patterns.assign(s.topics.begin(), s.topics.end());
+        if (patterns.empty()) subscriptionReply(s, "punsubscribe", nullptr);
+        for (const std::string& pattern : patterns) {
+            unsubscribeTopic(r, s, pattern);
+            subscriptionReply(s, "punsubscribe", &pattern);
+        }
+    } else if (command == "PUBLISH" && args.size() == 3) {
+        const std::string& channel = args[1];
+        const std::string& payload = args[2];
+        if (channel.find_first_of("\r\n") != std::string::npos || payload.find_first_of("\r\n") != std::string::npos) {
+            replyRaw(s, "-ERR channel and message can't contain line breaks\r\n");
+            return;
+        }
+        sendToRoom(r, s, channel, makeChatMessage(s, channel, payload));
+        if (TopicIndex::validTopic(channel)) {
+            std::string body = s.username + ": " + payload;
+            publishToTopic(r, s, channel, makeMessage(topic_message, channel, "[" + channel + "] " + body, body));
+        }
+        replyRaw(s, integer(0));
+    } else if (command == "CONFIG" || command == "COMMAND") {
+        replyRaw(s, "*0\r\n"); // tools ask on startup, nothing to report
+    } else if (command == "QUIT") {
+        replyRaw(s, "+OK\r\n");
+        s.closing = true;
+    } else {
+        replyRaw(s, "-ERR unknown command '" + args[0] + "' or wrong number of arguments\r\n");
+    }
+}
+
+} // namespace
+
+bool handleResp(Reactor& r, Session& s) {
+    size_t pos = 0;
+    std::vector<std::string> args;
+
+    while (pos < s.inbuf.size()) {
+        int parsed = parseCommand(s.inbuf, pos, args);
+        if (parsed == 0) break;
+        if (parsed < 0) {
+            replyRaw(s, "-ERR Protocol error\r\n");
+            return false;
+        }
+        if (!args.empty()) runCommand(r, s, args);
+    }
+    s.inbuf.erase(0, pos);
+    if (s.inbuf.size() > max_command) { // one command still arriving, and already too big
+        replyRaw(s, "-ERR Protocol error: command too big\r\n");
+        return false;
+    }
+    return true;
+}
+
+Frame encodeRespMessage(const Message& message) {
+    if (message.kind == notice_message) return nullptr; // chat notices mean nothing to Redis clients
+    return frameOf("*3\r\n" + bulk("message") + bulk(message.channel) + bulk(message.payload));
+}
+
+Frame encodeRespPatternMessage(const Message& message, const std::string& pattern) {
+    return frameOf("*4\r\n" + bulk("pmessage") + bulk(pattern) + bulk(message.channel) + bulk(message.payload));
+}
@@ -0,0 +1,26 @@
+/*
+Redis Pub/Sub Adapter (RESP)
+
+Lets Redis clients and tools (redis-cli, redis-benchmark) talk to the
+chat server on the same port. A connection whose first byte is '*' is
+treated as RESP, and its commands map onto what chat clients use:
+- SUBSCRIBE / UNSUBSCRIBE channel  -> join / leave the room
+- PSUBSCRIBE / PUNSUBSCRIBE pattern -> topic subscriptions (topics.h syntax)
+- PUBLISH channel message           -> the room, and topic subscribers
+
+Redis clients share the session table and fan-out with everyone else;
+a message gets its RESP encoding once, shared by all Redis recipients.
+*/
+
+#pragma once
+
+#include "server.h"
+
+// handleResp(): runs every complete command in s.inbuf (false = drop the connection)
+bool handleResp(Reactor& r, Session& s);
+
+// encodeRespMessage(): ["message", channel, payload] (null for notices)
+Frame encodeRespMessage(const Message& message);
+
+// encodeRespPatternMessage(): ["pmessage", pattern, channel, payload]
+Frame encodeRespPatternMessage(const Message& message, const std::string& pattern);
@@ -0,0 +1,70 @@
+/*
+Room Directory (see rooms.h)
+*/
+
+#include <cmath>
+
+#include "rooms.h"
+
+namespace {
+
+const double activity_tau_ms = 5 * 60 * 1000.0;
+const double max_exponent = 600; // e^600 is still far from overflowing a double
+
+} // namespace
+
+void RoomDirectory::apply(const std::string& room, const RoomUpdate& update, uint64_t now_ms) {
+    if (base_ms == 0) base_ms = now_ms;
+    if ((now_ms - base_ms) / activity_tau_ms > max_exponent) rebase(now_ms);
+
+    auto found = rooms.find(room);
+    if (found != rooms.end()) {
+        by_members.erase({-(int64_t)found->second.members, room});
+        by_activity.erase({-found->second.score, room});
+        if (update.members == 0) {
+            rooms.erase(found);
+            return;
+        }
+    } else if (update.members == 0) {
+        return;
+    } else {
+        found = rooms.emplace(room, Entry()).first;
+    }
+
+    Entry& entry = found->second;
+    entry.members = update.members;
+    if (update.messages > 0) entry.score += update.messages * std::exp((now_ms - base_ms) / activity_tau_ms);
+    by_members.insert({-(int64_t)entry.members, room});
+    by_activity.insert({-entry.score, room});
+}
+
+// rebase(): rescales every score to a new base time, the one pass that touches every room
+void RoomDirectory::rebase(uint64_t now_ms) {
+    double scale = std::exp(-((now_ms - base_ms) / activity_tau_ms));
+    base_ms = now_ms;
+    by_activity.clear();
+    for (auto& entry : rooms) {
+        entry.second.score *= scale;
+        by_activity.insert({-entry.second.score, entry.first});
+    }
+}
+
+std::vector<RoomDirectory::Listed> RoomDirectory::page(Ranking ranking, size_t offset, size_t limit,
+                                                       uint64_t now_ms) const {
+    std::vector<Listed> out;
+    double decay = base_ms ? std::exp(-((double)(now_ms > base_ms ? now_ms - base_ms : 0) / activity_tau_ms)) : 0;
+    auto add = [&](const std::string& room) {
+        const Entry& entry = rooms.at(room);
+        out.push_back(Listed{room, entry.members, entry.score * decay});
+    };
+    if (ranking == largest) {
+        for (auto at = by_members.find_by_order(offset); at != by_members.end() && out.size() < limit; ++at) {
+            add(at->second);
+        }
+    } else {
+        for (auto at = by_activity.find_by_order(offset); at != by_activity.end() && out.size() < limit; ++at) {
+            add(at->second);
+        }
+    }
+    return out;
+}
@@ -0,0 +1,74 @@
+/*
+Room Directory
+
+Every room with its member count and how busy it is lately, ranked two
+ways (largest, most active), for /rooms and the admin socket:
+    /rooms [active|largest] [page]
+
+The counts come from the rooms' owners as they change: each owner notes
+joins, leaves and messages in its own pending list (a map lookup), and
+sends the list to the directory's reactor at most every few hundred ms,
+so a busy room costs the directory one update per interval, not one per
+message. Nothing is ever counted by walking rooms or member lists.
+
+Both rankings are order-statistics trees (every node knows its subtree's
+size), so page n is found in O(log rooms) and costs O(page) to read.
+
+Activity is a message count that decays with a time constant of
+activity_tau_ms (about "messages in the last few minutes"). Stored
+scaled by e^(t/tau) at the time of each message, a room's score never
+changes between its own messages, so the ranking only moves when a room
+gets an update; the scale is reset every ~2 days (one pass over all
+rooms) before it overflows.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <ext/pb_ds/assoc_container.hpp>
+#include <ext/pb_ds/tree_policy.hpp>
+
+// RoomUpdate: a room's member count now, and the messages since its last update
+struct RoomUpdate {
+    uint32_t members = 0;   // 0 = the room is gone
+    uint32_t messages = 0;
+};
+
+class RoomDirectory {
+public:
+    enum Ranking { most_active, largest };
+
+    struct Listed {
+        std::string room;
+        uint32_t members;
+        double activity; // decayed message count
+    };
+
+    void apply(const std::string& room, const RoomUpdate& update, uint64_t now_ms);
+
+    // page(): rooms [offset, offset + limit) in that ranking
+    std::vector<Listed> page(Ranking ranking, size_t offset, size_t limit, uint64_t now_ms) const;
+
+    size_t size() const { return rooms.size(); }
+
+private:
+    template <typename Key>
+    using RankedSet = __gnu_pbds::tree<Key, __gnu_pbds::null_type, std::less<Key>, __gnu_pbds::rb_tree_tag,
+                                       __gnu_pbds::tree_order_statistics_node_update>;
+
+    struct Entry {
+        uint32_t members = 0;
+        double score = 0; // sum of e^((t - base_ms) / tau) over its messages
+    };
+
+    std::unordered_map<std::string, Entry> rooms;
+    RankedSet<std::pair<int64_t, std::string>> by_members; // (-members, room)
+    RankedSet<std::pair<double, std::string>> by_activity; // (-score, room)
+    uint64_t base_ms = 0;
+
+    void rebase(uint64_t now_ms);
+};
@@ -2,13 +2,30 @@
 Multi-Client Chat Server
 
 TCP-based chat server with I/O multiplexing by select().
-Checks activity to process the clients through a single thread,
-allowing multiple concurrent clients.
+Each reactor thread runs its own select() loop over its own clients,
+and every reactor listens on the same port (SO_REUSEPORT lets the
+kernel spread new connections between them).
+
+Rooms are owned by exactly one reactor (picked by hashing the name).
+A chat line is handed to the room's owner, which numbers it and then
+passes it on to the reactors holding the members: one handoff per
+destination reactor per batch, no matter how many members live there.
 
 Key Ideas:
 - select() for multi-client handling
 - Event-driven architecture
 - Client state management using STL containers
+- Room ownership so fan-out crosses threads at most once per thread
+- Membership published as read-only snapshots (readers never lock)
+- Huge rooms fanned out in parallel chunks by a worker pool
+- Hot rooms (a spike of traffic) moved to a fan-out thread of their own
+- Topic subscriptions with wildcards, next to rooms (see topics.h)
+- Redis pub/sub clients served from the same sessions (see resp.cpp)
+- Read-only SSE feeds for dashboards, same fan-out again (see sse.cpp)
+- Recent messages of each room kept in memory for joins (see history.h),
+  and on disk as fixed-layout records read in place (see log.h, record.h)
+- Registered accounts, with passwords hashed off the reactors (see accounts.h)
+- Sessions moved between reactors when their load drifts apart (see balance.h)
 */
 
 #include <iostream>
@@ -16,200 +33,1998 @@ Key Ideas:
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <unistd.h>
-#include <vector>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
 #include <algorithm>
-#include <map>
+#include <condition_variable>
+#include <future>
+
+#include "server.h"
+#include "clock.h"
+#include "cluster.h"
+#include "topics.h"
+#include "resp.h"
+#include "sse.h"
+#include "wire.h"
+#include "admin.h"
+#include "commit.h"
+#include "replica.h"
+#include "accounts.h"
+#include "alloc.h"
+#include "profiler.h"
+#include "store.h"
+#include "directory.h"
+#include "rooms.h"
+#include "balance.h"
+
+// Note: the old one-thread-per-client version is kept at the bottom.
+// Reactor threads don't share client state, so the only lock left is
+// the one guarding each reactor's handoff queue (Inbox).
+// Room membership lives on the room's owner; lists handed to fan-out
+// workers are pinned instead of locked (see Room in server.h)
+
+//Global: one reactor per thread, fixed after startup
+std::vector<Reactor*> reactors;
+std::atomic<uint64_t> next_session_id(1);
+std::mutex log_mutex; // keeps lines from different reactors from mixing
+
+const std::string default_room = "lobby";
+
+// Topic subscriptions all live on one reactor, so the index needs no locking
+const int topic_owner = 0;
+TopicIndex topic_index; // only touched on reactors[topic_owner]
+
+// Same for the names of everyone connected (/who, /complete)
+const int user_owner = 0;
+UserDirectory user_directory; // only touched on reactors[user_owner]
+const size_t who_page = 50;
+const size_t complete_limit = 10;
+
+// And the room directory (/rooms), which the owners keep posting their rooms' changes to
+const int directory_owner = 0;
+RoomDirectory room_directory; // only touched on reactors[directory_owner]
+std::atomic<size_t> directory_rooms(0); // its size, for the admin socket
+const uint64_t room_update_ms = 250; // how often an owner sends what changed
+
+// Which numbering room seqs belong to (see wire.h): kept in the log directory, else new every run
+std::atomic<uint64_t> numbering_epoch(0);
+const size_t rooms_page = 20;
+
+/*
+FanoutChunk: one slice of a huge room's member list for a fan-out worker.
+done runs once the last chunk of the message has been handed off.
+A chunk without a list only marks a point in the workers' queues (see afterFanouts)
+*/
+struct FanoutChunk {
+    const MemberList* list;
+    size_t begin;
+    size_t end;
+    MessagePtr message;
+    uint64_t exclude; // sender, skipped
+    std::shared_ptr<std::atomic<int>> remaining;
+    std::function<void()> done;
+};
+
+struct FanoutWorker {
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<FanoutChunk> queue;
+    bool hot = false; // a hot room's own thread, its batches go to the reactors' hot backlog
+};
+
+std::vector<FanoutWorker*> fanout_workers;
+size_t huge_room_size = 5000; // members before a room's fan-out is split across workers
+
+// Hot rooms: a room fanning out more than hot_room_rate deliveries a second gets a worker of its own
+std::mutex hot_mutex; // guards idle_hot_workers (promotions happen on every owner)
+std::vector<FanoutWorker*> idle_hot_workers;
+int hot_room_threads = 2; // 0 turns hot-room promotion off
+uint64_t hot_room_rate = 50000;
+size_t hot_budget = 2000;             // hot deliveries per reactor per loop pass
+size_t hot_backlog_limit = 100000;    // recipients a reactor's hot backlog holds before it delivers early
+const uint64_t heat_window_ms = 1000; // deliveries are counted per window
+const int demote_windows = 5;         // windows below half the rate before a room is demoted
+std::atomic<uint64_t> hot_rooms(0), hot_promotions(0), hot_demotions(0), hot_overflow(0);
 
-// Note: Can use threading/mutex but less ineffective
-// #include <thread>
-// #include <mutex>
-// std::mutex clients_mutex; Dont need, only for threading
+// logLine(): prints one full line to stdout from any reactor
+void logLine(const std::string& line) {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    std::cout << line << std::endl;
+}
+
+// makeFrame(): encodes a line of text for chat clients (newline terminated)
+Frame makeFrame(const std::string& text) {
+    return std::make_shared<const std::string>(text + "\n");
+}
+
+// newMessage(): makeMessage() for callers that fill in more before handing it out
+std::shared_ptr<Message> newMessage(MessageKind kind, const std::string& channel, const std::string& text,
+                                    const std::string& payload) {
+    std::shared_ptr<Message> message = std::make_shared<Message>();
+    message->kind = kind;
+    message->channel = channel;
+    message->text = text;
+    message->payload = payload.empty() ? text : payload;
+    message->time_ns = realtimeNs();
+    return message;
+}
+
+MessagePtr makeMessage(MessageKind kind, const std::string& channel, const std::string& text,
+                       const std::string& payload) {
+    return newMessage(kind, channel, text, payload);
+}
+
+// makeChatMessage(): "username: body" from a session, carrying its id for compact clients
+MessagePtr makeChatMessage(const Session& s, const std::string& room, const std::string& body) {
+    std::shared_ptr<Message> message = newMessage(chat_message, room, s.username + ": " + body, "");
+    message->user_id = s.user_id;
+    message->body_at = s.username.size() + 2;
+    message->rx_ns = s.rx_ns;
+    message->read_ns = s.read_ns;
+    return message;
+}
+
+// Message::frame(): encodes on first use, call_once keeps it to one encoding across reactors
+Frame Message::frame(Protocol protocol) const {
+    std::call_once(encoded_once[protocol], [this, protocol]() {
+        if (protocol == chat_protocol) encoded[protocol] = makeFrame(text);
+        else if (protocol == resp_protocol) encoded[protocol] = encodeRespMessage(*this);
+        else if (protocol == sse_protocol) encoded[protocol] = encodeSseMessage(*this);
+        else if (protocol == binary_protocol) encoded[protocol] = encodeBinaryMessage(*this);
+        else if (protocol == compact_protocol) encoded[protocol] = encodeCompactMessage(*this);
+    });
+    return encoded[protocol];
+}
+
+Frame Message::patternFrame(const std::string& pattern) const {
+    std::lock_guard<std::mutex> lock(pattern_mutex);
+    Frame& frame = by_pattern[pattern];
+    if (!frame) frame = encodeRespPatternMessage(*this, pattern);
+    return frame;
+}
+
+// ownerOf(): reactor that owns (sequences and fans out) the given room
+int ownerOf(const std::string& room) {
+    return std::hash<std::string>{}(room) % reactors.size();
+}
 
-//Global: tracks all connected clients
-std::vector<int> clients; // Stores socket descriptors
-std::map<int, std::string> client_names; // Maps socket descriptor, for the usernames
+bool Inbox::open() {
+    if (pipe(wake_fds) < 0) return false;
+    fcntl(wake_fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(wake_fds[1], F_SETFL, O_NONBLOCK);
+    return true;
+}
 
 /*
-broadcast(): Sends the inputed message to all clients.
+Inbox::post(): queues a task for the thread owning this inbox.
+Only writes to the wake pipe when the inbox was empty (one wakeup
+covers everything queued behind it)
+*/
+void Inbox::post(std::function<void()> task) {
+    bool was_empty;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        was_empty = tasks.empty();
+        tasks.push_back(std::move(task));
+    }
+    if (was_empty) {
+        char wake = 1;
+        (void)write(wake_fds[1], &wake, 1);
+    }
+}
+
+// Inbox::run(): runs every task posted since the last call
+void Inbox::run() {
+    char drain[256];
+    while (read(wake_fds[0], drain, sizeof(drain)) > 0) {}
+
+    std::vector<std::function<void()>> batch;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        batch.swap(tasks);
+    }
+    for (auto& task : batch) task();
+}
+
+// post(): hands a task to another reactor, it runs on that reactor's thread
+void post(int target, std::function<void()> task) {
+    reactors[target]->inbox.post(std::move(task));
+}
+
+// runOn(): runs the task right away if we already are that reactor
+void runOn(Reactor& self, int target, std::function<void()> task) {
+    if (target == self.index) {
+        task();
+    } else {
+        post(target, std::move(task));
+    }
+}
+
+// noteRoom(): on the owner, records a room's member count now (0 = gone) and any new messages
+void noteRoom(Reactor& owner, const std::string& room_name, size_t members, uint32_t messages) {
+    RoomUpdate& update = owner.room_updates[room_name];
+    update.members = members;
+    update.messages += messages;
+}
+
+// flushRoomUpdates(): sends the directory what changed, at most every room_update_ms
+void flushRoomUpdates(Reactor& r) {
+    if (r.room_updates.empty()) return;
+    uint64_t now = monotonicMs();
+    if (now - r.room_updates_sent_ms < room_update_ms) return; // runReactor's select() comes back for them
+    r.room_updates_sent_ms = now;
 
-message - is the string to broadcast
-sender_socket - the socket ID of the sender (allowing for exclusion of message)
+    auto updates = std::make_shared<std::map<std::string, RoomUpdate>>();
+    updates->swap(r.room_updates);
+    runOn(r, directory_owner, [updates, now]() {
+        for (auto& entry : *updates) room_directory.apply(entry.first, entry.second, now);
+        directory_rooms.store(room_directory.size(), std::memory_order_relaxed);
+    });
+}
 
-Loops through the clients sending (send()) the message to each
+/*
+groupMembers(): adds list[begin, end) to per-reactor batches for one message.
+Members are grouped by the reactor holding them so each destination
+gets one Batch per message, however many of its sessions are in the room
 */
-void broadcast(const std::string& message, int sender_socket) {
-    for (int client : clients) {
-        if (client != sender_socket) { // Ensures message isn't repeated to sender
-            send(client, message.c_str(), message.length(), 0);
+void groupMembers(std::vector<std::vector<Batch>>& out, const std::vector<Member>& list, size_t begin, size_t end,
+                  const MessagePtr& message, uint64_t exclude) {
+    // Index of this message's batch per destination (-1 = none yet)
+    std::vector<int> batch_for(out.size(), -1);
+
+    for (size_t i = begin; i < end; i++) {
+        const Member& member = list[i];
+        if (member.session == exclude) continue; // Ensures message isn't repeated to sender
+
+        int& b = batch_for[member.reactor];
+        if (b < 0) {
+            out[member.reactor].push_back(Batch{message, {}});
+            b = out[member.reactor].size() - 1;
+        }
+        out[member.reactor][b].sessions.push_back(member.session);
+    }
+}
+
+void flushOutgoing(Reactor& r);
+void capHot(Reactor& r);
+void finishFanout(Reactor& owner, const std::string& room_name, const MemberList* list);
+void trackHeat(Reactor& owner, const std::string& room_name, Room& room, size_t deliveries);
+void fanOutHot(Reactor& owner, const std::string& room_name, Room& room, const MemberList* list,
+               const MessagePtr& message, uint64_t sender_session);
+
+// fanoutSlot(): the pool worker a member's messages go through in a huge room, the same for the session's life
+size_t fanoutSlot(uint64_t session) {
+    return fanout_workers.empty() ? 0 : session % fanout_workers.size();
+}
+
+// fanoutDone(): what a message's last chunk runs, tells the owner the message (and its list) is handed off
+std::function<void()> fanoutDone(Reactor& owner, const std::string& room_name, const MemberList* list) {
+    int owner_index = owner.index;
+    return [owner_index, room_name, list]() {
+        post(owner_index, [owner_index, room_name, list]() { finishFanout(*reactors[owner_index], room_name, list); });
+    };
+}
+
+void queueChunk(FanoutWorker& worker, FanoutChunk chunk) {
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.queue.push_back(std::move(chunk));
+    }
+    worker.ready.notify_one();
+}
+
+/*
+fanOutParallel(): splits a huge room's fan-out across the worker pool.
+
+Worker c gets the members in slot c (fanoutSlot), which is one range of
+the list. A session's slot never changes, whatever joins or leaves, so
+each recipient is always handled by the same worker, which takes the
+room's messages in order. That keeps every recipient's messages in
+order with several messages of the room in flight at once, while the
+list keeps changing
+*/
+void fanOutParallel(Reactor& owner, const std::string& room_name, Room& room, const MemberList* list,
+                    const MessagePtr& message, uint64_t sender_session) {
+    // Anything grouped earlier on this reactor must be handed off before the chunks
+    flushOutgoing(owner);
+    room.inflight++;
+    room.pinned[list]++;
+
+    size_t chunks = fanout_workers.size();
+    auto remaining = std::make_shared<std::atomic<int>>(chunks);
+    std::function<void()> done = fanoutDone(owner, room_name, list);
+
+    const std::vector<Member>& members = list->members;
+    size_t begin = 0;
+    for (size_t c = 0; c < chunks; c++) {
+        size_t end = std::partition_point(members.begin() + begin, members.end(), [c](const Member& member) {
+            return fanoutSlot(member.session) <= c;
+        }) - members.begin();
+        queueChunk(*fanout_workers[c], FanoutChunk{list, begin, end, message, sender_session, remaining, done});
+        begin = end;
+    }
+}
+
+/*
+afterFanouts(): runs fn once the room's messages already with workers are handed off
+(right away if there are none), on whichever thread gets there last
+*/
+void afterFanouts(Room& room, std::function<void()> fn) {
+    if (room.inflight == 0) {
+        fn();
+        return;
+    }
+    std::vector<FanoutWorker*> workers = room.hot ? std::vector<FanoutWorker*>{room.hot} : fanout_workers;
+    auto remaining = std::make_shared<std::atomic<int>>(workers.size());
+    for (FanoutWorker* worker : workers) queueChunk(*worker, FanoutChunk{nullptr, 0, 0, nullptr, 0, remaining, fn});
+}
+
+const size_t max_numbered = 1 << 20; // rooms a reactor remembers the numbering of (see noteNumbered)
+
+/*
+noteNumbered(): where a room's numbering stopped, for when it opens again (see addMember).
+Past max_numbered rooms, ones that aren't open are forgotten until half are left: the
+log's floor goes above what they had, so one that comes back numbers on from there
+*/
+void noteNumbered(Reactor& owner, const std::string& room_name, uint64_t seq) {
+    if (!owner.numbered.insert_or_assign(room_name, seq).second || owner.numbered.size() <= max_numbered) return;
+    for (auto it = owner.numbered.begin(); it != owner.numbered.end() && owner.numbered.size() > max_numbered / 2;) {
+        if (owner.rooms.count(it->first)) {
+            ++it;
+            continue;
+        }
+        owner.log.raiseFloor(it->second);
+        it = owner.numbered.erase(it);
+    }
+}
+
+/*
+broadcast(): Sends the message to every member of a room.
+Runs on the room's owner.
+
+message - what to send (shared, never copied, encoded once per protocol)
+sender_session - the session ID of the sender (allowing for exclusion of message)
+ack - the sender to acknowledge once the message is on disk (durable rooms only)
+
+Numbers the message, then groups the members by the reactor holding
+them. Nothing is sent here, the groups are handed off in flushOutgoing()
+(or by the fan-out workers, for huge rooms)
+*/
+void broadcast(Reactor& owner, const std::string& room_name, const MessagePtr& message, uint64_t sender_session,
+               Member ack) {
+    PhaseScope phase(owner.watch, phase_broadcast);
+    AllocScope allocs(alloc_broadcast);
+    auto found = owner.rooms.find(room_name);
+    if (found == owner.rooms.end()) return;
+    Room& room = *found->second;
+
+    room.seq++;
+    message->seq = room.seq; // nobody else reads it until the hand-off below
+    message->room_id = room.id;
+    if (message->kind == chat_message) {
+        noteNumbered(owner, room_name, room.seq);
+        owner.history.append(room_name, message);
+        bool logged = owner.log.append(*message, room.seq);
+
+        // Durable room: the sender hears back once the committer has synced this pass
+        if (ack.session != 0) {
+            DurableAck waiting{ack.session, ack.reactor, room_name, room.seq, message->time_ns};
+            if (logged) owner.log.awaitCommit(waiting);
+            else requestCommit(-1, "", {waiting}); // reported back as not saved
+        }
+    }
+
+    const MemberList* list = room.members;
+    if (message->kind == chat_message) noteRoom(owner, room_name, list->members.size(), 1);
+
+    trackHeat(owner, room_name, room, list->members.size());
+    // Grouped here or by the pool: decided only while nothing is in flight, so a message
+    // sent one way never overtakes the room's earlier ones sent the other
+    if (room.inflight == 0) room.parallel = !fanout_workers.empty() && list->members.size() >= huge_room_size;
+    if (room.hot) {
+        fanOutHot(owner, room_name, room, list, message, sender_session);
+        return;
+    }
+    if (room.parallel) {
+        fanOutParallel(owner, room_name, room, list, message, sender_session);
+        return;
+    }
+    groupMembers(owner.outgoing, list->members, 0, list->members.size(), message, sender_session);
+}
+
+// queueFrame(): puts a frame on a local session's outbox (sent by flushSession)
+void queueFrame(Session& s, const Frame& frame) {
+    s.outbox.push_back(frame);
+    s.work++;
+}
+
+/*
+deliverMessage(): queues the session's encoding of a message.
+RESP clients get topic messages as pmessage, naming their pattern
+that matched (if several match, the first one)
+*/
+void deliverMessage(Session& s, const Message& message) {
+    if (message.kind == topic_message && s.protocol == resp_protocol) {
+        for (const std::string& pattern : s.topics) {
+            if (TopicIndex::matches(pattern, message.channel)) {
+                queueFrame(s, message.patternFrame(pattern));
+                return;
+            }
+        }
+        return;
+    }
+
+    Frame frame = message.frame(s.protocol);
+    if (!frame) return;
+    if (s.protocol == compact_protocol) defineIds(s, message); // names it hasn't seen go first
+    queueFrame(s, frame);
+}
+
+// deliverBatch(): queues one batch to its sessions here (now: the time, read once per deliver())
+void deliverBatch(Reactor& r, const Batch& batch, uint64_t& now) {
+    // Timed once per message per reactor: that's when its recipients here have it queued
+    const Message& message = *batch.message;
+    if (message.read_ns && !batch.replay) {
+        if (!now) now = realtimeNs();
+        if (message.rx_ns) r.latency.rx_deliver.record(now > message.rx_ns ? now - message.rx_ns : 0);
+        r.latency.read_deliver.record(now > message.read_ns ? now - message.read_ns : 0);
+    }
+
+    for (uint64_t id : batch.sessions) {
+        auto found = r.sessions.find(id);
+        if (found != r.sessions.end()) {
+            deliverMessage(found->second, message);
+            continue;
+        }
+        // Disconnected in the meantime, or moving to another reactor (then it follows)
+        MessagePtr shared = batch.message;
+        withSession(r, id, [shared](Reactor&, Session& s) { deliverMessage(s, *shared); });
+    }
+}
+
+// deliver(): runs on the destination reactor, queues each batch to its sessions
+void deliver(Reactor& r, const std::vector<Batch>& batches) {
+    PhaseScope phase(r.watch, phase_deliver);
+    AllocScope allocs(alloc_broadcast);
+    uint64_t now = 0; // read once, if anything here is timed
+    for (const Batch& batch : batches) {
+        // A room with deliveries still in the hot backlog (it was hot a moment ago) queues behind them
+        auto waiting = r.hot_pending.find(batch.message->channel);
+        if (waiting != r.hot_pending.end()) {
+            waiting->second++;
+            r.hot_backlog.push_back(batch);
+            r.hot_queued += batch.sessions.size();
+            continue;
+        }
+        deliverBatch(r, batch, now);
+    }
+    capHot(r);
+}
+
+// flushOutgoing(): one handoff per destination reactor for everything fanned out this pass
+void flushOutgoing(Reactor& r) {
+    AllocScope allocs(alloc_broadcast);
+    for (int target = 0; target < (int)r.outgoing.size(); target++) {
+        if (r.outgoing[target].empty()) continue;
+
+        std::vector<Batch> batches;
+        batches.swap(r.outgoing[target]);
+
+        if (target == r.index) {
+            deliver(r, batches);
+        } else {
+            post(target, [target, batches]() { deliver(*reactors[target], batches); });
         }
     }
 }
 
-int main() {
+/*
+flushSession(): writes as much of the outbox as the socket accepts.
+Sockets are non-blocking so a slow client can't stall the whole loop;
+whatever is left gets sent once select() reports it writable.
+Returns false if the connection is broken
+*/
+bool flushSession(Session& s) {
+    while (!s.outbox.empty()) {
+        const std::string& data = *s.outbox.front();
+        ssize_t sent = send(s.fd, data.data() + s.out_offset, data.size() - s.out_offset, MSG_NOSIGNAL);
+        if (sent < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+        s.out_offset += sent;
+        if (s.out_offset == data.size()) {
+            s.outbox.pop_front();
+            s.out_offset = 0;
+        }
+    }
+    return true;
+}
+
+// ------------------- Parallel Fan-out -------------------
+
+void queueHot(Reactor& r, const std::vector<Batch>& batches);
+
+// runFanoutWorker(): groups chunks by destination and hands them straight to those reactors
+void runFanoutWorker(FanoutWorker* worker) {
+    AllocScope allocs(alloc_broadcast); // all this thread does
+    profileThread(worker->hot ? "hot-room" : "fanout");
+    std::vector<std::vector<Batch>> out(reactors.size());
+
+    while (true) {
+        FanoutChunk chunk;
+        {
+            std::unique_lock<std::mutex> lock(worker->mutex);
+            worker->ready.wait(lock, [worker]() { return !worker->queue.empty(); });
+            chunk = std::move(worker->queue.front());
+            worker->queue.pop_front();
+        }
+
+        if (chunk.list) groupMembers(out, chunk.list->members, chunk.begin, chunk.end, chunk.message, chunk.exclude);
+        for (int target = 0; target < (int)out.size(); target++) {
+            if (out[target].empty()) continue;
+            std::vector<Batch> batches;
+            batches.swap(out[target]);
+            if (worker->hot) post(target, [target, batches]() { queueHot(*reactors[target], batches); });
+            else post(target, [target, batches]() { deliver(*reactors[target], batches); });
+        }
+
+        // Last chunk of the message: let the owner know (after all our handoffs above)
+        if (--*chunk.remaining == 0) chunk.done();
+    }
+}
+
+void releaseHot(Reactor& owner, const std::string& room_name, Room& room);
+void promoteRoom(Reactor& owner, const std::string& room_name, Room& room, uint64_t rate);
+void demoteRoom(Reactor& owner, const std::string& room_name);
+
+// finishFanout(): all chunks of one message are handed off, its list can go once no other message needs it
+void finishFanout(Reactor& owner, const std::string& room_name, const MemberList* list) {
+    auto found = owner.rooms.find(room_name);
+    if (found == owner.rooms.end()) return;
+    Room& room = *found->second;
+    auto pin = room.pinned.find(list);
+    if (--pin->second == 0) {
+        room.pinned.erase(pin);
+        if (list != room.members) delete list;
+    }
+    if (--room.inflight > 0) return;
+
+    // Nothing in flight: a switch that had to wait for that happens now, and a room that emptied meanwhile goes
+    if (room.demoting) demoteRoom(owner, room_name);
+    else if (room.promote_rate) promoteRoom(owner, room_name, room, room.promote_rate);
+    if (room.members->members.empty()) {
+        releaseHot(owner, room_name, room);
+        releaseName(room_name);
+        owner.rooms.erase(found);
+    }
+}
+
+// ------------------- Hot Rooms -------------------
+
+/*
+A room that fans out more than hot_room_rate deliveries a second (its
+members times its messages) is promoted: it gets one of the hot-room
+workers to itself, which groups its members and hands the batches to
+the reactors, so the owner only numbers and logs its messages. The
+reactors put a hot room's batches in their hot backlog instead of
+delivering them right away, and deliver at most hot_budget of them
+per loop pass, after the pass's other work: a spike in one room
+delays that room, not every quiet room behind it in the same inbox.
+
+The backlog holds at most hot_backlog_limit recipients per reactor: a
+spike that outgrows it is delivered from the front right away (counted
+in hot_overflow), giving up the budget rather than growing without end.
+
+A room is demoted after cool_windows windows in a row below half the
+rate (or when it empties). Order holds across both moves: neither
+happens while messages of the room are with a worker (it waits for
+finishFanout), promotion hands off what the owner grouped before, and
+a reactor delivers a room's batches behind any of its own still in the
+backlog.
+*/
+
+// releaseHot(): the room is back to fanning out on its owner, its worker is free again
+void releaseHot(Reactor& owner, const std::string& room_name, Room& room) {
+    if (!room.hot) return;
+    {
+        std::lock_guard<std::mutex> lock(hot_mutex);
+        idle_hot_workers.push_back(room.hot);
+    }
+    room.hot = nullptr;
+    room.cool_windows = 0;
+    room.demoting = false;
+    owner.hot_rooms.erase(room_name);
+    hot_rooms--;
+}
+
+void demoteRoom(Reactor& owner, const std::string& room_name) {
+    auto found = owner.rooms.find(room_name);
+    if (found == owner.rooms.end() || !found->second->hot) return;
+    Room& room = *found->second;
+    if (room.inflight > 0) { // the worker still has messages of it queued, once they're out
+        room.demoting = true;
+        return;
+    }
+    releaseHot(owner, room_name, room);
+    hot_demotions++;
+    logLine("[hot] " + room_name + " cooled down, back on reactor " + std::to_string(owner.index));
+}
+
+void promoteRoom(Reactor& owner, const std::string& room_name, Room& room, uint64_t rate) {
+    if (room.inflight > 0) { // chunks still out could land behind the new worker's, once they're out
+        room.promote_rate = rate;
+        return;
+    }
+    room.promote_rate = 0;
+    {
+        std::lock_guard<std::mutex> lock(hot_mutex);
+        if (idle_hot_workers.empty()) return; // every worker has a room, this one waits for the next window
+        room.hot = idle_hot_workers.back();
+        idle_hot_workers.pop_back();
+    }
+    flushOutgoing(owner); // what was grouped here before goes ahead of the worker's first batch
+    room.cool_windows = 0;
+    owner.hot_rooms.insert(room_name);
+    hot_rooms++;
+    hot_promotions++;
+    logLine("[hot] " + room_name + " promoted at " + std::to_string(rate) + " deliveries/s");
+}
+
+// closeWindow(): at the end of a window, promotes or demotes on the rate it saw
+void closeWindow(Reactor& owner, const std::string& room_name, Room& room, uint64_t now) {
+    uint64_t rate = room.heat * 1000 / std::max<uint64_t>(1, now - room.heat_since_ms);
+    room.heat = 0;
+    room.heat_since_ms = now;
+    if (!room.hot) {
+        if (rate >= hot_room_rate) promoteRoom(owner, room_name, room, rate);
+    } else if (rate >= hot_room_rate / 2) {
+        room.cool_windows = 0;
+    } else if (++room.cool_windows >= demote_windows) {
+        demoteRoom(owner, room_name);
+    }
+}
+
+// trackHeat(): counts a message's deliveries, called by broadcast() on the owner
+void trackHeat(Reactor& owner, const std::string& room_name, Room& room, size_t deliveries) {
+    if (hot_room_threads == 0) return;
+    uint64_t now = monotonicMs();
+    if (room.heat_since_ms == 0) room.heat_since_ms = now;
+    room.heat += deliveries;
+    if (now - room.heat_since_ms >= heat_window_ms) closeWindow(owner, room_name, room, now);
+}
+
+// checkHotRooms(): closes the windows of hot rooms that went quiet (they have no messages to do it)
+void checkHotRooms(Reactor& owner) {
+    if (owner.hot_rooms.empty()) return;
+    uint64_t now = monotonicMs();
+    std::vector<std::string> names(owner.hot_rooms.begin(), owner.hot_rooms.end()); // demotions change the set
+    for (const std::string& name : names) {
+        auto found = owner.rooms.find(name);
+        if (found == owner.rooms.end()) continue;
+        Room& room = *found->second;
+        if (room.hot && now - room.heat_since_ms >= heat_window_ms) closeWindow(owner, name, room, now);
+    }
+}
+
+// fanOutHot(): the whole member list to the room's own worker (pinned until it's handed off, as in fanOutParallel)
+void fanOutHot(Reactor& owner, const std::string& room_name, Room& room, const MemberList* list,
+               const MessagePtr& message, uint64_t sender_session) {
+    flushOutgoing(owner); // joiners' history, grouped here, goes ahead
+    room.inflight++;
+    room.pinned[list]++;
+    queueChunk(*room.hot, FanoutChunk{list, 0, list->members.size(), message, sender_session,
+                                      std::make_shared<std::atomic<int>>(1), fanoutDone(owner, room_name, list)});
+}
+
+// queueHot(): on a destination reactor, a hot room's batches wait for drainHot()
+void queueHot(Reactor& r, const std::vector<Batch>& batches) {
+    for (const Batch& batch : batches) {
+        r.hot_pending[batch.message->channel]++;
+        r.hot_backlog.push_back(batch);
+        r.hot_queued += batch.sessions.size();
+    }
+    capHot(r);
+}
+
+// drainHot(): delivers from the hot backlog, oldest first, until `budget` sessions have been served
+void drainHot(Reactor& r, size_t budget) {
+    PhaseScope phase(r.watch, phase_deliver);
+    AllocScope allocs(alloc_broadcast);
+    uint64_t now = 0;
+    size_t served = 0;
+    while (!r.hot_backlog.empty() && served < budget) {
+        Batch batch = std::move(r.hot_backlog.front());
+        r.hot_backlog.pop_front();
+        auto waiting = r.hot_pending.find(batch.message->channel);
+        if (--waiting->second == 0) r.hot_pending.erase(waiting);
+        deliverBatch(r, batch, now);
+        served += batch.sessions.size();
+    }
+    r.hot_queued -= std::min(r.hot_queued, served);
+    r.hot_waiting.store(r.hot_queued, std::memory_order_relaxed);
+}
+
+// capHot(): delivers the oldest of the backlog now if it's over hot_backlog_limit
+void capHot(Reactor& r) {
+    if (r.hot_queued > hot_backlog_limit) {
+        size_t over = r.hot_queued - hot_backlog_limit;
+        hot_overflow += over;
+        drainHot(r, over);
+    }
+    r.hot_waiting.store(r.hot_queued, std::memory_order_relaxed);
+}
+
+std::string hotStats() {
+    size_t waiting = 0;
+    for (Reactor* r : reactors) waiting += r->hot_waiting.load(std::memory_order_relaxed);
+    return "hot_rooms " + std::to_string(hot_rooms.load()) + "\n" +
+           "hot_promotions " + std::to_string(hot_promotions.load()) + "\n" +
+           "hot_demotions " + std::to_string(hot_demotions.load()) + "\n" +
+           "hot_backlog " + std::to_string(waiting) + "\n" +
+           "hot_overflow " + std::to_string(hot_overflow.load()) + "\n";
+}
+
+// ------------------- Room Membership -------------------
+// These run on the owner of the room (reached through runOn/post)
+
+// bySession(): the MemberList order, slot first (see fanoutSlot)
+bool bySession(const Member& member, uint64_t session) {
+    size_t slot = fanoutSlot(member.session), other = fanoutSlot(session);
+    return slot != other ? slot < other : member.session < session;
+}
+
+/*
+editMembers(): the room's list, ready to change.
+Edited in place unless messages with workers were sent to it: then it is
+copied and the copy swapped in, and the pinned one is freed once the last
+of them is handed off (finishFanout). So a join only copies the list while
+a broadcast through the workers is still under way
+*/
+MemberList& editMembers(Room& room) {
+    if (room.pinned.count(room.members)) room.members = new MemberList(*room.members);
+    return *room.members;
+}
+
+/*
+addMember(): runs on the room's owner.
+replay - also send the joiner the room's recent messages (from the history cache),
+         queued ahead of anything said after the join
+after - only those numbered after this (the client has the rest, see /since)
+*/
+void addMember(Reactor& owner, const std::string& room_name, uint64_t session, int home, const std::string& username,
+               bool replay, uint64_t after) {
+    AllocScope allocs(alloc_presence);
+    std::unique_ptr<Room>& room = owner.rooms[room_name];
+    bool created = !room;
+    if (created) {
+        room.reset(new Room());
+        room->id = nameId(room_name);
+    }
+
+    MemberList& list = editMembers(*room);
+    auto at = std::lower_bound(list.members.begin(), list.members.end(), session, bySession);
+    if (at != list.members.end() && at->session == session) {
+        at->reactor = home;
+    } else {
+        list.members.insert(at, Member{session, home});
+    }
+    noteRoom(owner, room_name, list.members.size(), 0);
+
+    // A room that emptied out (or came back after a restart) goes on numbering where it stopped, one
+    // whose records were all deleted above the log's floor, so the marks clients keep stay meaningful
+    auto numbered = owner.numbered.find(room_name);
+    if (created) room->seq = numbered != owner.numbered.end() ? numbered->second : owner.log.floor();
+
+    std::vector<MessagePtr> recent;
+    if (replay && !owner.history.recent(room_name, recent) && owner.log.enabled()) {
+        // Evicted from the cache: read it back from the log, and cache it again (the log knows where
+        // the room's last records are, so this reads those and walks nothing)
+        owner.log.recent(room_name, owner.history.perRoom(), recent);
+        owner.history.fill(room_name, recent);
+    }
+    if (after > room->seq) after = 0; // numbering started over (no history kept), the mark means nothing
+
+    if (replay) {
+        for (const MessagePtr& message : recent) {
+            if (message->seq <= after) continue;
+            if (message->room_id == 0) message->room_id = room->id; // read back from the log, not handed out yet
+            owner.outgoing[home].push_back(Batch{message, {session}, true});
+        }
+    }
+
+    // Silent members (no username, like Redis subscribers) aren't announced
+    if (!username.empty()) {
+        broadcast(owner, room_name, makeMessage(notice_message, room_name, username + " has joined " + room_name), session);
+    }
+}
+
+void removeMember(Reactor& owner, const std::string& room_name, uint64_t session, const std::string& username) {
+    AllocScope allocs(alloc_presence);
+    auto found = owner.rooms.find(room_name);
+    if (found == owner.rooms.end()) return;
+    Room& room = *found->second;
+
+    const std::vector<Member>& current = room.members->members;
+    auto at = std::lower_bound(current.begin(), current.end(), session, bySession);
+    if (at == current.end() || at->session != session) return; // wasn't a member
+    size_t index = at - current.begin();
+    MemberList& list = editMembers(room);
+    list.members.erase(list.members.begin() + index);
+    noteRoom(owner, room_name, list.members.size(), 0);
+
+    if (!username.empty()) {
+        broadcast(owner, room_name, makeMessage(notice_message, room_name, username + " has left " + room_name), session);
+    }
+
+    // Empty rooms are dropped so the map doesn't grow forever (with messages in flight, by finishFanout)
+    if (list.members.empty() && room.inflight == 0) {
+        releaseHot(owner, room_name, room);
+        releaseName(room_name);
+        owner.rooms.erase(found);
+    }
+}
+
+// speaksChat(): chat, binary and compact clients send the same lines (username, messages, /commands)
+bool speaksChat(const Session& s) {
+    return s.protocol == chat_protocol || s.protocol == binary_protocol || s.protocol == compact_protocol;
+}
+
+// joinRoom(): runs on the session's reactor, tells the room owner about it
+void joinRoom(Reactor& r, Session& s, const std::string& room) {
+    AllocScope allocs(alloc_presence);
+    s.room = room;
+    if (!s.rooms.insert(room).second) return; // already a member
+
+    uint64_t id = s.id;
+    int home = r.index;
+    std::string username = speaksChat(s) ? s.username : "";
+    bool replay = s.protocol != resp_protocol; // Redis subscribers only get what's published after
+    uint64_t after = 0;
+    auto mark = s.marks.find(room);
+    if (mark != s.marks.end()) {
+        after = mark->second;
+        s.marks.erase(mark);
+    }
+    runOn(r, ownerOf(room), [=]() { addMember(*reactors[ownerOf(room)], room, id, home, username, replay, after); });
+}
+
+void leaveRoom(Reactor& r, Session& s, const std::string& room) {
+    AllocScope allocs(alloc_presence);
+    if (s.rooms.erase(room) == 0) return;
+
+    uint64_t id = s.id;
+    std::string username = speaksChat(s) ? s.username : "";
+    runOn(r, ownerOf(room), [=]() { removeMember(*reactors[ownerOf(room)], room, id, username); });
+}
+
+// ------------------- Topics -------------------
+
+/*
+publishTopic(): the topic version of broadcast(), runs on topic_owner.
+Subscribers come from the index (cached per topic) and are handed off
+the same way room members are
+*/
+void publishTopic(Reactor& owner, const std::string& topic, const MessagePtr& message, uint64_t sender_session) {
+    const std::vector<Member>& subscribers = topic_index.match(topic);
+    groupMembers(owner.outgoing, subscribers, 0, subscribers.size(), message, sender_session);
+}
+
+void subscribeTopic(Reactor& r, Session& s, const std::string& pattern) {
+    if (!s.topics.insert(pattern).second) return;
+    Member member{s.id, r.index};
+    runOn(r, topic_owner, [=]() { topic_index.subscribe(pattern, member); });
+}
+
+void unsubscribeTopic(Reactor& r, Session& s, const std::string& pattern) {
+    if (s.topics.erase(pattern) == 0) return;
+    uint64_t id = s.id;
+    runOn(r, topic_owner, [=]() { topic_index.unsubscribe(pattern, id); });
+}
+
+// ------------------- Migration -------------------
+
+/*
+Moving sessions between reactors (for the balancer, see balance.h).
+
+Every room owner sends a member's messages to the reactor in its
+Member entry, in order. To move sessions from A to B without losing or
+reordering any of them:
+  1. A stops reading them, and tells B they're coming: from then on, B
+     holds anything for them (deliveries, replies) until they arrive
+  2. each owner of one of their rooms (and the topic owner) points
+     their Member entries at B, hands off everything it had for A, and
+     only then acknowledges to A. So by the last acknowledgement,
+     every message sent to them through A is in their outboxes on A
+  3. A hands the sessions (socket, buffers, outbox) to B, which adds
+     what it held to their outboxes, after what came from A
+A remembers where they went for a while, so late replies follow them
+*/
+
+std::atomic<uint64_t> next_migration(1);
+std::atomic<uint64_t> sessions_migrated(0);
+const uint64_t moved_keep_ms = 10000; // how long a reactor forwards to sessions that left it
+
+void finishMigration(Reactor& r, uint64_t migration);
+
+bool withSession(Reactor& r, uint64_t id, std::function<void(Reactor&, Session&)> fn) {
+    auto found = r.sessions.find(id);
+    if (found != r.sessions.end()) {
+        fn(r, found->second);
+        return true;
+    }
+    auto waiting = r.arriving.find(id);
+    if (waiting != r.arriving.end()) {
+        waiting->second.push_back(std::move(fn));
+        return true;
+    }
+    auto moved = r.moved.find(id);
+    if (moved == r.moved.end()) return false;
+    int to = moved->second.first;
+    post(to, [to, id, fn]() { withSession(*reactors[to], id, fn); });
+    return true;
+}
+
+void postToSession(int home, uint64_t id, std::function<void(Reactor&, Session&)> fn) {
+    post(home, [home, id, fn]() { withSession(*reactors[home], id, fn); });
+}
+
+// migrationAck(): on the sessions' old reactor, one owner has switched them over
+void migrationAck(Reactor& r, uint64_t migration) {
+    auto found = r.leaving.find(migration);
+    if (found != r.leaving.end() && --found->second.acks == 0) finishMigration(r, migration);
+}
+
+// moveMembers(): on a room's owner, points the sessions' entries at reactor `to`
+void moveMembers(Reactor& owner, const std::string& room_name, const std::vector<uint64_t>& ids, int to, int from,
+                 uint64_t migration) {
+    std::function<void()> ack = [from, migration]() {
+        post(from, [from, migration]() { migrationAck(*reactors[from], migration); });
+    };
+    // What was fanned out to the old reactor goes ahead of the ack: grouped here, or still with the workers
+    flushOutgoing(owner);
+    auto found = owner.rooms.find(room_name);
+    if (found != owner.rooms.end()) {
+        Room& room = *found->second;
+        MemberList& list = editMembers(room);
+        for (uint64_t id : ids) {
+            auto at = std::lower_bound(list.members.begin(), list.members.end(), id, bySession);
+            if (at != list.members.end() && at->session == id) at->reactor = to;
+        }
+        afterFanouts(room, ack);
+        return;
+    }
+    ack();
+}
+
+void migrateSessions(Reactor& r, const std::vector<uint64_t>& ids, int to) {
+    if (to == r.index || to < 0 || to >= (int)reactors.size()) return;
+    uint64_t migration = next_migration++;
+    Migration& m = r.leaving[migration];
+    m.to = to;
+
+    std::map<std::string, std::vector<uint64_t>> by_room;
+    std::vector<std::pair<uint64_t, std::set<std::string>>> subscribed;
+    for (uint64_t id : ids) {
+        auto found = r.sessions.find(id);
+        if (found == r.sessions.end()) continue;
+        Session& s = found->second;
+        if (!s.detected || s.authenticating || s.closing || s.migrating) continue;
+        s.migrating = true;
+        m.sessions.push_back(id);
+        for (const std::string& room : s.rooms) by_room[room].push_back(id);
+        if (!s.topics.empty()) subscribed.push_back({id, s.topics});
+    }
+    if (m.sessions.empty()) {
+        r.leaving.erase(migration);
+        return;
+    }
+
+    std::vector<uint64_t> moving = m.sessions;
+    post(to, [to, moving]() {
+        for (uint64_t id : moving) reactors[to]->arriving[id];
+    });
+
+    int from = r.index;
+    m.acks = by_room.size() + (subscribed.empty() ? 0 : 1);
+    for (auto& entry : by_room) {
+        std::string room = entry.first;
+        std::vector<uint64_t> members = entry.second;
+        runOn(r, ownerOf(room), [room, members, to, from, migration]() {
+            moveMembers(*reactors[ownerOf(room)], room, members, to, from, migration);
+        });
+    }
+    if (!subscribed.empty()) {
+        runOn(r, topic_owner, [subscribed, to, from, migration]() {
+            for (auto& entry : subscribed) {
+                for (const std::string& pattern : entry.second) topic_index.subscribe(pattern, Member{entry.first, to});
+            }
+            flushOutgoing(*reactors[topic_owner]);
+            post(from, [from, migration]() { migrationAck(*reactors[from], migration); });
+        });
+    }
+    if (m.acks == 0) finishMigration(r, migration);
+}
+
+// finishMigration(): every owner has switched over, hands the sessions to their new reactor
+void finishMigration(Reactor& r, uint64_t migration) {
+    Migration m = std::move(r.leaving[migration]);
+    r.leaving.erase(migration);
+    drainHot(r, SIZE_MAX); // hot rooms' messages sent here for them go with them too
+
+    uint64_t now = monotonicMs();
+    for (auto it = r.moved.begin(); it != r.moved.end();) {
+        if (now - it->second.second > moved_keep_ms) it = r.moved.erase(it);
+        else ++it;
+    }
+
+    auto moving = std::make_shared<std::vector<Session>>();
+    for (uint64_t id : m.sessions) {
+        auto found = r.sessions.find(id);
+        if (found == r.sessions.end()) continue; // disconnected meanwhile
+        found->second.migrating = false;
+        moving->push_back(std::move(found->second));
+        r.sessions.erase(found);
+        r.moved[id] = {m.to, now};
+    }
+    r.watch.sessions.store(r.sessions.size(), std::memory_order_relaxed);
+
+    int to = m.to;
+    std::vector<uint64_t> ids = m.sessions;
+    post(to, [to, moving, ids]() {
+        Reactor& target = *reactors[to];
+        for (Session& session : *moving) {
+            Session& s = target.sessions[session.id] = std::move(session);
+            for (auto& held : target.arriving[s.id]) held(target, s); // after everything that came with it
+            sessions_migrated++;
+        }
+        for (uint64_t id : ids) target.arriving.erase(id); // including the ones that left
+        target.watch.sessions.store(target.sessions.size(), std::memory_order_relaxed);
+    });
+}
+
+/*
+shedSessions(): picks the sessions to move for about `share` of this reactor's work.
+Busiest first, skipping any too big for what's left (so one heavy
+session doesn't just move the hot spot), idle ones only when share is 1.
+Starts a new count of everyone's work
+*/
+size_t shedSessions(Reactor& r, int to, double share, size_t max_sessions) {
+    std::vector<std::pair<uint64_t, uint64_t>> candidates; // work, session
+    uint64_t total = 0;
+    for (auto& entry : r.sessions) {
+        Session& s = entry.second;
+        total += s.work;
+        if (s.detected && !s.authenticating && !s.closing && !s.migrating) candidates.push_back({s.work, s.id});
+        s.work = 0;
+    }
+    std::sort(candidates.rbegin(), candidates.rend());
+
+    uint64_t left = share >= 1 ? total : (uint64_t)(total * share);
+    std::vector<uint64_t> picked;
+    for (auto& candidate : candidates) {
+        if (picked.size() >= max_sessions) break;
+        if (candidate.first == 0 && share < 1) break;
+        if (candidate.first > left) continue;
+        left -= candidate.first;
+        picked.push_back(candidate.second);
+    }
+    migrateSessions(r, picked, to);
+    return picked.size();
+}
+
+// ------------------- Sending -------------------
+
+// Chat clients never get their own lines back, Redis clients do (like a real broker), and so do
+// binary clients: that's how they learn their messages' seq (client.cpp keeps history by it)
+uint64_t excludedSender(const Session& s) {
+    return s.protocol == chat_protocol ? s.id : 0;
+}
+
+void sendToRoom(Reactor& r, Session& s, const std::string& room, const MessagePtr& message) {
+    uint64_t exclude = excludedSender(s);
+    // Redis clients already got their PUBLISH reply, only chat and binary clients wait for acks
+    Member ack{isDurable(room) && speaksChat(s) ? s.id : 0, r.index};
+    runOn(r, ownerOf(room), [=]() { broadcast(*reactors[ownerOf(room)], room, message, exclude, ack); });
+
+    // Channels ('#' rooms) also go out to the other nodes, through the relay tree
+    if (clusterEnabled() && isChannel(room)) relayToCluster(room, message->text);
+}
+
+void publishToTopic(Reactor& r, Session& s, const std::string& topic, const MessagePtr& message) {
+    uint64_t exclude = excludedSender(s);
+    runOn(r, topic_owner, [=]() { publishTopic(*reactors[topic_owner], topic, message, exclude); });
+}
+
+// ------------------- Client Handling -------------------
+
+// reply(): sends a line back to just this client (binary clients get it as a notice record)
+void reply(Session& s, const std::string& text) {
+    if (s.protocol == chat_protocol) {
+        queueFrame(s, makeFrame(text));
+        return;
+    }
+    Frame frame = makeMessage(notice_message, s.room, text)->frame(s.protocol);
+    if (frame) queueFrame(s, frame);
+}
+
+// enterChat(): the session has its name, it starts out in the lobby
+void enterChat(Reactor& r, Session& s, const std::string& username) {
+    s.username = username;
+    s.user_id = nameId(username);
+    logLine(username + " has joined the chat!");
+    runOn(r, user_owner, [username]() { user_directory.add(username); });
+    if (clusterEnabled()) presenceJoin(username);
+    joinRoom(r, s, default_room);
+}
+
+/*
+startAuth(): /register <name> <password> or /login <name> <password> as the first line.
+The hash runs on the registry's threads; until the result comes back
+the session's input stays in inbuf, then it is handled as usual, or
+dropped if the login failed
+*/
+void startAuth(Reactor& r, Session& s, const std::string& message) {
+    bool create = message[1] == 'r';
+    size_t name_at = create ? 10 : 7;
+    size_t space = message.find(' ', name_at);
+    if (!accountsEnabled()) {
+        reply(s, "No registered users on this server, just send a name");
+        return;
+    }
+    if (space == std::string::npos || space == name_at || space + 1 == message.size()) {
+        reply(s, create ? "Usage: /register <name> <password>" : "Usage: /login <name> <password>");
+        return;
+    }
+    std::string name = message.substr(name_at, space - name_at);
+    uint64_t id = s.id;
+    int home = r.index;
+
+    bool queued = requestAuth(create, name, message.substr(space + 1), home, [id, home, name, create](AuthResult result) {
+        Reactor& r = *reactors[home];
+        auto found = r.sessions.find(id);
+        if (found == r.sessions.end()) return; // left while waiting
+        Session& s = found->second;
+        s.authenticating = false;
+
+        if (result == auth_ok) {
+            reply(s, create ? "Registered " + name : "Logged in as " + name);
+            enterChat(r, s, name);
+        } else if (result == auth_wrong) {
+            reply(s, "Wrong name or password");
+        } else if (result == auth_taken) {
+            reply(s, name + " is already registered");
+        } else {
+            reply(s, "Couldn't save the account, try again");
+        }
+        // Whatever arrived meanwhile (closing flushes the replies first). It was sent for the account
+        // it asked for, so after a failure none of it becomes the name: the client has to log in again
+        s.dropping = result != auth_ok;
+        if (!handleInput(r, s)) s.closing = true;
+        s.dropping = false;
+    });
+    if (queued) s.authenticating = true;
+    else reply(s, "Server busy, try again");
+}
+
+/*
+sinceMark(): /since <seq>[:<epoch>] <room>, the client already has the room's history up to seq,
+so the next join of it only replays what came after. Can come before the username.
+A mark from another numbering epoch (see wire.h) is dropped: the room starts over from 1
+*/
+void sinceMark(Session& s, const std::string& message) {
+    size_t space = message.find(' ', 7);
+    if (space == std::string::npos || space + 1 == message.size()) {
+        reply(s, "Usage: /since <seq>[:<epoch>] <room>");
+        return;
+    }
+    std::string room = message.substr(space + 1);
+    char* end;
+    uint64_t seq = strtoull(message.c_str() + 7, &end, 10);
+    if (*end == ':' && strtoull(end + 1, NULL, 10) != numbering_epoch) {
+        s.marks.erase(room);
+        return;
+    }
+    if (s.marks.size() >= 1024 && !s.marks.count(room)) return; // only kept until the join, nobody needs more
+    s.marks[room] = seq;
+}
+
+/*
+profileCommand(): /profile <text> saves the sender's profile, /whois <name> shows someone's.
+Both go through the store's thread, the answer comes back to this reactor
+*/
+void profileCommand(Reactor& r, Session& s, const std::string& message) {
+    if (!storeEnabled()) {
+        reply(s, "No profiles on this server");
+        return;
+    }
+    bool saving = message[1] == 'p';
+    std::string arg = message.substr(saving ? 9 : 7);
+    if (arg.empty() || arg.size() > 512) {
+        reply(s, saving ? "Usage: /profile <about you, up to 512 bytes>" : "Usage: /whois <name>");
+        return;
+    }
+    uint64_t id = s.id;
+    int home = r.index;
+    auto answer = [id, home](const std::string& text) {
+        // It may have left (or moved to another reactor) meanwhile
+        withSession(*reactors[home], id, [text](Reactor&, Session& s) { reply(s, text); });
+    };
+    if (saving) {
+        storePut("profile/" + s.username, arg, home, [answer](bool ok) {
+            answer(ok ? "Profile saved" : "Couldn't save your profile, try again");
+        });
+    } else {
+        storeGet("profile/" + arg, home, [answer, arg](bool found, const std::string& profile) {
+            answer(found ? arg + ": " + profile : arg + " has no profile");
+        });
+    }
+}
+
+/*
+whoCommand(): /who [prefix] and /more list connected users a page at a time,
+/complete <prefix> gives a few names for an @-mention. The directory
+lives on user_owner; the page comes back here, where the cursor is kept
+*/
+void whoCommand(Reactor& r, Session& s, const std::string& message) {
+    bool complete = message.compare(0, 10, "/complete ") == 0;
+    std::string prefix, after;
+    if (message == "/more") {
+        if (s.who_after.empty()) {
+            reply(s, "Nothing more, /who starts over");
+            return;
+        }
+        prefix = s.who_prefix;
+        after = s.who_after;
+    } else {
+        prefix = message.substr(std::min<size_t>(message.size(), complete ? 10 : 5));
+        if (prefix.size() > 64) {
+            reply(s, "Prefix too long");
+            return;
+        }
+        if (!complete) { // a new listing, /more follows this one now
+            s.who_prefix = prefix;
+            s.who_after.clear();
+        }
+    }
+    size_t limit = complete ? complete_limit : who_page;
+    uint64_t id = s.id;
+    int home = r.index;
+
+    runOn(r, user_owner, [=]() {
+        bool more = false;
+        std::vector<std::string> names = user_directory.page(prefix, after, limit, more);
+        size_t total = user_directory.names();
+
+        postToSession(home, id, [=](Reactor&, Session& s) {
+            std::string list;
+            for (const std::string& name : names) list += (list.empty() ? "" : ", ") + name;
+
+            if (complete) {
+                reply(s, names.empty() ? "No names start with " + prefix : "Matches: " + list);
+                return;
+            }
+            if (s.who_prefix != prefix) return; // a newer /who went out meanwhile
+            s.who_after = more ? names.back() : "";
+            if (names.empty()) {
+                reply(s, prefix.empty() ? "Nobody here" : "No names start with " + prefix);
+                return;
+            }
+            reply(s, "Users (" + std::to_string(total) + " online): " + list);
+            if (more) reply(s, "/more for the next page");
+        });
+    });
+}
+
+// whereCommand(): /where <name>, the nodes of the cluster someone is online on
+void whereCommand(Reactor& r, Session& s, const std::string& message) {
+    std::string name = message.substr(std::min<size_t>(message.size(), 7));
+    if (name.empty()) {
+        reply(s, "Usage: /where <name>");
+        return;
+    }
+    if (!clusterEnabled()) {
+        reply(s, "Not part of a cluster, /who lists who's here");
+        return;
+    }
+    uint64_t id = s.id;
+    int home = r.index;
+    whereOnline(name, home, [id, home, name](const std::vector<std::string>& nodes) {
+        std::string list;
+        for (const std::string& node : nodes) list += (list.empty() ? "" : ", ") + node;
+        std::string text = nodes.empty() ? name + " isn't online" : name + " is online on " + list;
+        withSession(*reactors[home], id, [text](Reactor&, Session& s) { reply(s, text); });
+    });
+}
+
+/*
+roomsListing(): "[active|largest] [page]" -> a page of the directory, one room per line.
+Runs on directory_owner
+*/
+std::string roomsListing(const std::string& args) {
+    bool largest = args.compare(0, 7, "largest") == 0;
+    size_t digits = args.find_first_of("0123456789");
+    size_t page = digits == std::string::npos ? 1 : std::max(1ul, strtoul(args.c_str() + digits, NULL, 10));
+
+    std::vector<RoomDirectory::Listed> listed = room_directory.page(
+        largest ? RoomDirectory::largest : RoomDirectory::most_active, (page - 1) * rooms_page, rooms_page,
+        monotonicMs());
+    size_t pages = (room_directory.size() + rooms_page - 1) / rooms_page;
+    std::string out = std::string("Rooms by ") + (largest ? "size" : "activity") + ", page " + std::to_string(page) +
+                      " of " + std::to_string(std::max<size_t>(pages, 1)) + " (" +
+                      std::to_string(room_directory.size()) + " rooms)\n";
+    for (const RoomDirectory::Listed& room : listed) {
+        char line[64];
+        snprintf(line, sizeof(line), "%.1f", room.activity);
+        out += "  " + room.room + ": " + std::to_string(room.members) + " members, " + line + " recent messages\n";
+    }
+    return out;
+}
+
+// roomsCommand(): /rooms [active|largest] [page], answered by the directory's reactor
+void roomsCommand(Reactor& r, Session& s, const std::string& message) {
+    std::string args = message.size() > 7 ? message.substr(7) : "";
+    uint64_t id = s.id;
+    int home = r.index;
+    runOn(r, directory_owner, [id, home, args]() {
+        std::string listing = roomsListing(args);
+        postToSession(home, id, [listing](Reactor&, Session& s) {
+            size_t start = 0, newline;
+            while ((newline = listing.find('\n', start)) != std::string::npos) {
+                reply(s, listing.substr(start, newline - start));
+                start = newline + 1;
+            }
+        });
+    });
+}
+
+/*
+handleLine(): processes one full line from a client.
+First line is the username, after that lines are chat messages
+or commands (/join <room>, /sub <pattern>, /unsub <pattern>, /pub <topic> <text>, /since <seq>[:<epoch>] <room>,
+/profile <text>, /whois <name>, /who [prefix], /more, /complete <prefix>, /rooms [active|largest] [page],
+/where <name>)
+*/
+void handleLine(Reactor& r, Session& s, std::string message) {
+    // STRIP TRAILING WHITESPACE/NEWLINES so You: doesn't linger
+    message.erase(message.find_last_not_of(" \n\r\t") + 1);
+    if (message.empty() || s.dropping) return;
+
+    if (message.compare(0, 7, "/since ") == 0) {
+        sinceMark(s, message);
+        return;
+    }
+
+    // Checks if this is their first message (or inputing username)
+    if (s.username.empty()) {
+        if (message.compare(0, 7, "/login ") == 0 || message.compare(0, 10, "/register ") == 0) {
+            startAuth(r, s, message);
+        } else if (isRegistered(message)) {
+            reply(s, message + " is registered, use /login <name> <password>");
+        } else {
+            enterChat(r, s, message);
+        }
+        return;
+    }
+
+    // Switching rooms: leaves the current one and joins the new one
+    if (message.compare(0, 6, "/join ") == 0) {
+        std::string room = message.substr(6);
+        if (room.empty() || room == s.room) return;
+        leaveRoom(r, s, s.room);
+        joinRoom(r, s, room);
+        return;
+    }
+
+    // Topic subscriptions: /sub alerts.*.critical, /sub team.#
+    if (message.compare(0, 5, "/sub ") == 0 || message.compare(0, 7, "/unsub ") == 0) {
+        bool sub = message[1] == 's';
+        std::string pattern = message.substr(sub ? 5 : 7);
+        if (!TopicIndex::validPattern(pattern)) {
+            reply(s, "Invalid pattern (levels split by '.', '*' = one level, '#' = the rest)");
+            return;
+        }
+        if (sub) subscribeTopic(r, s, pattern);
+        else unsubscribeTopic(r, s, pattern);
+        return;
+    }
+
+    // Publishing to a topic: /pub alerts.db.critical disk full
+    if (message.compare(0, 5, "/pub ") == 0) {
+        size_t space = message.find(' ', 5);
+        std::string topic = message.substr(5, space == std::string::npos ? std::string::npos : space - 5);
+        if (space == std::string::npos || !TopicIndex::validTopic(topic)) {
+            reply(s, "Usage: /pub <topic> <message>");
+            return;
+        }
+        std::string body = s.username + ": " + message.substr(space + 1);
+        publishToTopic(r, s, topic, makeMessage(topic_message, topic, "[" + topic + "] " + body, body));
+        return;
+    }
+
+    if (message == "/who" || message.compare(0, 5, "/who ") == 0 || message == "/more" ||
+        message.compare(0, 10, "/complete ") == 0) {
+        whoCommand(r, s, message);
+        return;
+    }
+
+    if (message == "/where" || message.compare(0, 7, "/where ") == 0) {
+        whereCommand(r, s, message);
+        return;
+    }
+
+    if (message == "/rooms" || message.compare(0, 7, "/rooms ") == 0) {
+        roomsCommand(r, s, message);
+        return;
+    }
+
+    if (message.compare(0, 9, "/profile ") == 0 || message.compare(0, 7, "/whois ") == 0) {
+        profileCommand(r, s, message);
+        return;
+    }
+
+    // This is for a regular chat
+    logLine(s.username + ": " + message);
+
+    // creates message once, then hands it to the room owner
+    sendToRoom(r, s, s.room, makeChatMessage(s, s.room, message));
+}
+
+// closeSession(): leaves every room, closes the socket and forgets the session
+void closeSession(Reactor& r, uint64_t id) {
+    Session& s = r.sessions[id];
+
+    // Handles if client leaves before inputting username
+    if (s.username.empty()) {
+        logLine("Client (socket " + std::to_string(s.fd) + ") disconnected");
+    } else { // else notifies with username of disconnection
+        logLine(s.username + " disconnected");
+        std::set<std::string> rooms = s.rooms;
+        for (const std::string& room : rooms) leaveRoom(r, s, room);
+        if (speaksChat(s)) { // named in enterChat (Redis and SSE names never are)
+            std::string username = s.username;
+            runOn(r, user_owner, [username]() { user_directory.remove(username); });
+            if (clusterEnabled()) presenceLeave(username);
+        }
+        if (s.user_id != 0) releaseName(s.username);
+    }
+    std::set<std::string> topics = s.topics;
+    for (const std::string& pattern : topics) unsubscribeTopic(r, s, pattern);
+
+    close(s.fd);
+    r.sessions.erase(id);
+    r.watch.sessions.store(r.sessions.size(), std::memory_order_relaxed);
+}
+
+/*
+readSession(): reads what's available and handles every full line in it.
+Returns false when the client disconnected.
+
+recvmsg() rather than read(), for the kernel's receive timestamp of the
+bytes (SO_TIMESTAMPING, software): chat lines in this read are timed
+from it, so time spent in the socket queue while we were busy shows up
+*/
+bool readSession(Reactor& r, Session& s) {
+    AllocScope allocs(alloc_parse); // joins, leaves and messages said here get their own tags
+    char buffer[4096];
+    char control[CMSG_SPACE(sizeof(scm_timestamping))];
+    iovec io = {buffer, sizeof(buffer)};
+    msghdr header;
+    memset(&header, 0, sizeof(header));
+    header.msg_iov = &io;
+    header.msg_iovlen = 1;
+    header.msg_control = control;
+    header.msg_controllen = sizeof(control);
+    ssize_t valread = recvmsg(s.fd, &header, 0);
+
+    if (valread < 0 && (errno == EAGAIN || errno == EINTR)) return true;
+    if (valread <= 0) return false; // if 0 = disctionection, 0 > means error
+
+    s.read_ns = realtimeNs();
+    s.rx_ns = 0;
+    s.work++;
+    for (cmsghdr* c = CMSG_FIRSTHDR(&header); c; c = CMSG_NXTHDR(&header, c)) {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_TIMESTAMPING) continue;
+        scm_timestamping stamps;
+        memcpy(&stamps, CMSG_DATA(c), sizeof(stamps));
+        s.rx_ns = (uint64_t)stamps.ts[0].tv_sec * 1000000000 + stamps.ts[0].tv_nsec;
+    }
+    if (s.rx_ns) r.latency.rx_read.record(s.read_ns > s.rx_ns ? s.read_ns - s.rx_ns : 0);
+
+    s.inbuf.append(buffer, valread);
+
+    // First bytes decide the protocol: Redis clients always start with an array ('*'),
+    // dashboards with an HTTP request ("GET "), binary and compact clients with their magic
+    if (!s.detected) {
+        const std::string get = "GET ";
+        const std::string magic(wire_magic, sizeof(wire_magic));
+        const std::string ids_magic(wire_ids_magic, sizeof(wire_ids_magic));
+        if (s.inbuf.size() < get.size() && get.compare(0, s.inbuf.size(), s.inbuf) == 0) return true; // wait for more
+        if (s.inbuf.size() < magic.size() && magic.compare(0, s.inbuf.size(), s.inbuf) == 0) return true;
+        if (s.inbuf.size() < ids_magic.size() && ids_magic.compare(0, s.inbuf.size(), s.inbuf) == 0) return true;
+        s.detected = true;
+        if (s.inbuf.compare(0, magic.size(), magic) == 0) {
+            s.protocol = binary_protocol;
+            s.inbuf.erase(0, magic.size());
+        } else if (s.inbuf.compare(0, ids_magic.size(), ids_magic) == 0) {
+            s.protocol = compact_protocol;
+            s.inbuf.erase(0, ids_magic.size());
+            queueFrame(s, epochFrame(numbering_epoch)); // before any seq it applies to
+        } else if (s.inbuf[0] == '*') {
+            s.protocol = resp_protocol;
+            s.username = "resp-" + std::to_string(s.id);
+        } else if (s.inbuf.compare(0, get.size(), get) == 0) {
+            s.protocol = sse_protocol;
+            s.username = "sse-" + std::to_string(s.id);
+        }
+    }
+    return handleInput(r, s);
+}
+
+bool handleInput(Reactor& r, Session& s) {
+    if (s.protocol == resp_protocol) return handleResp(r, s);
+    if (s.protocol == sse_protocol) return handleSse(r, s);
+    if (s.protocol == binary_protocol || s.protocol == compact_protocol) return handleBinary(r, s);
+
+    // Lines after a /login wait in inbuf for its result
+    size_t start = 0;
+    size_t newline;
+    while (!s.authenticating && (newline = s.inbuf.find('\n', start)) != std::string::npos) {
+        handleLine(r, s, s.inbuf.substr(start, newline - start));
+        start = newline + 1;
+    }
+    s.inbuf.erase(0, start);
+
+    // A client that never sends a newline can't grow the buffer forever
+    if (s.inbuf.size() > 64 * 1024) {
+        if (s.authenticating) return false;
+        handleLine(r, s, s.inbuf);
+        s.inbuf.clear();
+    }
+    return true;
+}
+
+// ------------------- Reactor Loop -------------------
+
+void acceptClient(Reactor& r) {
+    AllocScope allocs(alloc_accept);
+    sockaddr_in address;
+    socklen_t addrlen = sizeof(address);
+
+    // accepts client through creating new socket for the connection
+    int new_client = accept(r.listen_fd, (sockaddr*)&address, &addrlen);
+    if (new_client < 0) { // catches if not valid client (another reactor may have taken it)
+        return;
+    }
+    fcntl(new_client, F_SETFL, fcntl(new_client, F_GETFL) | O_NONBLOCK);
+
+    // Kernel receive timestamps on every read (see readSession), where the kernel has them
+    int stamping = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    setsockopt(new_client, SOL_SOCKET, SO_TIMESTAMPING, &stamping, sizeof(stamping));
+
+    // Adds the client to the session table for tracking
+    uint64_t id = next_session_id++;
+    Session& s = r.sessions[id];
+    s.id = id;
+    s.fd = new_client;
+    r.watch.sessions.store(r.sessions.size(), std::memory_order_relaxed);
+    logLine("New client connected (socket " + std::to_string(new_client) + ", reactor " + std::to_string(r.index) + ")");
+
+    // A standby only mirrors the leader's log until it's promoted
+    if (standby()) {
+        queueFrame(s, makeFrame("Standby server, not serving yet"));
+        s.read_only = true;
+        s.closing = true;
+    }
+}
+
+void runReactor(Reactor* reactor) {
+    Reactor& r = *reactor;
+    r.watch.thread = pthread_self(); // where the watchdog sends for a stack
+    profileThread("reactor");
+    fd_set read_fds; // set the file descriptors to monitor to read the activity
+    fd_set write_fds; // clients with frames still waiting to be sent
+
+    // Reactor: loops until manually stopped
+    while (true) {
+        // Clear the sets (ensuring a blank slate for looping)
+        FD_ZERO(&read_fds);
+        FD_ZERO(&write_fds);
+
+        // Add listening socket and wake pipe, so it can find new connections and posted work
+        FD_SET(r.listen_fd, &read_fds);
+        FD_SET(r.inbox.wake_fds[0], &read_fds);
+        int max_fd = std::max(r.listen_fd, r.inbox.wake_fds[0]); // used in select, records highest FD number
+
+        // Add all client sockets to set so now the reactor can detect messages sent
+        for (auto& entry : r.sessions) {
+            Session& s = entry.second;
+            if (!s.migrating) FD_SET(s.fd, &read_fds); // a moving session's input waits for its new reactor
+            if (!s.outbox.empty()) FD_SET(s.fd, &write_fds);
+            if (s.fd > max_fd) max_fd = s.fd;
+        }
+
+        // Wait for activity on ANY socket (or until room changes held back are due, see flushRoomUpdates,
+        // or hot rooms' windows close), not at all while hot deliveries are waiting
+        timeval due = {0, (suseconds_t)(r.hot_backlog.empty() ? room_update_ms * 1000 : 0)};
+        bool timed = !r.room_updates.empty() || !r.hot_rooms.empty() || !r.hot_backlog.empty();
+        int activity = select(max_fd + 1, &read_fds, &write_fds, NULL, timed ? &due : NULL);
+        if (activity < 0) { // Calls error if nothing is selected
+            if (errno != EINTR) std::cerr << "Select error" << std::endl;
+            continue; // Attempts call again
+        }
+        r.watch.tick(); // busy from here to the end of the pass
+        uint64_t pass_start = monotonicNs();
+
+        // Work handed over by other reactors (joins, messages to fan out, deliveries)
+        r.watch.set(phase_inbox);
+        if (FD_ISSET(r.inbox.wake_fds[0], &read_fds)) r.inbox.run();
+
+        // Checks if listening socket has activity (NEW CONNECTION)
+        r.watch.set(phase_accept);
+        if (FD_ISSET(r.listen_fd, &read_fds)) acceptClient(r);
+
+        // Check all clients for activity
+        r.watch.set(phase_read);
+        std::vector<uint64_t> disconnected;
+        for (auto& entry : r.sessions) {
+            Session& s = entry.second;
+            if (s.fd < 0 || !FD_ISSET(s.fd, &read_fds)) continue;
+            r.watch.session.store(s.id, std::memory_order_relaxed);
+            if (!readSession(r, s)) disconnected.push_back(s.id);
+        }
+        r.watch.session.store(0, std::memory_order_relaxed);
+        for (uint64_t id : disconnected) closeSession(r, id);
+
+        // Hot rooms' share of the pass, after everything else that came in
+        if (!r.hot_backlog.empty()) drainHot(r, hot_budget);
+        checkHotRooms(r);
+
+        // Hand off everything fanned out this pass, then write what's queued locally
+        r.watch.set(phase_handoff);
+        flushOutgoing(r);
+
+        r.watch.set(phase_write);
+        disconnected.clear();
+        for (auto& entry : r.sessions) {
+            Session& s = entry.second;
+            if (s.outbox.empty() && !s.closing) continue;
+            r.watch.session.store(s.id, std::memory_order_relaxed);
+            if (!flushSession(s) || (s.closing && s.outbox.empty())) disconnected.push_back(entry.first);
+        }
+        r.watch.session.store(0, std::memory_order_relaxed);
+        for (uint64_t id : disconnected) closeSession(r, id);
+
+        // Leave messages from those disconnects still need handing off
+        r.watch.set(phase_handoff);
+        flushOutgoing(r);
+
+        // One write for everything this pass added to the history log
+        r.watch.set(phase_log);
+        r.log.flush();
+
+        // Room changes for the directory, every room_update_ms at most
+        r.watch.set(phase_handoff);
+        flushRoomUpdates(r);
+
+        r.watch.set(phase_idle);
+        r.busy_ns.store(r.busy_ns.load(std::memory_order_relaxed) + monotonicNs() - pass_start,
+                        std::memory_order_relaxed);
+        r.watch.tick();
+    }
+}
+
 // ------------------- Socket Setup -------------------
-    // Create socket
+
+/*
+openListener(): creates a listening socket for one reactor.
+Every reactor binds the same port, SO_REUSEPORT spreads new
+connections between them
+*/
+int openListener(int port) {
     // uses AF_INET/IPv4 and SOCK_STREAM/TCP (stream oriented connection) for reliability
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0); 
+    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (server_fd == -1) { // if returned -1 the stops and fails creation
         std::cerr << "Socket creation failed!" << std::endl;
-        return 1;
+        return -1;
     }
 
-    // Allows for resuse of address/port (saves time for quick restarts)
+    // Allows for resuse of address/port (saves time for quick restarts, and shares it between reactors)
     int opt = 1;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+        setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
         std::cerr << "setsockopt failed!" << std::endl;
-        return 1;
+        return -1;
     }
-    
+
     // Configure server address
     sockaddr_in address;
+    memset(&address, 0, sizeof(address));
     address.sin_family = AF_INET; // IPv4
     address.sin_addr.s_addr = INADDR_ANY; // Accept connections on any local network
-    address.sin_port = htons(8080); // hosts on port 8080 using htons (Host To Network Short)
-    
+    address.sin_port = htons(port); // using htons (Host To Network Short)
+
     // Bind socket to port (using :: to specify global namespace)
     if (::bind(server_fd, (sockaddr*)&address, sizeof(address)) < 0) {
         std::cerr << "Bind failed!" << std::endl;
-        return 1;
+        return -1;
     }
-    
+
     // Listen for connections that are incoming
-    // Second parameter catches if max queued connections
-    if (listen(server_fd, 3) < 0) {
+    if (listen(server_fd, SOMAXCONN) < 0) {
         std::cerr << "Listen failed!" << std::endl;
-        return 1;
+        return -1;
     }
-    
-    std::cout << "Server listening on port 8080..." << std::endl;
-    
-    
 
-// ------------------- SELECT() LOOP -------------------
+    // Non-blocking: all reactors wake on a new connection, only one gets it
+    fcntl(server_fd, F_SETFL, fcntl(server_fd, F_GETFL) | O_NONBLOCK);
+    return server_fd;
+}
 
-    fd_set read_fds; // set the file descriptors to monitor to read the activity
+// historyStats(): the history cache metrics, summed over every reactor's share
+std::string historyStats() {
+    uint64_t hits = 0, misses = 0, evictions = 0, bytes = 0, rooms = 0;
+    uint64_t appended = 0, written = 0, disk_reads = 0;
+    for (Reactor* r : reactors) {
+        const HistoryCache::Stats& stats = r->history.stats();
+        hits += stats.hits;
+        misses += stats.misses;
+        evictions += stats.evictions;
+        bytes += stats.bytes;
+        rooms += stats.rooms;
 
-    // Server: loops until manually stopped
-    while (true) { // Accepts and handles clients through select
-        
-        // Clear the set (ensuring a blank slate for looping)
-        FD_ZERO(&read_fds);
+        const MessageLog::Stats& log = r->log.stats();
+        appended += log.appended;
+        written += log.bytes_written;
+        disk_reads += log.reads;
+    }
+    char hit_rate[32];
+    snprintf(hit_rate, sizeof(hit_rate), "%.3f", hits + misses ? (double)hits / (hits + misses) : 0.0);
 
-        // Add server socket to set, making it so it can find new connections
-        FD_SET(server_fd, &read_fds);
-        int max_fd = server_fd; // used in select, records highest FD number
+    return "history_hits " + std::to_string(hits) + "\n" +
+           "history_misses " + std::to_string(misses) + "\n" +
+           "history_hit_rate " + hit_rate + "\n" +
+           "history_evictions " + std::to_string(evictions) + "\n" +
+           "history_bytes " + std::to_string(bytes) + "\n" +
+           "history_rooms " + std::to_string(rooms) + "\n" +
+           "history_log_records " + std::to_string(appended) + "\n" +
+           "history_log_bytes " + std::to_string(written) + "\n" +
+           "history_log_reads " + std::to_string(disk_reads) + "\n";
+}
 
-        // Add all client sockets to set so now server can detect messages sent
-        for (int client : clients) {
-            FD_SET(client, &read_fds); // sets each client
-            // if the client is above the max, set new max
-            if (client > max_fd) max_fd = client;
-        }
+// sumLatency(): the ingress histograms, summed over every reactor
+void sumLatency(IngressLatency& total) {
+    for (Reactor* r : reactors) {
+        total.rx_read.add(r->latency.rx_read);
+        total.rx_deliver.add(r->latency.rx_deliver);
+        total.read_deliver.add(r->latency.read_deliver);
+    }
+}
 
-        // Wait for activity on ANY socket
-        // block until activity in one
-        // To then select()
-        // Returning number of sockets currently with activity
-        // Parameters:
-        // max_fd, read set, write set, exception set, timeout
-        int activity = select(max_fd + 1, &read_fds, NULL, NULL, NULL);
+std::string latencyStats() {
+    IngressLatency total;
+    sumLatency(total);
+    return total.rx_read.stats("latency_rx_read") + total.rx_deliver.stats("latency_rx_deliver") +
+           total.read_deliver.stats("latency_read_deliver");
+}
 
-        if (activity < 0) { // Calls error if nothing is selected
-            std::cerr << "Select error" << std::endl;
-            continue; // Attempts call again
-        }
+/*
+loadEpoch(): the numbering epoch kept in the log directory (made the first time).
+Rooms go on numbering from the log there, so a client's marks stay good across restarts
+*/
+uint64_t loadEpoch(const std::string& dir) {
+    std::string path = dir + "/epoch";
+    FILE* file = fopen(path.c_str(), "r");
+    unsigned long long epoch = 0;
+    if (file) {
+        if (fscanf(file, "%llu", &epoch) != 1) epoch = 0;
+        fclose(file);
+    }
+    if (epoch != 0) return epoch;
 
-        // Checks if server socket has activity (NEW CONNECTION)
-        
-        // FD_ISSET is used to check for activity
-        if (FD_ISSET(server_fd, &read_fds)) {
-            int addrlen = sizeof(address);
-            
-            // accepts client through creating new socket for the connection
-            int new_client = accept(server_fd, (sockaddr*)&address, (socklen_t*)&addrlen);
+    epoch = realtimeNs();
+    file = fopen(path.c_str(), "w");
+    if (file) {
+        fprintf(file, "%llu\n", epoch);
+        fclose(file);
+    }
+    return epoch;
+}
 
-            if (new_client < 0) { // catches if not valid client
-                std::cerr << "Accept failed!" << std::endl;
-                continue;
-            }
+int main(int argc, char* argv[]) {
+    int port = 8080;
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+
+    int workers = threads;
+    size_t history_messages = 50;
+    size_t history_mb = 64;
+    std::string history_dir;
+    bool verify_log = false;
+    int commit_us = 500;
+    int replica_port = 0;
+    std::string follow;
+    std::string admin_path;
+    std::string users_path;
+    int auth_workers = 2;
+    int auth_queue = 1024;
+    int stall_ms = 250;
+    bool alloc_profile = false;
+    int profile_hz = 99;
+    int balance_ms = 1000;
+    int balance_tolerance = 20;
+    std::string store_dir;
+    size_t store_memtable_mb = 8;
+    ClusterConfig cluster;
 
-            // Adds the client to vector for tracking
-            clients.push_back(new_client);
-            std::cout << "New client connected (socket " << new_client << ")" << std::endl;
+    // Options: --port <n>, --threads <n>, --fanout-workers <n>, --huge-room <members>, --sse-rooms <a,b,...>
+    // Balancing: --balance-ms <how often reactor load is compared, 0 = off>,
+    //            --balance-tolerance <busy % points between reactors before sessions move>
+    // Hot rooms: --hot-room-threads <dedicated fan-out threads, 0 = off>, --hot-room-rate <deliveries/s to promote>,
+    //            --hot-budget <hot deliveries per reactor pass>, --hot-backlog <recipients waiting per reactor>
+    // History: --history <messages per room> (0 = off), --history-mb <total budget>, --history-dir <log dir>,
+    //          --recovery <fast|full> (full also CRC-checks sealed segments)
+    // Durability: --durable-rooms <a,b,...> (needs --history-dir), --commit-us <commit window>
+    // Replication: --replica-port <n> (leader), --follow <host:port> (warm standby); both need --history-dir
+    // Accounts: --users <file>, --auth-workers <hashing threads>, --auth-queue <logins waiting before "busy">
+    // Store: --store-dir <dir> (profiles and other small state), --store-memtable-mb <before it's written out>
+    // Admin: --admin <socket path>, --stall-ms <pass length the watchdog reports, 0 = off>,
+    //        --alloc-profile <on|off> (count allocations by code path from the start),
+    //        --profile-hz <CPU samples per second of each thread's CPU time, 0 = off>
+    // Cluster: --node-id <id>, --zone <zone>, --peer-port <n>, --peers <id@host:port[/zone],...>, --relay-fanout <k>,
+    //          --gossip-ms <how often presence changes go to the other nodes>
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string flag = argv[i];
+        if (flag == "--port") port = atoi(argv[i + 1]);
+        else if (flag == "--threads") threads = std::max(1, atoi(argv[i + 1]));
+        else if (flag == "--fanout-workers") workers = std::max(0, atoi(argv[i + 1]));
+        else if (flag == "--huge-room") huge_room_size = std::max(1, atoi(argv[i + 1]));
+        else if (flag == "--hot-room-threads") hot_room_threads = std::max(0, atoi(argv[i + 1]));
+        else if (flag == "--hot-room-rate") hot_room_rate = std::max(1, atoi(argv[i + 1]));
+        else if (flag == "--hot-budget") hot_budget = std::max(1, atoi(argv[i + 1]));
+        else if (flag == "--hot-backlog") hot_backlog_limit = std::max(1, atoi(argv[i + 1]));
+        else if (flag == "--sse-rooms") allowSseRooms(argv[i + 1]);
+        else if (flag == "--history") history_messages = std::max(0, atoi(argv[i + 1]));
+        else if (flag == "--history-mb") history_mb = std::max(0, atoi(argv[i + 1]));
+        else if (flag == "--history-dir") history_dir = argv[i + 1];
+        else if (flag == "--recovery") verify_log = std::string(argv[i + 1]) == "full";
+        else if (flag == "--durable-rooms") durableRooms(argv[i + 1]);
+        else if (flag == "--commit-us") commit_us = std::max(0, atoi(argv[i + 1]));
+        else if (flag == "--replica-port") replica_port = atoi(argv[i + 1]);
+        else if (flag == "--follow") follow = argv[i + 1];
+        else if (flag == "--admin") admin_path = argv[i + 1];
+        else if (flag == "--alloc-profile") alloc_profile = std::string(argv[i + 1]) == "on";
+        else if (flag == "--profile-hz") profile_hz = std::max(0, atoi(argv[i + 1]));
+        else if (flag == "--balance-ms") balance_ms = std::max(0, atoi(argv[i + 1]));
+        else if (flag == "--balance-tolerance") balance_tolerance = std::max(1, atoi(argv[i + 1]));
+        else if (flag == "--stall-ms") stall_ms = std::max(0, atoi(argv[i + 1]));
+        else if (flag == "--store-dir") store_dir = argv[i + 1];
+        else if (flag == "--store-memtable-mb") store_memtable_mb = std::max(1, atoi(argv[i + 1]));
+        else if (flag == "--users") users_path = argv[i + 1];
+        else if (flag == "--auth-workers") auth_workers = std::max(1, atoi(argv[i + 1]));
+        else if (flag == "--auth-queue") auth_queue = std::max(1, atoi(argv[i + 1]));
+        else if (flag == "--node-id") cluster.node_id = argv[i + 1];
+        else if (flag == "--zone") cluster.zone = argv[i + 1];
+        else if (flag == "--peer-port") cluster.peer_port = atoi(argv[i + 1]);
+        else if (flag == "--relay-fanout") cluster.fanout = std::max(1, atoi(argv[i + 1]));
+        else if (flag == "--gossip-ms") cluster.gossip_ms = std::max(10, atoi(argv[i + 1]));
+        else if (flag == "--peers") {
+            if (!parsePeers(argv[i + 1], cluster.peers)) {
+                std::cerr << "Bad --peers list (expected id@host:port[/zone],...)" << std::endl;
+                return 1;
+            }
+        }
+        else {
+            std::cerr << "Unknown option " << flag << std::endl;
+            return 1;
         }
+    }
 
-        // Check all clients for activity
+    if ((anyDurable() || replica_port > 0 || !follow.empty()) && history_dir.empty()) {
+        std::cerr << "--durable-rooms, --replica-port and --follow need --history-dir" << std::endl;
+        return 1;
+    }
 
-        // More dynamic for iterating by index if deletion/disconnection occurs
-        for (int i = 0; i < clients.size(); i++) {
-            int client = clients[i];
-
-            // Checks for if data is ready
-            if (FD_ISSET(client, &read_fds)) {
-
-                // Reads data from given client
-                char buffer[1024];
-                memset(buffer, 0, sizeof(buffer));
-                int valread = read(client, buffer, 1024);
-
-                // Checks for disconnection
-                if (valread <= 0) { // if 0 = disctionection, 0 > means error
-                    // Client disconnected
-                    std::string leaving_user = client_names[client];
-
-                    // Handles if client leaves before inputting username
-                    if(leaving_user.empty()) {
-                        std::cout << "Client (socket " << client << ")" << std::endl;
-                    } else { // else notifies with username of disconnection
-                        std::cout << leaving_user << " disconnected" << std::endl;
-                        std::string leaving_msg = leaving_user + " has left the chat";
-                        broadcast(leaving_msg, -1); // Broadcasts the message to all users
-                        // -1 causes it to be sent to everyone
-                    }
-
-                    // Ensures closing the client and erasing from tracking
-                    close(client);
-                    clients.erase(clients.begin() + i); // i makes it change accordingly
-                    client_names.erase(client);
-                    i--; // change index after erasing
-
-                
-                } else { // For Incoming Messages
-                    
-                    // Client SENT Data
-                    std::string message(buffer);
-
-                    // STRIP TRAILING WHITESPACE/NEWLINES so You: doesn't linger
-                    message.erase(message.find_last_not_of(" \n\r\t") + 1);
-
-                    // Checks if this is their first message (or inputing username)
-                    // if find() returns the end() it means non-existant in username map
-                    if (client_names.find(client) == client_names.end()) {
-                        
-                        // This is the username, stores it in map
-                        client_names[client] = message;
-                        std::cout << message << " has joined the chat!" << std::endl;
-
-                        // broadcasts new user joining to chat
-                        std::string join_msg = message + " has joined the chat!";
-                        broadcast(join_msg, client);
-                    } else {
-                        // This is for a regular chat
-                        std::string username = client_names[client]; // finds username
-                        std::cout << username << ": " << message << std::endl;
-
-                        // creates message to send to other clients
-                        std::string full_msg = username + ": " + message;
-                        broadcast(full_msg, client);
-                    }
-                }
-            }
+    signal(SIGPIPE, SIG_IGN); // broken connections show up as send() errors instead
+
+    for (int i = 0; i < threads; i++) {
+        Reactor* r = new Reactor();
+        r->index = i;
+        r->listen_fd = openListener(port);
+        if (r->listen_fd < 0) return 1;
+        if (!r->inbox.open()) {
+            std::cerr << "Pipe failed!" << std::endl;
+            return 1;
         }
+        reactors.push_back(r);
     }
-    
-    // Never used but allows for better closing of server
-    close(server_fd); 
-    return 0; 
+    for (Reactor* r : reactors) {
+        r->outgoing.resize(reactors.size());
+        r->history.configure((history_mb << 20) / reactors.size(), history_messages); // each caches the rooms it owns
+    }
+
+    // History log: cut torn tails, warm every owner's cache (and where each room's numbering stopped)
+    // from what's on disk, then start new segments. Without it rooms number from 1 again, a new epoch
+    numbering_epoch = realtimeNs();
+    if (!history_dir.empty()) {
+        mkdir(history_dir.c_str(), 0755);
+        recoverLogs(history_dir, follow.empty(), verify_log);
+        numbering_epoch = loadEpoch(history_dir);
+        auto warm = [](const std::string& room, const std::vector<MessagePtr>& messages) {
+            Reactor& owner = *reactors[ownerOf(room)];
+            owner.history.fill(room, messages);
+            uint64_t last = 0;
+            for (const MessagePtr& message : messages) last = std::max(last, message->seq);
+            noteNumbered(owner, room, last);
+        };
+        // Numbering is needed without a cache too
+        uint64_t floor = loadHistory(history_dir, std::max<size_t>(1, history_messages), warm);
+        // A standby leaves its log to the leader's stream, and opens its own when promoted
+        for (Reactor* r : reactors) {
+            r->log.raiseFloor(floor);
+            if (follow.empty() && !r->log.open(history_dir, r->index)) return 1;
+        }
+    }
+    if (replica_port > 0 && !startReplicaServer(replica_port, history_dir)) return 1;
+    if (!follow.empty() && !startFollower(follow, history_dir)) {
+        std::cerr << "Bad --follow address (expected host:port)" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Server listening on port " << port << " with " << threads << " reactor thread(s)..." << std::endl;
+
+    startProfiler(profile_hz); // before any thread it samples starts
+
+    // Workers for huge rooms (0 turns parallel fan-out off)
+    for (int i = 0; i < workers; i++) fanout_workers.push_back(new FanoutWorker());
+    for (FanoutWorker* w : fanout_workers) w->thread = std::thread(runFanoutWorker, w);
+
+    // One per room promoted at a time (see Hot Rooms)
+    for (int i = 0; i < hot_room_threads; i++) {
+        FanoutWorker* w = new FanoutWorker();
+        w->hot = true;
+        idle_hot_workers.push_back(w);
+        w->thread = std::thread(runFanoutWorker, w);
+    }
+
+    if (cluster.peer_port > 0 && !startCluster(cluster)) return 1;
+    if (!users_path.empty() && !openAccounts(users_path, auth_workers, auth_queue)) return 1;
+    if (!store_dir.empty() && !openStore(store_dir, store_memtable_mb << 20)) return 1;
+
+    addAdminStats(historyStats);
+    addAdminStats(latencyStats);
+    addAdminCommand("latency", "ingress latency histograms (from kernel receive)", [](const std::string&) {
+        IngressLatency total;
+        sumLatency(total);
+        return total.rx_read.chart("rx_read") + total.rx_deliver.chart("rx_deliver") +
+               total.read_deliver.chart("read_deliver");
+    });
+    addAdminStats([]() { return "rooms_listed " + std::to_string(directory_rooms.load()) + "\n"; });
+    addAdminStats([]() { return "sessions_migrated " + std::to_string(sessions_migrated.load()) + "\n"; });
+    addAdminStats(hotStats);
+    addAdminCommand("rooms", "the room directory (rooms [active|largest] [page])", [](const std::string& args) {
+        // Asked of the directory's reactor, like a client's /rooms
+        auto answer = std::make_shared<std::promise<std::string>>();
+        std::future<std::string> listing = answer->get_future();
+        post(directory_owner, [answer, args]() { answer->set_value(roomsListing(args)); });
+        if (listing.wait_for(std::chrono::seconds(2)) != std::future_status::ready) {
+            return std::string("The directory's reactor didn't answer (see stalls)\n");
+        }
+        return listing.get();
+    });
+    if (anyDurable()) startCommitter(commit_us);
+    startWatchdog(stall_ms);
+    startBalancer(balance_ms, balance_tolerance);
+    startAllocProfiling(alloc_profile);
+    if (!admin_path.empty() && !startAdmin(admin_path)) return 1;
+
+    for (Reactor* r : reactors) r->thread = std::thread(runReactor, r);
+
+    // Never returns in practice (reactors loop until manually stopped)
+    for (Reactor* r : reactors) r->thread.join();
+    return 0;
 }
 
 /*
@@ -220,6 +2035,9 @@ Although scalability isn't as efficient,
 Difference:
 - Thead(): Bigger load as each client has its own thread
 - Select(): selects the given active block, all exist in one main thread
+
+The reactors above mix the two: a few threads, each running select()
+over many clients, instead of one thread per client.
 */
 
 // For Threading Structure
@@ -300,4 +2118,4 @@ Difference:
     //     std::thread(handleClient, client_socket).detach();
 
     //     // Loop resets to accept - waits for next client
-    // }
\ No newline at end of file
+    // }
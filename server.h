@@ -0,0 +1,303 @@
+/*
+Shared server state
+
+Types and helpers used by every part of the server: sessions, rooms,
+reactors and the handoff between threads. The select() loops and the
+chat protocol live in server.cpp, other subsystems in their own files.
+*/
+
+#pragma once
+
+#include <vector>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <deque>
+#include <string>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+#include "history.h"
+#include "log.h"
+#include "latency.h"
+#include "watchdog.h"
+#include "rooms.h"
+
+// Frame: bytes ready for the wire, shared by reference with every
+// reactor and client that sends them (fan-out never copies the text)
+typedef std::shared_ptr<const std::string> Frame;
+
+// Protocol: how a client talks to us, picked from its first bytes
+enum Protocol {
+    chat_protocol,    // newline-terminated text lines (netcat)
+    resp_protocol,    // Redis pub/sub (see resp.cpp)
+    sse_protocol,     // read-only HTTP event stream (see sse.cpp)
+    binary_protocol,  // records both ways (see wire.h)
+    compact_protocol, // records in, names as ids out (see wire.h, client.cpp)
+    protocol_count
+};
+
+enum MessageKind {
+    chat_message,   // a line someone sent to a room
+    notice_message, // joins and leaves (chat clients only)
+    topic_message,  // a publish to a topic (see topics.h)
+};
+
+/*
+Message: one thing to deliver to many sessions.
+Encoded at most once per protocol, the first time a recipient using that
+protocol needs it, and then shared by every other recipient
+*/
+struct Message {
+    MessageKind kind;
+    std::string channel; // room or topic it went to
+    std::string text;    // the line chat clients see ("alice: hi")
+    std::string payload; // just the body, for protocols that carry the channel separately
+    uint64_t time_ns = 0; // when it was made (CLOCK_REALTIME), kept in records
+    mutable uint64_t seq = 0; // room sequence number, set by the owner in broadcast() before fan-out
+    uint64_t rx_ns = 0;       // when the kernel received the line it came from (0 = not from a client line)
+    uint64_t read_ns = 0;     // when we read() it (see latency.h)
+
+    // Compact wire (see wire.h): names as ids, and where the body starts in text ("alice: hi" -> 7)
+    uint32_t user_id = 0;          // 0 = not sent by a named user (notices, replays from the log)
+    uint32_t body_at = 0;
+    mutable uint32_t room_id = 0;  // set by the owner, like seq
+
+    // frame(): the encoding for one protocol (null if that protocol doesn't get this kind)
+    Frame frame(Protocol protocol) const;
+
+    // patternFrame(): topic messages to RESP clients name the pattern that matched
+    Frame patternFrame(const std::string& pattern) const;
+
+private:
+    mutable std::once_flag encoded_once[protocol_count];
+    mutable Frame encoded[protocol_count];
+    mutable std::mutex pattern_mutex;
+    mutable std::map<std::string, Frame> by_pattern;
+};
+
+typedef std::shared_ptr<const Message> MessagePtr;
+
+/*
+Session: one connected client, owned by the reactor holding its socket.
+id is unique for the life of the server (fds get reused after close,
+so deliveries are addressed by id instead)
+*/
+struct Session {
+    uint64_t id = 0;
+    int fd = -1;
+    Protocol protocol = chat_protocol;
+    bool detected = false;        // protocol picked yet (on the first bytes)
+    bool read_only = false;       // input is ignored (SSE viewers)
+    bool closing = false;         // close once the outbox is sent
+    bool authenticating = false;  // a /login or /register is being hashed, input waits (see accounts.h)
+    bool dropping = false;        // it failed: the input that waited for it is dropped, not taken as a name
+    bool migrating = false;       // on its way to another reactor, input waits (see migrateSessions)
+    std::string username;         // empty until the first line arrives
+    uint32_t user_id = 0;         // username's id on the compact wire
+    std::string room;             // room that chat lines go to
+    std::set<std::string> rooms;  // every room joined
+    std::set<std::string> topics; // topic patterns subscribed (see topics.h)
+    std::map<std::string, uint64_t> marks; // /since: the client already has a room up to this seq
+    std::string who_prefix;       // the last /who, for /more (see directory.h)
+    std::string who_after;        // last name it sent, empty when there's nothing more
+    std::string inbuf;            // bytes read but not yet a full line
+    uint64_t rx_ns = 0;           // kernel receive time of the last read (SO_TIMESTAMPING, 0 = none)
+    uint64_t read_ns = 0;         // when that read happened
+    std::unordered_set<uint32_t> defined; // ids a compact client has been told the names of
+    std::deque<Frame> outbox;     // frames waiting for the socket
+    size_t out_offset = 0;        // bytes of outbox.front() already sent
+    uint64_t work = 0;            // reads and frames queued since the last rebalance (see balance.h)
+};
+
+// Member: a session in a room, and the reactor holding its socket
+struct Member {
+    uint64_t session;
+    int reactor;
+};
+
+/*
+MemberList: a room's membership, never changed while fan-out workers hold it.
+Sorted by fan-out slot, then session id (see fanoutSlot in server.cpp), so
+joins and leaves can binary search it and each worker's share is one range
+*/
+struct MemberList {
+    std::vector<Member> members;
+};
+
+struct FanoutWorker; // see server.cpp
+
+/*
+Room: state kept on the owning reactor.
+
+Only the owner reads or changes members. A message handed to fan-out
+workers carries the list it was sent to, which stays pinned until the
+message's last chunk is handed off: a join or leave meanwhile edits a copy
+instead (see editMembers), so it never waits for a broadcast to finish
+(and later broadcasts never wait for a join)
+*/
+struct Room {
+    uint64_t seq = 0; // last sequence number handed out
+    uint32_t id = 0;  // the name's id on the compact wire
+    MemberList* members = new MemberList();
+
+    // Fan-out through workers (huge rooms, see fanOutParallel, and hot rooms): messages not yet handed
+    // off, and the lists they were sent to, by how many of them. How the room fans out (parallel, hot)
+    // only changes while nothing is in flight
+    int inflight = 0;
+    std::map<const MemberList*, int> pinned;
+    bool parallel = false;
+
+    // Hot rooms (see trackHeat): deliveries counted this window, and a fan-out thread of its own while hot
+    uint64_t heat = 0;
+    uint64_t heat_since_ms = 0;
+    int cool_windows = 0; // in a row below the demotion rate
+    FanoutWorker* hot = nullptr;
+    uint64_t promote_rate = 0; // promotion (or demotion) waiting for messages in flight
+    bool demoting = false;
+
+    ~Room() { delete members; } // only dropped with nothing in flight, so nothing else is pinned
+};
+
+// Batch: one message going to several sessions that live on the same reactor
+struct Batch {
+    MessagePtr message;
+    std::vector<uint64_t> sessions;
+    bool replay = false; // history for a joiner, not timed
+};
+
+// Migration: sessions leaving a reactor together, waiting for their rooms' owners to send to `to` instead
+struct Migration {
+    int to;
+    int acks = 0; // owners (rooms, topics) still to confirm
+    std::vector<uint64_t> sessions;
+};
+
+/*
+Inbox: tasks handed to a thread that runs a select() loop.
+The task runs on that thread, so it can touch the thread's state without
+locking. The wake pipe makes select() return when something is posted
+*/
+struct Inbox {
+    std::mutex mutex; // guards tasks only (handoff between threads)
+    std::vector<std::function<void()>> tasks;
+    int wake_fds[2] = {-1, -1};
+
+    bool open();                           // creates the wake pipe
+    void post(std::function<void()> task); // callable from any thread
+    void run();                            // runs everything posted so far
+};
+
+struct Reactor {
+    int index = 0;
+    int listen_fd = -1;
+    std::thread thread;
+    Inbox inbox;
+
+    std::map<uint64_t, Session> sessions; // sessions whose sockets live here
+    std::map<std::string, std::unique_ptr<Room>> rooms; // rooms this reactor owns
+    HistoryCache history; // recent messages of the rooms owned here, for joins
+    MessageLog log;       // every chat message of those rooms, on disk (--history-dir)
+    std::unordered_map<std::string, uint64_t> numbered; // room -> seq of its last chat message (see noteNumbered)
+    IngressLatency latency; // of chat lines, from kernel receive (see latency.h)
+    LoopWatch watch;        // heartbeat and phase for the stall watchdog (see watchdog.h)
+
+    // Changes to the rooms owned here, not yet sent to the room directory (see rooms.h)
+    std::map<std::string, RoomUpdate> room_updates;
+    uint64_t room_updates_sent_ms = 0;
+
+    // Sessions moving to or from here (see migrateSessions)
+    std::map<uint64_t, Migration> leaving; // by migration id
+    std::map<uint64_t, std::vector<std::function<void(Reactor&, Session&)>>> arriving; // work waiting for them
+    std::map<uint64_t, std::pair<int, uint64_t>> moved; // session -> reactor it went to, and when (ms)
+    std::atomic<uint64_t> busy_ns{0}; // time spent in loop passes (not waiting in select())
+
+    // Hot rooms owned here, and hot rooms' deliveries waiting for their share of a pass (see drainHot)
+    std::set<std::string> hot_rooms;
+    std::deque<Batch> hot_backlog;
+    std::unordered_map<std::string, size_t> hot_pending; // room -> its batches in hot_backlog
+    size_t hot_queued = 0;                               // recipients in hot_backlog
+    std::atomic<size_t> hot_waiting{0};                  // hot_queued, for the admin socket
+
+    // Batches built while fanning out, one list per destination reactor.
+    // Sent once at the end of each loop pass so several messages share a hop
+    std::vector<std::vector<Batch>> outgoing;
+};
+
+//Global: one reactor per thread, fixed after startup
+extern std::vector<Reactor*> reactors;
+
+// The numbering room seqs belong to (see wire.h), and loadEpoch(): the one kept in a log directory
+extern std::atomic<uint64_t> numbering_epoch;
+uint64_t loadEpoch(const std::string& dir);
+
+// logLine(): prints one full line to stdout from any thread
+void logLine(const std::string& line);
+
+// makeFrame(): encodes a line of text for chat clients (newline terminated)
+Frame makeFrame(const std::string& text);
+
+// makeMessage(): payload defaults to text
+MessagePtr makeMessage(MessageKind kind, const std::string& channel, const std::string& text,
+                       const std::string& payload = "");
+
+// makeChatMessage(): "username: body" said by a session
+MessagePtr makeChatMessage(const Session& s, const std::string& room, const std::string& body);
+
+// ownerOf(): reactor that owns (sequences and fans out) the given room
+int ownerOf(const std::string& room);
+
+// post(): hands a task to a reactor (see Inbox)
+void post(int target, std::function<void()> task);
+
+// runOn(): runs the task right away if we already are that reactor
+void runOn(Reactor& self, int target, std::function<void()> task);
+
+// broadcast(): fans a message out to a room's local members (runs on the room's owner).
+// ack: who to tell once it's on disk (durable rooms, see commit.h), session 0 = nobody
+void broadcast(Reactor& owner, const std::string& room_name, const MessagePtr& message, uint64_t sender_session,
+               Member ack = Member{0, 0});
+
+// noteNumbered(): remembers where a room's numbering stopped (runs on the room's owner)
+void noteNumbered(Reactor& owner, const std::string& room_name, uint64_t seq);
+
+// withSession(): runs fn on the session, now if it's on r, or wherever it moved to (false = it's gone)
+bool withSession(Reactor& r, uint64_t id, std::function<void(Reactor&, Session&)> fn);
+
+// postToSession(): withSession() on reactor `home`, callable from any thread
+void postToSession(int home, uint64_t id, std::function<void(Reactor&, Session&)> fn);
+
+// migrateSessions(): moves sessions of r to reactor `to`, socket, buffers, rooms and topics, keeping every
+// room's messages in order; shedSessions() picks the busiest of them for about `share` of r's work
+void migrateSessions(Reactor& r, const std::vector<uint64_t>& ids, int to);
+size_t shedSessions(Reactor& r, int to, double share, size_t max_sessions);
+
+// queueFrame(): puts raw bytes on a local session's outbox (replies, etc.)
+void queueFrame(Session& s, const Frame& frame);
+
+// reply(): sends a line back to just this client (as a notice, for protocols that have them)
+void reply(Session& s, const std::string& text);
+
+// ------------------- Session Actions -------------------
+// Run on the session's own reactor, they route to whoever owns the room/topic
+
+// handleLine(): one line of the chat protocol (binary clients send the same lines as records)
+void handleLine(Reactor& r, Session& s, std::string message);
+
+// handleInput(): everything complete in s.inbuf, in the session's protocol (false = drop the connection)
+bool handleInput(Reactor& r, Session& s);
+
+void joinRoom(Reactor& r, Session& s, const std::string& room);
+void leaveRoom(Reactor& r, Session& s, const std::string& room);
+void subscribeTopic(Reactor& r, Session& s, const std::string& pattern);
+void unsubscribeTopic(Reactor& r, Session& s, const std::string& pattern);
+
+// sendToRoom(): numbers and fans out on the room's owner (and other nodes for '#' channels)
+void sendToRoom(Reactor& r, Session& s, const std::string& room, const MessagePtr& message);
+
+// publishToTopic(): delivers to every session with a matching subscription
+void publishToTopic(Reactor& r, Session& s, const std::string& topic, const MessagePtr& message);
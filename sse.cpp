@@ -0,0 +1,122 @@
+/*
+Server-Sent Events Gateway (see sse.h)
+
+Request:  GET /events/<room> HTTP/1.1 (room names are percent-decoded, /events/%23news = #news)
+Response: 200 with Transfer-Encoding: chunked, then one chunk per event:
+    <hex size>\r\n
+    data: alice: hi\n\n
+    \r\n
+Anything the viewer sends after the request is ignored.
+*/
+
+#include <cstdio>
+#include <cctype>
+#include <set>
+
+#include "sse.h"
+
+namespace {
+
+const size_t max_request = 8192; // headers bigger than this aren't a dashboard
+
+std::set<std::string> allowed_rooms; // empty = every room
+
+Frame frameOf(std::string bytes) {
+    return std::make_shared<const std::string>(std::move(bytes));
+}
+
+// chunk(): wraps bytes as one HTTP/1.1 chunk
+std::string chunk(const std::string& body) {
+    char size[20];
+    snprintf(size, sizeof(size), "%zx\r\n", body.size());
+    return size + body + "\r\n";
+}
+
+std::string percentDecode(const std::string& text) {
+    std::string out;
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] == '%' && i + 2 < text.size() && isxdigit((unsigned char)text[i + 1]) &&
+            isxdigit((unsigned char)text[i + 2])) {
+            out += (char)std::stoi(text.substr(i + 1, 2), nullptr, 16);
+            i += 2;
+        } else {
+            out += text[i];
+        }
+    }
+    return out;
+}
+
+// respond(): a complete (non-streaming) HTTP response, the connection closes after it
+bool respond(Session& s, const std::string& status, const std::string& body) {
+    queueFrame(s, frameOf("HTTP/1.1 " + status + "\r\nContent-Type: text/plain\r\nContent-Length: " +
+                          std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body));
+    s.read_only = true;
+    s.closing = true;
+    return true;
+}
+
+} // namespace
+
+bool handleSse(Reactor& r, Session& s) {
+    // Already streaming: viewers are read-only, drop whatever they send
+    if (s.read_only) {
+        s.inbuf.clear();
+        return true;
+    }
+
+    size_t end = s.inbuf.find("\r\n\r\n");
+    if (end == std::string::npos) return s.inbuf.size() <= max_request; // headers not complete yet
+
+    // Request line: GET <path> HTTP/1.x
+    size_t path_end = s.inbuf.find(' ', 4);
+    std::string path = s.inbuf.substr(4, path_end == std::string::npos ? 0 : path_end - 4);
+    s.inbuf.clear();
+
+    const std::string prefix = "/events/";
+    if (path.compare(0, prefix.size(), prefix) != 0 || path.size() == prefix.size()) {
+        return respond(s, "404 Not Found", "Try /events/<room>\n");
+    }
+    std::string room = percentDecode(path.substr(prefix.size()));
+    if (!allowed_rooms.empty() && !allowed_rooms.count(room)) {
+        return respond(s, "403 Forbidden", "Room not available over SSE\n");
+    }
+
+    queueFrame(s, frameOf("HTTP/1.1 200 OK\r\n"
+                          "Content-Type: text/event-stream\r\n"
+                          "Cache-Control: no-cache\r\n"
+                          "Transfer-Encoding: chunked\r\n"
+                          "Connection: keep-alive\r\n\r\n" +
+                          chunk(": streaming " + room + "\n\n")));
+    s.read_only = true;
+    joinRoom(r, s, room); // silent member, same fan-out as everyone else
+    return true;
+}
+
+Frame encodeSseMessage(const Message& message) {
+    if (message.kind == topic_message) return nullptr; // viewers watch rooms only
+    std::string event = message.kind == notice_message ? "event: notice\n" : "";
+
+    // One data line per line of text (the browser joins them back with \n), so a line
+    // break in a message can't end the event early or start a field of its own
+    event += "data: ";
+    const std::string& text = message.text;
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] == '\r' || text[i] == '\n') {
+            if (text[i] == '\r' && i + 1 < text.size() && text[i + 1] == '\n') i++;
+            event += "\ndata: ";
+        } else {
+            event += text[i];
+        }
+    }
+    return frameOf(chunk(event + "\n\n"));
+}
+
+void allowSseRooms(const std::string& comma_list) {
+    size_t start = 0;
+    while (start <= comma_list.size()) {
+        size_t comma = comma_list.find(',', start);
+        if (comma == std::string::npos) comma = comma_list.size();
+        if (comma > start) allowed_rooms.insert(comma_list.substr(start, comma - start));
+        start = comma + 1;
+    }
+}
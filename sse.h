@@ -0,0 +1,25 @@
+/*
+Server-Sent Events Gateway
+
+Read-only live feed of a room over plain HTTP, for dashboards:
+    curl -N http://localhost:8080/events/lobby
+
+A connection starting with "GET " gets just enough HTTP parsing to find
+the room, a chunked text/event-stream response, and is then a silent
+member of the room. Every message is encoded as one chunk holding a
+"data:" event, once, and that chunk is shared by all viewers of the room
+(so a viewer costs about what an idle chat client costs).
+*/
+
+#pragma once
+
+#include "server.h"
+
+// handleSse(): waits for the request headers, then answers and joins the room
+bool handleSse(Reactor& r, Session& s);
+
+// encodeSseMessage(): one HTTP chunk with one event in it
+Frame encodeSseMessage(const Message& message);
+
+// allowSseRooms(): limits which rooms can be watched (empty = every room)
+void allowSseRooms(const std::string& comma_list);
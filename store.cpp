@@ -0,0 +1,825 @@
+/*
+Key-Value Store (see store.h)
+
+Record kinds (none of them MessageKinds, store files never reach the history log):
+    put, delete     channel = key, payload = value (WALs and run data)
+    index           channel = key, seq = offset of its data record (every index_every'th key)
+    bloom           seq = hash count, payload = filter bits
+    run footer      seq = entries, payload = RunFooter (always the last footer_size bytes)
+*/
+
+#include <iostream>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "store.h"
+#include "admin.h"
+#include "server.h"
+
+namespace {
+
+const uint8_t put_kind = 129;
+const uint8_t delete_kind = 130;
+const uint8_t index_kind = 131;
+const uint8_t bloom_kind = 132;
+const uint8_t run_footer_kind = 133;
+
+const int index_every = 16;     // data records per index entry (at most that many read per lookup)
+const int bloom_bits_per_key = 10;
+const int bloom_hashes = 7;     // ~1% false positives at 10 bits per key
+const size_t merge_width = 4;   // runs of about one size merged at once (see pickMerge)
+const size_t write_chunk = 1 << 20;
+
+struct RunFooter {
+    uint64_t data_end;    // data records are [0, data_end)
+    uint64_t index_at;    // index records are [index_at, bloom_at)
+    uint64_t bloom_at;    // one bloom record
+    uint64_t covers_from; // oldest memtable number in this run
+};
+
+const size_t footer_size = sizeof(RecordHeader) + sizeof(RunFooter);
+static_assert(footer_size % record_align == 0, "the footer is found by its size");
+
+// keyHash(): FNV-1a, then a finalizer; stored filters depend on it, so it can't change
+uint64_t keyHash(std::string_view key) {
+    uint64_t h = 14695981039346656037ull;
+    for (unsigned char c : key) h = (h ^ c) * 1099511628211ull;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+}
+
+// bloomBit(): the i-th probe for a hash (double hashing)
+uint64_t bloomBit(uint64_t hash, int i, uint64_t bits) {
+    uint32_t h1 = (uint32_t)hash, h2 = (uint32_t)(hash >> 32) | 1;
+    return (h1 + (uint64_t)i * h2) % bits;
+}
+
+// ------------------- Runs -------------------
+
+enum Lookup { lookup_absent, lookup_value, lookup_deleted };
+
+// Run: one immutable sorted file, mapped, with its index and filter in reach
+struct Run {
+    uint64_t number = 0;
+    uint64_t covers_from = 0;
+    uint64_t entries = 0;
+    std::string path;
+    MappedSegment file;
+    size_t data_end = 0;
+    std::vector<std::pair<std::string, uint64_t>> index; // first key of every index_every records -> offset
+    const uint8_t* bloom = nullptr;
+    uint64_t bloom_bits = 0;
+    int hashes = 0;
+
+    bool mayContain(std::string_view key) const {
+        uint64_t hash = keyHash(key);
+        for (int i = 0; i < hashes; i++) {
+            uint64_t bit = bloomBit(hash, i, bloom_bits);
+            if (!(bloom[bit / 8] & (1 << (bit % 8)))) return false;
+        }
+        return true;
+    }
+
+    Lookup find(const std::string& key, std::string& value) const {
+        auto at = std::upper_bound(index.begin(), index.end(), key,
+                                   [](const std::string& k, const std::pair<std::string, uint64_t>& e) {
+                                       return k < e.first;
+                                   });
+        if (at == index.begin()) return lookup_absent; // before the first key
+        size_t offset = (at - 1)->second;
+        for (int i = 0; i < index_every && offset < data_end; i++) {
+            RecordView record(file.data + offset);
+            int order = record.channel().compare(key);
+            if (order > 0) break;
+            if (order == 0) {
+                if (record.kind() == delete_kind) return lookup_deleted;
+                value.assign(record.payload());
+                return lookup_value;
+            }
+            offset += record.size();
+        }
+        return lookup_absent;
+    }
+};
+
+using RunPtr = std::shared_ptr<Run>;
+
+std::string runPath(const std::string& dir, uint64_t number) { return dir + "/run-" + std::to_string(number) + ".sst"; }
+std::string walPath(const std::string& dir, uint64_t number) { return dir + "/wal-" + std::to_string(number) + ".log"; }
+
+bool writeAll(int fd, const std::string& bytes) {
+    size_t written = 0;
+    while (written < bytes.size()) {
+        ssize_t n = write(fd, bytes.data() + written, bytes.size() - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        written += n;
+    }
+    return true;
+}
+
+// syncDir(): makes renames and new files in dir durable
+void syncDir(const std::string& dir) {
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return;
+    fsync(fd);
+    close(fd);
+}
+
+// openRun(): maps a run and checks every record in it (they're read in place afterwards)
+RunPtr openRun(const std::string& path, uint64_t number) {
+    RunPtr run = std::make_shared<Run>();
+    run->number = number;
+    run->path = path;
+    if (!run->file.map(path) || run->file.size < footer_size) return nullptr;
+    madvise(const_cast<char*>(run->file.data), run->file.size, MADV_RANDOM);
+
+    const char* data = run->file.data;
+    size_t size = run->file.size;
+    const char* footer_at = data + size - footer_size;
+    if (verifyRecord(footer_at, footer_size) != record_ok) return nullptr;
+    RecordView footer_record(footer_at);
+    if (footer_record.kind() != run_footer_kind || footer_record.payload().size() != sizeof(RunFooter)) return nullptr;
+    RunFooter footer;
+    memcpy(&footer, footer_record.payload().data(), sizeof(footer));
+    if (footer.data_end > footer.index_at || footer.index_at > footer.bloom_at || footer.bloom_at > size - footer_size) {
+        return nullptr;
+    }
+    run->entries = footer_record.seq();
+    run->covers_from = footer.covers_from;
+    run->data_end = footer.data_end;
+
+    size_t at = 0;
+    while (at < footer.data_end && verifyRecord(data + at, footer.data_end - at) == record_ok) {
+        at += RecordView(data + at).size();
+    }
+    if (at != footer.data_end) return nullptr;
+
+    at = footer.index_at;
+    while (at < footer.bloom_at && verifyRecord(data + at, footer.bloom_at - at) == record_ok) {
+        RecordView record(data + at);
+        if (record.kind() != index_kind || record.seq() >= footer.data_end) return nullptr;
+        run->index.emplace_back(std::string(record.channel()), record.seq());
+        at += record.size();
+    }
+    if (at != footer.bloom_at) return nullptr;
+
+    if (verifyRecord(data + at, size - footer_size - at) != record_ok) return nullptr;
+    RecordView bloom(data + at);
+    if (bloom.kind() != bloom_kind || bloom.payload().empty()) return nullptr;
+    run->bloom = (const uint8_t*)bloom.payload().data();
+    run->bloom_bits = bloom.payload().size() * 8;
+    run->hashes = (int)bloom.seq();
+    return run;
+}
+
+/*
+RunWriter: writes a run from keys in order, to a temporary file renamed
+into place by finish(), so a run file is either whole or absent
+*/
+class RunWriter {
+public:
+    bool start(const std::string& final_path) {
+        path = final_path;
+        fd = ::open((path + ".tmp").c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        return fd >= 0;
+    }
+
+    bool add(std::string_view key, std::string_view value, bool deleted) {
+        uint64_t offset = written + buffer.size();
+        if (entries % index_every == 0) index.emplace_back(std::string(key), offset);
+        hashes.push_back(keyHash(key));
+        entries++;
+        if (!appendRecord(buffer, deleted ? delete_kind : put_kind, 0, 0, key, "", value)) return false;
+        return buffer.size() < write_chunk || flushBuffer();
+    }
+
+    bool finish(uint64_t covers_from) {
+        RunFooter footer;
+        footer.data_end = written + buffer.size();
+        footer.index_at = footer.data_end;
+        for (auto& entry : index) {
+            if (!appendRecord(buffer, index_kind, entry.second, 0, entry.first, "", "")) return fail();
+        }
+        footer.bloom_at = written + buffer.size();
+
+        // Capped at what fits in one record: a huge run just gets more false positives
+        uint64_t bits = std::max<uint64_t>(64, (uint64_t)hashes.size() * bloom_bits_per_key);
+        bits = std::min<uint64_t>(bits, (uint64_t)(max_record - 2 * sizeof(RecordHeader)) * 8);
+        bits -= bits % 64;
+        std::string filter(bits / 8, '\0');
+        for (uint64_t hash : hashes) {
+            for (int i = 0; i < bloom_hashes; i++) {
+                uint64_t bit = bloomBit(hash, i, bits);
+                filter[bit / 8] |= (char)(1 << (bit % 8));
+            }
+        }
+        appendRecord(buffer, bloom_kind, bloom_hashes, 0, "", "", filter);
+
+        footer.covers_from = covers_from;
+        appendRecord(buffer, run_footer_kind, entries, 0, "", "", std::string_view((const char*)&footer, sizeof(footer)));
+
+        if (!flushBuffer() || fdatasync(fd) != 0) return fail();
+        close(fd);
+        fd = -1;
+        return rename((path + ".tmp").c_str(), path.c_str()) == 0;
+    }
+
+    ~RunWriter() {
+        if (fd >= 0) fail();
+    }
+
+private:
+    bool flushBuffer() {
+        if (!writeAll(fd, buffer)) return fail();
+        written += buffer.size();
+        buffer.clear();
+        return true;
+    }
+
+    bool fail() {
+        close(fd);
+        fd = -1;
+        unlink((path + ".tmp").c_str());
+        return false;
+    }
+
+    std::string path;
+    int fd = -1;
+    uint64_t written = 0;
+    uint64_t entries = 0;
+    std::string buffer;
+    std::vector<std::pair<std::string, uint64_t>> index;
+    std::vector<uint64_t> hashes;
+};
+
+// ------------------- Memtables -------------------
+
+struct Entry {
+    std::string value;
+    bool deleted;
+};
+
+using Memtable = std::map<std::string, Entry, std::less<>>;
+
+const size_t entry_overhead = 64; // map node and string headers, roughly
+
+Lookup findIn(const Memtable& table, const std::string& key, std::string& value) {
+    auto found = table.find(key);
+    if (found == table.end()) return lookup_absent;
+    if (found->second.deleted) return lookup_deleted;
+    value = found->second.value;
+    return lookup_value;
+}
+
+// ------------------- State -------------------
+
+struct StoreOp {
+    uint8_t kind; // put_kind, delete_kind, or 0 for a get
+    std::string key;
+    std::string value;
+    int reactor;
+    std::function<void(bool, const std::string&)> got;
+    std::function<void(bool)> done;
+    bool ok = false;
+};
+
+std::string dir;
+size_t memtable_limit = 0;
+bool enabled = false;
+
+std::mutex queue_mutex; // guards queue
+std::condition_variable queue_ready;
+std::deque<StoreOp> queue;
+
+// Store thread only
+Memtable active;
+size_t active_bytes = 0;
+uint64_t active_number = 0; // also its WAL's
+int wal_fd = -1;
+
+std::mutex version_mutex; // guards frozen, frozen_number and runs (store thread <-> flush and merge threads)
+std::condition_variable version_changed;
+std::shared_ptr<const Memtable> frozen; // being written out as a run, null if none
+uint64_t frozen_number = 0;
+std::vector<RunPtr> runs; // newest first
+
+struct StoreStats {
+    std::atomic<uint64_t> gets{0};
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> puts{0};
+    std::atomic<uint64_t> deletes{0};
+    std::atomic<uint64_t> batches{0};
+    std::atomic<uint64_t> wal_bytes{0};
+    std::atomic<uint64_t> run_searches{0}; // runs actually searched (the filter said maybe)
+    std::atomic<uint64_t> bloom_skips{0};  // runs the filter ruled out
+    std::atomic<uint64_t> flushes{0};
+    std::atomic<uint64_t> compactions{0};
+    std::atomic<uint64_t> compacted_bytes{0}; // written by merges (write amplification, with wal_bytes)
+    std::atomic<uint64_t> stalls{0};       // batches that waited for a flush to finish
+    std::atomic<uint64_t> errors{0};
+    std::atomic<uint64_t> memtable_keys{0};
+} stats;
+
+Lookup lookup(const std::string& key, std::string& value, const std::shared_ptr<const Memtable>& frozen_now,
+              const std::vector<RunPtr>& runs_now) {
+    Lookup result = findIn(active, key, value);
+    if (result == lookup_absent && frozen_now) result = findIn(*frozen_now, key, value);
+    for (size_t i = 0; result == lookup_absent && i < runs_now.size(); i++) {
+        if (!runs_now[i]->mayContain(key)) {
+            stats.bloom_skips++;
+            continue;
+        }
+        stats.run_searches++;
+        result = runs_now[i]->find(key, value);
+    }
+    return result;
+}
+
+bool openWal(uint64_t number) {
+    wal_fd = ::open(walPath(dir, number).c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (wal_fd < 0) return false;
+    syncDir(dir);
+    return true;
+}
+
+// freeze(): hands the full memtable to the flush thread and starts a new one (and WAL)
+void freeze() {
+    std::unique_lock<std::mutex> lock(version_mutex);
+    if (frozen) stats.stalls++; // the last one is still being written: writes wait rather than pile up
+    version_changed.wait(lock, []() { return !frozen; });
+
+    frozen = std::make_shared<const Memtable>(std::move(active));
+    frozen_number = active_number;
+    active = Memtable();
+    active_bytes = 0;
+    close(wal_fd);
+    if (!openWal(++active_number)) std::cerr << "Store: can't open a new WAL in " << dir << std::endl;
+    version_changed.notify_all();
+}
+
+// complete(): runs each finished op's callback on the reactor that asked, one handoff per reactor
+void complete(std::vector<StoreOp>& batch) {
+    std::vector<std::shared_ptr<std::vector<StoreOp>>> by_reactor(reactors.size());
+    for (StoreOp& op : batch) {
+        if (op.reactor < 0 || op.reactor >= (int)reactors.size()) {
+            if (op.got) op.got(op.ok, op.value);
+            else if (op.done) op.done(op.ok);
+            continue;
+        }
+        auto& ops = by_reactor[op.reactor];
+        if (!ops) ops = std::make_shared<std::vector<StoreOp>>();
+        ops->push_back(std::move(op));
+    }
+    for (int target = 0; target < (int)by_reactor.size(); target++) {
+        if (!by_reactor[target]) continue;
+        std::shared_ptr<std::vector<StoreOp>> ops = by_reactor[target];
+        post(target, [ops]() {
+            for (StoreOp& op : *ops) {
+                if (op.got) op.got(op.ok, op.value);
+                else if (op.done) op.done(op.ok);
+            }
+        });
+    }
+}
+
+void runStore() {
+    std::vector<StoreOp> batch;
+    std::string wal;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_ready.wait(lock, []() { return !queue.empty(); });
+            batch.assign(std::make_move_iterator(queue.begin()), std::make_move_iterator(queue.end()));
+            queue.clear();
+        }
+        std::shared_ptr<const Memtable> frozen_now;
+        std::vector<RunPtr> runs_now;
+        {
+            std::lock_guard<std::mutex> lock(version_mutex);
+            frozen_now = frozen;
+            runs_now = runs;
+        }
+
+        // In queue order, so a get sees every write queued before it
+        wal.clear();
+        for (StoreOp& op : batch) {
+            if (op.kind == 0) {
+                stats.gets++;
+                op.ok = lookup(op.key, op.value, frozen_now, runs_now) == lookup_value;
+                if (op.ok) stats.hits++;
+                else op.value.clear();
+                continue;
+            }
+            bool deleted = op.kind == delete_kind;
+            op.ok = appendRecord(wal, op.kind, 0, 0, op.key, "", op.value);
+            if (!op.ok) continue; // too big to be a record
+            (deleted ? stats.deletes : stats.puts)++;
+            auto slot = active.try_emplace(op.key);
+            Entry& entry = slot.first->second;
+            if (slot.second) active_bytes += op.key.size() + entry_overhead;
+            active_bytes = active_bytes - entry.value.size() + (deleted ? 0 : op.value.size());
+            entry.value = deleted ? std::string() : std::move(op.value);
+            entry.deleted = deleted;
+            op.value.clear();
+        }
+
+        // One write and one sync for every write in the batch, before any of them completes
+        if (!wal.empty()) {
+            bool written = wal_fd >= 0 && writeAll(wal_fd, wal) && fdatasync(wal_fd) == 0;
+            if (!written) {
+                stats.errors++;
+                for (StoreOp& op : batch) {
+                    if (op.kind != 0) op.ok = false; // in the memtable, but not promised
+                }
+            }
+            stats.wal_bytes += wal.size();
+        }
+        stats.batches++;
+        stats.memtable_keys.store(active.size(), std::memory_order_relaxed);
+        complete(batch);
+        batch.clear();
+
+        if (active_bytes >= memtable_limit) freeze();
+    }
+}
+
+// ------------------- Compaction -------------------
+
+bool writeMemtable(const Memtable& table, uint64_t number) {
+    RunWriter writer;
+    if (!writer.start(runPath(dir, number))) return false;
+    for (auto& entry : table) {
+        if (!writer.add(entry.first, entry.second.value, entry.second.deleted)) return false;
+    }
+    return writer.finish(number);
+}
+
+/*
+mergeRuns(): writes them (newest first, next to each other in age) as one
+run. Where several have a key, the newest wins; deletions are dropped only
+if the oldest run is among them, since then nothing is left for them to hide
+*/
+bool mergeRuns(const std::vector<RunPtr>& inputs, bool oldest) {
+    struct Cursor {
+        const Run* run;
+        size_t at;
+    };
+    std::vector<Cursor> cursors;
+    for (const RunPtr& run : inputs) cursors.push_back(Cursor{run.get(), 0});
+
+    RunWriter writer;
+    if (!writer.start(runPath(dir, inputs.front()->number))) return false;
+    while (true) {
+        // The smallest key left, from the newest run holding it
+        const Cursor* pick = nullptr;
+        std::string_view key;
+        for (const Cursor& c : cursors) {
+            if (c.at >= c.run->data_end) continue;
+            std::string_view candidate = RecordView(c.run->file.data + c.at).channel();
+            if (!pick || candidate < key) {
+                pick = &c;
+                key = candidate;
+            }
+        }
+        if (!pick) break;
+
+        RecordView record(pick->run->file.data + pick->at);
+        bool deleted = record.kind() == delete_kind;
+        if ((!deleted || !oldest) && !writer.add(key, record.payload(), deleted)) return false;
+        for (Cursor& c : cursors) { // past it in every run (key points into the picked run's mapping, still valid)
+            if (c.at < c.run->data_end && RecordView(c.run->file.data + c.at).channel() == key) {
+                c.at += RecordView(c.run->file.data + c.at).size();
+            }
+        }
+    }
+    return writer.finish(inputs.back()->covers_from);
+}
+
+/*
+pickMerge(): the runs to merge next, [first, last) of runs (newest first), or first == last if none.
+From each run, newest first, a stretch grows while the next older run is no bigger than the
+whole stretch; merge_width runs or more are worth merging. So runs merge with others of about
+their size, and a big old one waits until as much has piled up in front of it: every record is
+rewritten about log2(runs it has outlived) times, not once per merge
+*/
+std::pair<size_t, size_t> pickMerge(const std::vector<RunPtr>& list) {
+    for (size_t first = 0; first < list.size(); first++) {
+        uint64_t bytes = list[first]->file.size;
+        size_t last = first + 1;
+        while (last < list.size() && list[last]->file.size <= bytes) bytes += list[last++]->file.size;
+        if (last - first >= merge_width) return {first, last};
+    }
+    return {0, 0};
+}
+
+// runFlush(): writes each frozen memtable out as the newest run, then its WAL can go
+void runFlush() {
+    while (true) {
+        std::shared_ptr<const Memtable> flushing;
+        uint64_t number = 0;
+        {
+            std::unique_lock<std::mutex> lock(version_mutex);
+            version_changed.wait(lock, []() { return frozen != nullptr; });
+            flushing = frozen;
+            number = frozen_number;
+        }
+
+        RunPtr run = writeMemtable(*flushing, number) ? openRun(runPath(dir, number), number) : nullptr;
+        if (!run) {
+            stats.errors++;
+            std::cerr << "Store: can't write run " << number << ", retrying" << std::endl;
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            continue;
+        }
+        syncDir(dir);
+        {
+            std::lock_guard<std::mutex> lock(version_mutex);
+            runs.insert(runs.begin(), run);
+            frozen = nullptr;
+        }
+        version_changed.notify_all();
+        unlink(walPath(dir, number).c_str());
+        stats.flushes++;
+    }
+}
+
+/*
+runMerge(): merges runs as pickMerge() finds them, on its own thread so a long merge never
+holds up a flush (and the writes waiting on it). Flushes only add runs in front, so the
+inputs are still next to each other, where they were, when the merge is done
+*/
+void runMerge() {
+    while (true) {
+        std::vector<RunPtr> merging;
+        bool oldest;
+        {
+            std::unique_lock<std::mutex> lock(version_mutex);
+            std::pair<size_t, size_t> range;
+            version_changed.wait(lock, [&]() {
+                range = pickMerge(runs);
+                return range.first != range.second;
+            });
+            merging.assign(runs.begin() + range.first, runs.begin() + range.second);
+            oldest = range.second == runs.size();
+        }
+
+        // Named after the newest input, replacing it
+        uint64_t newest = merging.front()->number;
+        RunPtr merged = mergeRuns(merging, oldest) ? openRun(runPath(dir, newest), newest) : nullptr;
+        if (!merged) {
+            stats.errors++;
+            std::cerr << "Store: compaction failed, retrying" << std::endl;
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            continue;
+        }
+        syncDir(dir);
+        {
+            std::lock_guard<std::mutex> lock(version_mutex);
+            size_t at = std::find(runs.begin(), runs.end(), merging.front()) - runs.begin();
+            runs.erase(runs.begin() + at, runs.begin() + at + merging.size());
+            runs.insert(runs.begin() + at, merged);
+        }
+        for (size_t i = 1; i < merging.size(); i++) unlink(merging[i]->path.c_str()); // still mapped until unused
+        stats.compactions++;
+        stats.compacted_bytes += merged->file.size;
+    }
+}
+
+// ------------------- Startup -------------------
+
+// listFiles(): numbers of the <prefix><n><suffix> files in dir, ascending
+std::vector<uint64_t> listFiles(const char* prefix, const char* suffix) {
+    std::vector<uint64_t> numbers;
+    DIR* d = opendir(dir.c_str());
+    if (!d) return numbers;
+    size_t prefix_size = strlen(prefix), suffix_size = strlen(suffix);
+    while (dirent* entry = readdir(d)) {
+        std::string name = entry->d_name;
+        if (name.size() <= prefix_size + suffix_size || name.compare(0, prefix_size, prefix) != 0 ||
+            name.compare(name.size() - suffix_size, suffix_size, suffix) != 0) {
+            continue;
+        }
+        std::string digits = name.substr(prefix_size, name.size() - prefix_size - suffix_size);
+        if (digits.find_first_not_of("0123456789") == std::string::npos) numbers.push_back(std::stoull(digits));
+    }
+    closedir(d);
+    std::sort(numbers.begin(), numbers.end());
+    return numbers;
+}
+
+// replayWal(): its writes into the memtable, up to a torn tail
+void replayWal(uint64_t number) {
+    MappedSegment mapped;
+    if (!mapped.map(walPath(dir, number))) return;
+    size_t at = 0;
+    while (verifyRecord(mapped.data + at, mapped.size - at) == record_ok) {
+        RecordView record(mapped.data + at);
+        at += record.size();
+        if (record.kind() != put_kind && record.kind() != delete_kind) continue;
+        Entry& entry = active[std::string(record.channel())];
+        entry.deleted = record.kind() == delete_kind;
+        entry.value = entry.deleted ? std::string() : std::string(record.payload());
+    }
+    if (at < mapped.size) std::cerr << "Store: cut " << mapped.size - at << " torn bytes from WAL " << number << std::endl;
+}
+
+/*
+recover(): loads the runs, drops what a crash left behind, and turns
+the WALs into one more run, so the store starts with an empty memtable
+*/
+bool recover() {
+    std::vector<uint64_t> run_numbers = listFiles("run-", ".sst");
+    std::vector<RunPtr> loaded;
+    for (uint64_t number : run_numbers) {
+        RunPtr run = openRun(runPath(dir, number), number);
+        if (!run) {
+            std::cerr << "Store: run " << number << " is damaged" << std::endl;
+            return false;
+        }
+        loaded.push_back(run);
+    }
+    // Inputs of a merge whose files outlived it (it covers them, and is newer)
+    for (const RunPtr& run : loaded) {
+        bool covered = false;
+        for (const RunPtr& other : loaded) {
+            covered = covered || (other->covers_from <= run->number && run->number < other->number);
+        }
+        if (covered) unlink(run->path.c_str());
+        else runs.insert(runs.begin(), run);
+    }
+    for (uint64_t number : listFiles("run-", ".sst.tmp")) unlink((runPath(dir, number) + ".tmp").c_str());
+
+    uint64_t last_run = runs.empty() ? 0 : runs.front()->number;
+    std::vector<uint64_t> replayed;
+    for (uint64_t number : listFiles("wal-", ".log")) {
+        if (number <= last_run) {
+            unlink(walPath(dir, number).c_str()); // written out before the crash
+            continue;
+        }
+        replayWal(number);
+        replayed.push_back(number);
+    }
+    active_number = std::max(last_run, replayed.empty() ? 0 : replayed.back()) + 1;
+
+    if (!active.empty()) {
+        uint64_t number = replayed.back();
+        RunWriter writer;
+        bool ok = writer.start(runPath(dir, number));
+        for (auto& entry : active) ok = ok && writer.add(entry.first, entry.second.value, entry.second.deleted);
+        RunPtr run = ok && writer.finish(replayed.front()) ? openRun(runPath(dir, number), number) : nullptr;
+        if (!run) {
+            std::cerr << "Store: can't write the recovered WALs out" << std::endl;
+            return false;
+        }
+        runs.insert(runs.begin(), run);
+        active.clear();
+    }
+    for (uint64_t number : replayed) unlink(walPath(dir, number).c_str());
+    syncDir(dir);
+    return true;
+}
+
+std::string storeStats() {
+    size_t queued;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        queued = queue.size();
+    }
+    size_t run_count;
+    uint64_t run_entries = 0;
+    {
+        std::lock_guard<std::mutex> lock(version_mutex);
+        run_count = runs.size();
+        for (const RunPtr& run : runs) run_entries += run->entries;
+    }
+    uint64_t batches = stats.batches;
+    char line[1024];
+    snprintf(line, sizeof(line),
+             "store_gets %llu\nstore_hits %llu\nstore_puts %llu\nstore_deletes %llu\nstore_queue %zu\n"
+             "store_batches %llu\nstore_ops_per_batch %.1f\nstore_wal_bytes %llu\nstore_memtable_keys %llu\n"
+             "store_runs %zu\nstore_run_entries %llu\nstore_run_searches %llu\nstore_bloom_skips %llu\n"
+             "store_flushes %llu\nstore_compactions %llu\nstore_compacted_bytes %llu\nstore_stalls %llu\n"
+             "store_errors %llu\n",
+             (unsigned long long)stats.gets.load(), (unsigned long long)stats.hits.load(),
+             (unsigned long long)stats.puts.load(), (unsigned long long)stats.deletes.load(), queued,
+             (unsigned long long)batches,
+             batches ? (double)(stats.gets + stats.puts + stats.deletes) / batches : 0.0,
+             (unsigned long long)stats.wal_bytes.load(), (unsigned long long)stats.memtable_keys.load(), run_count,
+             (unsigned long long)run_entries, (unsigned long long)stats.run_searches.load(),
+             (unsigned long long)stats.bloom_skips.load(), (unsigned long long)stats.flushes.load(),
+             (unsigned long long)stats.compactions.load(), (unsigned long long)stats.compacted_bytes.load(),
+             (unsigned long long)stats.stalls.load(),
+             (unsigned long long)stats.errors.load());
+    return line;
+}
+
+void enqueue(StoreOp&& op) {
+    bool was_empty;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        was_empty = queue.empty();
+        queue.push_back(std::move(op));
+    }
+    if (was_empty) queue_ready.notify_one(); // otherwise the store thread is already on its way
+}
+
+// adminStore(): kv get <key> | kv put <key> <value> | kv del <key>, waits for the store thread
+std::string adminStore(const std::string& args) {
+    size_t space = args.find(' ');
+    std::string verb = args.substr(0, space);
+    std::string rest = space == std::string::npos ? "" : args.substr(space + 1);
+    size_t value_at = rest.find(' ');
+    std::string key = rest.substr(0, value_at);
+    if (key.empty() || (verb != "get" && verb != "put" && verb != "del") || (verb == "put") != (value_at != std::string::npos)) {
+        return "Usage: kv get <key> | kv put <key> <value> | kv del <key>\n";
+    }
+
+    std::mutex mutex;
+    std::condition_variable finished;
+    bool ready = false;
+    std::string reply;
+    auto answer = [&](const std::string& text) {
+        std::lock_guard<std::mutex> lock(mutex);
+        reply = text;
+        ready = true;
+        finished.notify_one();
+    };
+    if (verb == "get") {
+        storeGet(key, -1, [&](bool found, const std::string& value) { answer(found ? value + "\n" : "(not found)\n"); });
+    } else if (verb == "put") {
+        storePut(key, rest.substr(value_at + 1), -1, [&](bool ok) { answer(ok ? "OK\n" : "Failed\n"); });
+    } else {
+        storeDelete(key, -1, [&](bool ok) { answer(ok ? "OK\n" : "Failed\n"); });
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [&]() { return ready; });
+    return reply;
+}
+
+} // namespace
+
+bool openStore(const std::string& store_dir, size_t memtable_bytes) {
+    dir = store_dir;
+    memtable_limit = std::max<size_t>(memtable_bytes, 64 << 10);
+    mkdir(dir.c_str(), 0755);
+    if (!recover() || !openWal(active_number)) {
+        std::cerr << "Can't open the store in " << dir << std::endl;
+        return false;
+    }
+    uint64_t entries = 0;
+    for (const RunPtr& run : runs) entries += run->entries;
+    std::cout << "Store: " << runs.size() << " run(s), " << entries << " entries in " << dir << std::endl;
+
+    enabled = true;
+    std::thread(runStore).detach();
+    std::thread(runFlush).detach();
+    std::thread(runMerge).detach();
+    addAdminStats(storeStats);
+    addAdminCommand("kv", "read or change the key-value store (kv get|put|del <key> [value])", adminStore);
+    return true;
+}
+
+bool storeEnabled() {
+    return enabled;
+}
+
+void storeGet(const std::string& key, int reactor, std::function<void(bool, const std::string&)> done) {
+    StoreOp op;
+    op.kind = 0;
+    op.key = key;
+    op.reactor = reactor;
+    op.got = std::move(done);
+    enqueue(std::move(op));
+}
+
+void storePut(const std::string& key, const std::string& value, int reactor, std::function<void(bool)> done) {
+    StoreOp op;
+    op.kind = put_kind;
+    op.key = key;
+    op.value = value;
+    op.reactor = reactor;
+    op.done = std::move(done);
+    enqueue(std::move(op));
+}
+
+void storeDelete(const std::string& key, int reactor, std::function<void(bool)> done) {
+    StoreOp op;
+    op.kind = delete_kind;
+    op.key = key;
+    op.reactor = reactor;
+    op.done = std::move(done);
+    enqueue(std::move(op));
+}
@@ -0,0 +1,45 @@
+/*
+Key-Value Store
+
+A small LSM tree in one directory (--store-dir), for state that changes
+often and has to survive restarts: user profiles (/profile, /whois) now,
+room settings, bans and read markers as they come. Keys are grouped by
+prefix ("profile/alice"), values are opaque bytes.
+
+Nothing here blocks a reactor: operations go to the store thread through
+a queue, and each completion is posted back to the reactor that asked,
+all of a reactor's completions from one batch in one handoff. The store
+thread handles a whole queue at a time:
+    puts/deletes  go to the memtable (a sorted map) and to the write-ahead
+                  log, one write and one fdatasync per batch, then they
+                  complete (so a completed put is on disk)
+    gets          memtable, then the one being flushed, then the runs,
+                  newest first; a run is only searched if its Bloom
+                  filter says the key may be there
+When the memtable is full it is frozen and a new one (and a new WAL)
+takes over; the flush thread writes the frozen one out as a sorted run.
+A merge thread of its own merges runs of about the same size, a few at
+a time (size-tiered), dropping overwritten values on the way, and
+deletions once nothing older is left; a merge never holds up a flush.
+
+Files (all records, record.h):
+    wal-<n>.log     the memtable's writes, replayed at startup
+    run-<n>.sst     sorted records, then a sparse index, a Bloom filter
+                    and a footer; mmap'd and read in place
+A merged run takes the number of its newest input and records the oldest
+it covers, so inputs left behind by a crash are recognised and removed.
+*/
+
+#pragma once
+
+#include <string>
+#include <functional>
+
+// openStore(): replays the WALs in dir (created if missing), then starts the store, flush and merge threads
+bool openStore(const std::string& dir, size_t memtable_bytes);
+bool storeEnabled();
+
+// done(found, value) / done(ok) run on reactor `reactor` (on the store thread if it's -1)
+void storeGet(const std::string& key, int reactor, std::function<void(bool found, const std::string& value)> done);
+void storePut(const std::string& key, const std::string& value, int reactor, std::function<void(bool ok)> done);
+void storeDelete(const std::string& key, int reactor, std::function<void(bool ok)> done);
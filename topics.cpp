@@ -0,0 +1,140 @@
+/*
+Topic Subscriptions (see topics.h)
+*/
+
+#include <algorithm>
+
+#include "topics.h"
+
+namespace {
+
+// split(): "a.b.c" -> {"a", "b", "c"}
+std::vector<std::string> split(const std::string& text) {
+    std::vector<std::string> levels;
+    size_t start = 0;
+    while (true) {
+        size_t dot = text.find('.', start);
+        levels.push_back(text.substr(start, dot == std::string::npos ? std::string::npos : dot - start));
+        if (dot == std::string::npos) break;
+        start = dot + 1;
+    }
+    return levels;
+}
+
+bool matchLevels(const std::vector<std::string>& pattern, size_t p, const std::vector<std::string>& topic, size_t t) {
+    if (p == pattern.size()) return t == topic.size();
+    if (pattern[p] == "#") return true; // always last, takes whatever is left (even nothing)
+    if (t == topic.size()) return false;
+    if (pattern[p] != "*" && pattern[p] != topic[t]) return false;
+    return matchLevels(pattern, p + 1, topic, t + 1);
+}
+
+} // namespace
+
+bool TopicIndex::validPattern(const std::string& pattern) {
+    if (pattern.empty()) return false;
+    std::vector<std::string> levels = split(pattern);
+    for (size_t i = 0; i < levels.size(); i++) {
+        const std::string& level = levels[i];
+        if (level.empty()) return false;
+        if (level == "#" && i + 1 != levels.size()) return false;
+        if (level != "*" && level != "#" && level.find_first_of("*#") != std::string::npos) return false;
+    }
+    return true;
+}
+
+bool TopicIndex::validTopic(const std::string& topic) {
+    return validPattern(topic) && topic.find_first_of("*#") == std::string::npos;
+}
+
+bool TopicIndex::matches(const std::string& pattern, const std::string& topic) {
+    return matchLevels(split(pattern), 0, split(topic), 0);
+}
+
+void TopicIndex::subscribe(const std::string& pattern, const Member& member) {
+    Node* node = &root;
+    for (const std::string& level : split(pattern)) {
+        std::unique_ptr<Node>& child = node->children[level];
+        if (!child) child.reset(new Node());
+        node = child.get();
+    }
+    node->subscribers[member.session] = member.reactor;
+    invalidate(pattern);
+}
+
+void TopicIndex::unsubscribe(const std::string& pattern, uint64_t session) {
+    // Remember the path so empty nodes can be pruned on the way back
+    std::vector<std::pair<Node*, std::string>> path;
+    Node* node = &root;
+    for (const std::string& level : split(pattern)) {
+        auto found = node->children.find(level);
+        if (found == node->children.end()) return;
+        path.push_back({node, level});
+        node = found->second.get();
+    }
+    if (node->subscribers.erase(session) == 0) return;
+    invalidate(pattern);
+
+    while (!path.empty()) {
+        Node* parent = path.back().first;
+        Node* child = parent->children[path.back().second].get();
+        if (!child->subscribers.empty() || !child->children.empty()) break;
+        parent->children.erase(path.back().second);
+        path.pop_back();
+    }
+}
+
+/*
+collect(): walks every trie branch that can match levels[depth...].
+At each node that means the literal child for the next level, the '*'
+child, and the '#' child (which matches everything left, so its
+subscribers are taken without going deeper)
+*/
+void TopicIndex::collect(const Node& node, const std::vector<std::string>& levels, size_t depth,
+                         std::vector<Member>& out) const {
+    auto hash = node.children.find("#");
+    if (hash != node.children.end()) {
+        for (auto& sub : hash->second->subscribers) out.push_back(Member{sub.first, sub.second});
+    }
+
+    if (depth == levels.size()) {
+        for (auto& sub : node.subscribers) out.push_back(Member{sub.first, sub.second});
+        return;
+    }
+
+    auto literal = node.children.find(levels[depth]);
+    if (literal != node.children.end()) collect(*literal->second, levels, depth + 1, out);
+
+    auto star = node.children.find("*");
+    if (star != node.children.end()) collect(*star->second, levels, depth + 1, out);
+}
+
+const std::vector<Member>& TopicIndex::match(const std::string& topic) {
+    auto cached = cache.find(topic);
+    if (cached != cache.end()) return cached->second;
+
+    // Keeps the cache from growing with every topic ever published
+    if (cache.size() >= max_cached_topics) cache.clear();
+
+    std::vector<Member> found;
+    collect(root, split(topic), 0, found);
+
+    // Several patterns can match for the same session, it only gets the message once
+    std::sort(found.begin(), found.end(), [](const Member& a, const Member& b) { return a.session < b.session; });
+    found.erase(std::unique(found.begin(), found.end(), [](const Member& a, const Member& b) {
+        return a.session == b.session;
+    }), found.end());
+
+    return cache[topic] = std::move(found);
+}
+
+// invalidate(): drops the cached results that this pattern could have changed
+void TopicIndex::invalidate(const std::string& pattern) {
+    for (auto it = cache.begin(); it != cache.end();) {
+        if (matches(pattern, it->first)) {
+            it = cache.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
@@ -0,0 +1,58 @@
+/*
+Topic Subscriptions
+
+Topics are dot-separated levels, like alerts.db.critical.
+Subscriptions are patterns over those levels:
+- '*' matches exactly one level  (alerts.*.critical)
+- '#' matches zero or more levels, only as the last level (team.#)
+
+Patterns are kept in a trie, one level per node, with the wildcards as
+their own children. Matching a topic only walks the branches that can
+still match it, so the cost grows with the subscriptions that match,
+not with how many subscriptions exist.
+
+Results are cached per topic. A subscription change only drops the
+cached topics that its pattern matches.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+
+#include "server.h"
+
+class TopicIndex {
+public:
+    // validPattern()/validTopic(): checks the syntax above (topics can't use wildcards)
+    static bool validPattern(const std::string& pattern);
+    static bool validTopic(const std::string& topic);
+
+    // matches(): does a single pattern match the topic
+    static bool matches(const std::string& pattern, const std::string& topic);
+
+    void subscribe(const std::string& pattern, const Member& member);
+    void unsubscribe(const std::string& pattern, uint64_t session);
+
+    // match(): every subscriber of the topic, once each (even if several patterns match)
+    const std::vector<Member>& match(const std::string& topic);
+
+    size_t cachedTopics() const { return cache.size(); }
+
+private:
+    struct Node {
+        std::map<std::string, std::unique_ptr<Node>> children; // literal levels, '*' and '#'
+        std::map<uint64_t, int> subscribers;                     // session -> reactor
+    };
+
+    static const size_t max_cached_topics = 10000;
+
+    Node root;
+    std::map<std::string, std::vector<Member>> cache;
+
+    void collect(const Node& node, const std::vector<std::string>& levels, size_t depth,
+                 std::vector<Member>& out) const;
+    void invalidate(const std::string& pattern);
+};
@@ -0,0 +1,170 @@
+/*
+Stall Watchdog (see watchdog.h)
+*/
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <cxxabi.h>
+#include <execinfo.h>
+#include <signal.h>
+
+#include "watchdog.h"
+#include "clock.h"
+#include "admin.h"
+#include "server.h"
+
+namespace {
+
+const char* phase_names[phase_count] = {"idle", "inbox", "accept",    "read",   "handoff",
+                                        "write", "log",  "broadcast", "deliver"};
+
+const int max_frames = 48;
+const int stack_signal = SIGUSR2;
+
+// Filled by the signal handler on the stalled thread (one capture at a time)
+void* captured[max_frames];
+std::atomic<int> captured_depth{0};
+std::atomic<bool> captured_ready{false};
+
+std::mutex reports_mutex; // guards reports
+std::deque<std::string> reports; // the last few, for the admin stalls command
+std::atomic<uint64_t> stalls{0};
+std::atomic<uint64_t> max_stall_ms{0};
+
+// onStackSignal(): runs on the stalled reactor, only touches the buffer above
+void onStackSignal(int) {
+    int saved = errno;
+    captured_depth.store(backtrace(captured, max_frames), std::memory_order_relaxed);
+    captured_ready.store(true, std::memory_order_release);
+    errno = saved;
+}
+
+// demangle(): "./server(_Z10handleLine...+0x42) [0x...]" -> "handleLine(...) +0x42"
+std::string demangle(const char* symbol) {
+    const char* open = strchr(symbol, '(');
+    const char* plus = open ? strchr(open, '+') : nullptr;
+    if (!open || !plus || plus == open + 1) return symbol;
+
+    std::string mangled(open + 1, plus);
+    int status;
+    char* name = abi::__cxa_demangle(mangled.c_str(), nullptr, nullptr, &status);
+    std::string out = status == 0 ? name : mangled;
+    free(name);
+    const char* close = strchr(plus, ')');
+    return out + " " + std::string(plus, close ? close : plus + strlen(plus));
+}
+
+// captureStack(): the reactor's stack right now, one frame per line (empty if it didn't answer)
+std::string captureStack(pthread_t thread) {
+    captured_ready.store(false);
+    if (pthread_kill(thread, stack_signal) != 0) return "";
+    for (int waited = 0; !captured_ready.load(std::memory_order_acquire); waited++) {
+        if (waited == 100) return "  (no stack, the thread didn't take the signal)\n";
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    int depth = captured_depth.load(std::memory_order_relaxed);
+    char** symbols = backtrace_symbols(captured, depth); // allocates, fine here
+    std::string stack;
+    for (int i = 2; i < depth; i++) { // 0 and 1 are the handler and the signal trampoline
+        stack += "  #" + std::to_string(i - 2) + " " + (symbols ? demangle(symbols[i]) : "?") + "\n";
+    }
+    free(symbols);
+    return stack;
+}
+
+// inboxDepth(): tasks queued for the reactor, if its inbox isn't locked right now (-1 if it is)
+long inboxDepth(Reactor& r) {
+    std::unique_lock<std::mutex> lock(r.inbox.mutex, std::try_to_lock);
+    return lock.owns_lock() ? (long)r.inbox.tasks.size() : -1;
+}
+
+void report(std::string text) {
+    if (!text.empty() && text.back() == '\n') text.pop_back();
+    logLine(text);
+    std::lock_guard<std::mutex> lock(reports_mutex);
+    reports.push_back(text);
+    if (reports.size() > 8) reports.pop_front();
+}
+
+struct Watched {
+    uint64_t beat = 0;
+    uint64_t since_ms = 0; // when beat last changed
+    bool reported = false;
+};
+
+void runWatchdog(int stall_ms) {
+    std::vector<Watched> watched(reactors.size());
+    int every_ms = std::max(1, stall_ms / 4);
+
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(every_ms));
+        uint64_t now = monotonicMs();
+
+        for (size_t i = 0; i < reactors.size(); i++) {
+            Reactor& r = *reactors[i];
+            Watched& w = watched[i];
+            uint64_t beat = r.watch.beat.load(std::memory_order_acquire);
+
+            if (beat != w.beat) { // moved on
+                if (w.reported) {
+                    uint64_t lasted = now - w.since_ms;
+                    uint64_t seen = max_stall_ms.load();
+                    while (lasted > seen && !max_stall_ms.compare_exchange_weak(seen, lasted)) {}
+                    report("[watchdog] reactor " + std::to_string(i) + " recovered after ~" + std::to_string(lasted) +
+                           " ms");
+                }
+                w = Watched{beat, now, false};
+                continue;
+            }
+            if (!(beat & 1) || w.reported || now - w.since_ms < (uint64_t)stall_ms) continue;
+
+            // Stuck in one pass: what it's doing, then where
+            w.reported = true;
+            stalls++;
+            int phase = r.watch.phase.load(std::memory_order_relaxed);
+            uint64_t session = r.watch.session.load(std::memory_order_relaxed);
+            long inbox = inboxDepth(r);
+            std::string text = "[watchdog] reactor " + std::to_string(i) + " stalled " +
+                               std::to_string(now - w.since_ms) + " ms in " + phase_names[phase] +
+                               (session ? " (session " + std::to_string(session) + ")" : "") + ", inbox " +
+                               (inbox < 0 ? "locked" : std::to_string(inbox) + " queued") + ", " +
+                               std::to_string(r.watch.sessions.load(std::memory_order_relaxed)) + " sessions\n";
+            report(text + captureStack(r.watch.thread));
+        }
+    }
+}
+
+std::string watchdogStats() {
+    return "watchdog_stalls " + std::to_string(stalls.load()) + "\n" +
+           "watchdog_max_stall_ms " + std::to_string(max_stall_ms.load()) + "\n";
+}
+
+} // namespace
+
+void startWatchdog(int stall_ms) {
+    if (stall_ms <= 0) return;
+
+    // backtrace() loads its unwinder on first use, which isn't safe in a signal handler: do it now
+    void* warm[1];
+    backtrace(warm, 1);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onStackSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(stack_signal, &action, nullptr);
+
+    addAdminStats(watchdogStats);
+    addAdminCommand("stalls", "the last stalls the watchdog caught, with stacks", [](const std::string&) {
+        std::lock_guard<std::mutex> lock(reports_mutex);
+        std::string out;
+        for (const std::string& text : reports) out += text + "\n";
+        return out.empty() ? std::string("No stalls\n") : out;
+    });
+    std::thread(runWatchdog, stall_ms).detach();
+}
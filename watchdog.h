@@ -0,0 +1,63 @@
+/*
+Stall Watchdog
+
+Catches a reactor that stays inside one loop pass for too long (--stall-ms),
+and logs what it was doing: the phase of the pass, the session it was
+on, its queues, and a stack of the reactor thread taken right then.
+
+The reactor's side is a handful of relaxed stores per pass into its own
+LoopWatch (a heartbeat that is odd while a pass runs, the phase, the
+session), so it costs nothing while nothing stalls. The watchdog thread
+looks at every heartbeat a few times per threshold; one that stayed odd
+and unchanged for the whole threshold is a stall. The stack comes from
+the stalled thread itself: the watchdog signals it (SIGUSR2), and the
+handler only runs backtrace() into a buffer set aside for it. Names are
+looked up afterwards, on the watchdog thread.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <pthread.h>
+
+enum LoopPhase {
+    phase_idle,      // in select()
+    phase_inbox,     // running posted tasks
+    phase_accept,
+    phase_read,      // reading and handling a session's input
+    phase_handoff,   // flushOutgoing()
+    phase_write,     // flushing sessions' outboxes
+    phase_log,       // writing the history log
+    phase_broadcast, // inside broadcast() (from any of the above)
+    phase_deliver,   // inside deliver()
+    phase_count
+};
+
+// LoopWatch: one per reactor, written by the reactor only
+struct LoopWatch {
+    std::atomic<uint64_t> beat{0};     // +1 when a pass starts, +1 when it ends (odd = busy)
+    std::atomic<int> phase{phase_idle};
+    std::atomic<uint64_t> session{0};  // the session being read or written, 0 = none
+    std::atomic<uint32_t> sessions{0}; // connected to this reactor
+    pthread_t thread;
+
+    void set(LoopPhase next) { phase.store(next, std::memory_order_relaxed); }
+    void tick() { beat.store(beat.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+};
+
+// PhaseScope: marks a nested phase (broadcast, deliver), puts the outer one back after
+class PhaseScope {
+public:
+    PhaseScope(LoopWatch& watch, LoopPhase inner) : watch(watch), outer(watch.phase.load(std::memory_order_relaxed)) {
+        watch.set(inner);
+    }
+    ~PhaseScope() { watch.phase.store(outer, std::memory_order_relaxed); }
+
+private:
+    LoopWatch& watch;
+    int outer;
+};
+
+// startWatchdog(): watches every reactor (call once they're running); stall_ms = 0 leaves it off
+void startWatchdog(int stall_ms);
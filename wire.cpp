@@ -0,0 +1,113 @@
+/*
+Binary Wire Protocol (see wire.h)
+*/
+
+#include <mutex>
+#include <unordered_map>
+
+#include "wire.h"
+#include "record.h"
+
+namespace {
+
+// A name's id and how many holders it has (sessions logged in under it, rooms open by it)
+struct NameId {
+    uint32_t id;
+    uint32_t holders;
+};
+
+std::mutex names_mutex; // guards name_ids (taken at logins, room creation and when they end, not per message)
+std::unordered_map<std::string, NameId> name_ids;
+uint32_t last_id = 0;
+
+const size_t max_defined = 4096; // ids a session remembers sending, it's sent them again past that
+
+Frame defineFrame(uint32_t id, std::string_view name) {
+    std::string bytes = "D";
+    appendVarint(bytes, id);
+    appendVarint(bytes, name.size());
+    bytes.append(name.data(), name.size());
+    return std::make_shared<const std::string>(std::move(bytes));
+}
+
+} // namespace
+
+bool handleBinary(Reactor& r, Session& s) {
+    size_t at = 0;
+    while (!s.authenticating) { // records after a /login wait for its result
+        RecordStatus status = verifyRecord(s.inbuf.data() + at, s.inbuf.size() - at);
+        if (status == record_bad) return false; // corrupt or out of sync, nothing to resync on
+        if (status == record_partial) break;
+
+        RecordView record(s.inbuf.data() + at);
+        handleLine(r, s, std::string(record.payload()));
+        at += record.size();
+    }
+    // Whole records only, so what's left still starts 8-byte aligned
+    s.inbuf.erase(0, at);
+    return true;
+}
+
+Frame encodeBinaryMessage(const Message& message) {
+    std::string bytes;
+    if (!appendRecord(bytes, message.kind, message.seq, message.time_ns, message.channel, message.text, message.payload)) {
+        return nullptr;
+    }
+    return std::make_shared<const std::string>(std::move(bytes));
+}
+
+uint32_t nameId(const std::string& name) {
+    std::lock_guard<std::mutex> lock(names_mutex);
+    auto found = name_ids.find(name);
+    if (found == name_ids.end()) {
+        if (++last_id == 0) last_id = 1; // 0 is "no id"
+        found = name_ids.emplace(name, NameId{last_id, 0}).first;
+    }
+    found->second.holders++;
+    return found->second.id;
+}
+
+void releaseName(const std::string& name) {
+    std::lock_guard<std::mutex> lock(names_mutex);
+    auto found = name_ids.find(name);
+    if (found != name_ids.end() && --found->second.holders == 0) name_ids.erase(found);
+}
+
+Frame encodeCompactMessage(const Message& message) {
+    std::string bytes;
+    if (message.user_id != 0) {
+        std::string_view body = std::string_view(message.text).substr(message.body_at);
+        bytes = "M";
+        appendVarint(bytes, message.room_id);
+        appendVarint(bytes, message.user_id);
+        appendVarint(bytes, message.seq);
+        appendVarint(bytes, body.size());
+        bytes.append(body.data(), body.size());
+    } else {
+        bytes = "X";
+        bytes += (char)message.kind;
+        appendVarint(bytes, message.room_id);
+        appendVarint(bytes, message.seq);
+        appendVarint(bytes, message.text.size());
+        bytes += message.text;
+    }
+    return std::make_shared<const std::string>(std::move(bytes));
+}
+
+Frame epochFrame(uint64_t epoch) {
+    std::string bytes = "E";
+    appendVarint(bytes, epoch);
+    return std::make_shared<const std::string>(std::move(bytes));
+}
+
+void defineIds(Session& s, const Message& message) {
+    // Both names are in the message itself, no table lookup. A long session that has seen many
+    // names starts over: the client is told again the ones it still needs
+    if (s.defined.size() >= max_defined) s.defined.clear();
+    if (message.room_id != 0 && s.defined.insert(message.room_id).second) {
+        queueFrame(s, defineFrame(message.room_id, message.channel));
+    }
+    if (message.user_id != 0 && s.defined.insert(message.user_id).second) {
+        queueFrame(s, defineFrame(message.user_id, std::string_view(message.text).substr(0, message.body_at - 2)));
+    }
+}
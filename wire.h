@@ -0,0 +1,56 @@
+/*
+Binary Wire Protocol
+
+Clients that want records (record.h) instead of text lines open with
+the 8-byte wire_magic, then both directions are a stream of records:
+- client -> server: one record per line the chat protocol would send
+  (the username first, then messages and /commands), in the payload field
+- server -> client: every message as a record (their own included), plus replies as notices
+
+The record a binary client receives is byte-for-byte what the history
+log stores, seq included (so a client can keep its own history and ask
+for what it missed with /since, see client.cpp), encoded once per
+message and shared by every binary recipient.
+
+Compact wire: clients opening with wire_ids_magic send records the same
+way, but what they receive names users and rooms by number. The first
+time a connection needs an id it is sent the name, so each name crosses
+the wire once per connection instead of once per message:
+    define   'D' [varint id][varint size][name]
+    chat     'M' [varint room][varint user][varint seq][varint size][body]   (shown as "<user>: <body>")
+    other    'X' [u8 kind][varint room][varint seq][varint size][text]       (room 0 = not a room)
+    epoch    'E' [varint epoch]                                               (first thing sent)
+Ids come from one table for every name (users and rooms alike), held
+by the sessions and rooms using them. A name nothing holds any more is
+forgotten, and gets a new id if it comes back; ids aren't reused, so a
+definition a client has stays right for as long as it's used.
+
+The epoch names the numbering the seqs belong to: it stays the same while
+rooms keep numbering where they stopped (for as long as the server runs,
+and across restarts with --history-dir), and changes when they start over
+from 1. A client's marks (/since <seq>:<epoch> <room>) only count in it.
+*/
+
+#pragma once
+
+#include "server.h"
+
+// handleBinary(): handles every complete record in s.inbuf (false = drop the connection)
+bool handleBinary(Reactor& r, Session& s);
+
+// encodeBinaryMessage(): the message as one record
+Frame encodeBinaryMessage(const Message& message);
+
+// nameId(): the name's id on the compact wire, held until releaseName() (takes a lock, so callers
+// keep what they get)
+uint32_t nameId(const std::string& name);
+void releaseName(const std::string& name);
+
+// encodeCompactMessage(): the message as one 'M' or 'X' frame
+Frame encodeCompactMessage(const Message& message);
+
+// epochFrame(): the 'E' frame, the numbering epoch a compact session's seqs belong to
+Frame epochFrame(uint64_t epoch);
+
+// defineIds(): queues the definitions a compact session is missing for this message
+void defineIds(Session& s, const Message& message);